@@ -13,6 +13,11 @@
 #include <string>
 #include <array>
 #include <set>
+#include <fstream>
+#include <cstdint>
+#include <future>
+#include <condition_variable>
+#include <list>
 #include "pckcore.hpp"
 
 namespace mtx {
@@ -60,6 +65,124 @@ namespace mtx {
         bool isUndefined(const std::string& str);
     };
 
+    /* ============================================================================== *
+     * EdgeWriter class                                                               *
+     *                                                                                *
+     * Matches as an edge list, one (foreign, reference, similarity) row per match,   *
+     * written as the sweep finds them instead of piling up in the output's cells.    *
+     * Text lists are .csv files with both samples' keys (compressed the same way as  *
+     * the rest of the output, if it is). Binary ones (.mtxe) are a header (magic,    *
+     * version, flags, sample count, threshold) followed by 16-byte records: foreign  *
+     * row, reference row (32-bit, in the metadata's order) and similarity (float64). *
+     *                                                                                *
+     * mark() gets everything so far into the file and says how long it is, for the  *
+     * checkpoint; a resumed sweep opens the list again at that length and carries on *
+     * (compressed lists end their gzip member or zstd frame there).                  *
+     * ============================================================================== */
+
+    class Metadata;
+
+    class EdgeWriter {
+    public:
+        enum Format { none, text, binary };
+
+    private:
+        Format format;
+        pck::Packer::Format compression;
+        std::string path;
+        const std::vector<Metadata>* rows;
+        std::wfstream file;
+        pck::Packer packer;
+        std::wostream output;
+        std::ofstream raw;
+        std::string pending;    //binary records waiting to be written
+
+    public:
+        EdgeWriter();
+        ~EdgeWriter();
+
+        static std::string extension(Format format, pck::Packer::Format compression);
+        static const char* name(Format format);
+        bool open(const std::string& path, Format format, pck::Packer::Format compression, const std::vector<Metadata>& rows, double threshold, uint64_t length = 0);
+        void add(int foreign, int reference, double similarity);
+        uint64_t mark();
+        const std::string& getPath() const;
+        bool close();
+    };
+
+    /* ============================================================================== *
+     * DenseMatrix class                                                              *
+     *                                                                                *
+     * The whole cophenetic matrix: every sample's similarity to every other one      *
+     * (that of their lowest common ancestor, 0 across trees of a forest), meant for  *
+     * trees of up to some tens of thousands of samples. Samples go in the tree's     *
+     * depth-first order, so any node's samples are a single range; a block is        *
+     * filled by walking down the nodes that cover it and painting, for each child,   *
+     * its rows against the rest of its parent's range in one go. Tiles of the upper  *
+     * triangle are shared out between threads, each mirrored into the lower one.     *
+     *                                                                                *
+     * Binary files (.mtxd) are mapped and filled in place: a header (magic, version, *
+     * header size, sample count, then the offset of each array), the matrix itself   *
+     * (float32, row-major, samples x samples, 64-byte aligned), then each sample's   *
+     * metadata row (uint32, all ones if none), key offsets (uint64, samples + 1)     *
+     * and keys (UTF-8, back to back), 8-byte aligned. Text ones are a .csv with the  *
+     * keys across the top and down the side, compressed like the rest of the output. *
+     * ============================================================================== */
+
+    class TreeIndex;
+
+    class DenseMatrix {
+    public:
+        enum Format { none, binary, text };
+        static const int TILE = 128;    //tile side: 64 KB of float32, about a core's share of cache
+
+    private:
+        const TreeIndex& tree;
+        std::vector<int> childStart, children; //every node's children, in depth-first order
+
+        bool saveBinary(const std::string& path, const std::vector<uint32_t>& rows, const std::vector<std::string>& keys, unsigned threads) const;
+        bool saveText(const std::string& path, pck::Packer::Format compression, const std::vector<std::string>& keys, unsigned threads) const;
+
+    public:
+        DenseMatrix(const TreeIndex& tree);
+
+        static std::string extension(Format format, pck::Packer::Format compression);
+        static const char* name(Format format);
+        int getSamples() const;
+        void block(int r0, int r1, int c0, int c1, float* values, size_t stride) const;
+        bool save(const std::string& path, Format format, pck::Packer::Format compression, const std::vector<uint32_t>& rows,
+            const std::vector<std::string>& keys, unsigned threads) const;
+    };
+
+    /* ============================================================================== *
+     * RunConfig struct                                                               *
+     *                                                                                *
+     * Everything a single run of the Matrixinator needs to know. Every Matrixinator  *
+     * gets its own copy, so any number of them may be around at the same time.       *
+     * ============================================================================== */
+
+    struct RunConfig {
+        DisplayPaths paths;
+        bool overwrite = false;
+        bool detailed = false;
+        bool resume = false;    //pick the sweep up from the last checkpoint, if there's a usable one
+        bool columnar = false;  //binary columnar output (.mtxc) instead of .csv
+        bool compact = false;   //octagons kept as float32 instead of float64
+        pck::Packer::Format compression = pck::Packer::plain; //.csv output compressed on the fly (.csv.gz, .csv.zst)
+        EdgeWriter::Format edges = EdgeWriter::none; //matches in an edge list of their own, rather than in the output's cells
+        DenseMatrix::Format dense = DenseMatrix::none; //the whole similarity matrix too, for trees small enough to want it
+        double pairCutoff = 0;  //every sample pair at least this similar, in a sparse matrix (.mtxs) of its own; 0 = none
+        unsigned threads = 0;   //threads for reading and sweeping, 0 = one per hardware thread
+        std::vector<double> thresholds = { 80 }; //similarity cutoffs, one output each; the first one's is "the" result
+
+        bool ioDefined();
+        bool setThresholds(const std::string& list);
+        std::string thresholdList() const;
+        bool setPairCutoff(const std::string& value);
+        bool setInputs(const std::filesystem::path& tree, const std::filesystem::path& meta);
+        unsigned sweepThreads() const;
+    };
+
     /* ============================================================================== *
      * MatrixConfig class                                                             *
      *                                                                                *
@@ -68,8 +191,18 @@ namespace mtx {
      * Framework, where it may be properly configured and visualized.                 *
      *                                                                                *
      * Here is the starting point for the execution of the Matrixinator.              *
+     *                                                                                *
+     * As soon as both input files are picked, they're read and indexed in the        *
+     * background while the rest is being configured, so "Initialize program" can go  *
+     * straight to the sweep. Picking other ones drops that load and starts another.  *
+     *                                                                                *
+     * Runs go to the framework's JobRunner, so the menus stay up while they work:    *
+     * several may be going (or waiting their turn) at once, each with the settings   *
+     * it was started with, and they carry on after going back to Peacock.            *
      * ============================================================================== */
 
+    class Matrixinator;
+
     class MatrixConfig : public pck::Menu {
     private:
 
@@ -80,24 +213,36 @@ namespace mtx {
 
         void toggleOverwrite();
         void toggleDetailed();
+        void toggleResume();
+        void toggleColumnar();
+        void toggleCompact();
+        void cycleCompression();
+        void cycleEdges();
+        void cycleDense();
         void setFolders();             //folder search menu
+        void showFiles();              //folder menu's current picks
+        void askThresholds();          //similarity thresholds prompt
+        void askPairCutoff();          //pair matrix cutoff prompt
+        void preload();                //reads the selected inputs in the background
+        void runBatch();               //batch manifest prompt and status screen
+        void runService();             //query service status screen
         bool checkFile(bool);
         void parseopt(int& option);
         void statistiks();
         void printheader();
 
     protected:
-        static DisplayPaths paths;
-        static bool overwrite;
-        static bool detailed;
+        static RunConfig session;      //what the menus configure, handed over to each run
+        static std::unique_ptr<Matrixinator> preloaded;            //the selected inputs, read ahead of "Initialize program"
 
         bool isIOdefined();
 
     public:
         MatrixConfig();
-        MatrixConfig(std::string tf, std::string mf, std::string rf, bool ow = false, bool dt = false);
+        MatrixConfig(std::string tf, std::string mf, std::string rf, bool ow = false, bool dt = false, bool rs = false, bool cl = false);
 
         void mtxMenu();
+        static void closeAll();        //waits for the runs let go of, before leaving the program
     };
 
     /* ============================================================================== *
@@ -112,14 +257,14 @@ namespace mtx {
      * Key, Location, CollectionDate, Company, FSGID, Farm, Age_days, SampleOrigin,   *
      * SampleType, VMP, ibeA, traT, iutA, ompT, sitA, irp2, cvaC, tsh, iucC, iss.     *
      *                                                                                *
-     * The 8 octagon fields are:                                                      *
-     * BS22, BS15, BS3, BS8, BS27, BS84, BS18, BS278.                                 *
+     * Octagons don't live here, see OctagonMatrix.                                   *
      * ============================================================================== */
 
     class Metadata {
         friend class Matrixinator;
+        friend class QueryService;
+        friend class EdgeWriter;
     private:
-        std::vector<double> octagon;
         std::vector<std::wstring> data;
         std::vector<std::pair<std::wstring, double>> usaMatches;
         int nodeNumber;
@@ -128,9 +273,6 @@ namespace mtx {
         Metadata();
 
         void setData(const std::vector<std::wstring> datafield);
-        void setOctagon(const std::vector<double> origin);
-        void setOctagon(const double *vals);
-        void setOctagon(std::array<double, 8> origin);
         void appendMatch(std::wstring id, double sim);
         void appendMatch(std::pair<std::wstring, double> origin);
         void clearMatches() { usaMatches.clear(); }
@@ -138,10 +280,7 @@ namespace mtx {
 
         std::vector<std::pair<std::wstring, double>> getMatches();
         std::vector<std::wstring> getData();
-        std::vector<double> getOctagon();
         int getNode();
-        bool nullOct();
-        void copyOct(const Metadata& origin);
 
     };
 
@@ -159,10 +298,12 @@ namespace mtx {
 
     class Tree {
         friend class Matrixinator;
+        friend class TreeIndex;
+        friend class PairMatrix;
+        friend class DenseMatrix;
     private:
         std::pair<int, int> IDs; //ID and parentID
         double similarity;
-        std::set<int> childList;
         bool sample;
 
     public:
@@ -172,16 +313,272 @@ namespace mtx {
         void setIDs(int, int);
         void setIDs(std::pair<int, int>);
         void setSim(double);
-        void addChild(int);
         void makeSample();
 
         int getID();
         int getParentID();
         double getSim();
-        std::set<int> getChildren();
         bool isSample();
     };
 
+    /* ============================================================================== *
+     * TreeIndex class                                                                *
+     *                                                                                *
+     * A whole dendrogram, loaded and laid out, ready to be swept. It doesn't depend  *
+     * on the metadata at all, so once built it's read-only and may be shared by as   *
+     * many runs as needed.                                                           *
+     *                                                                                *
+     * Samples are laid out in depth-first order, so every node covers a single       *
+     * range of them, and every node can jump up the tree in powers of two, knowing   *
+     * the lowest similarity along the way. Together they find how far up a sample    *
+     * stays above a similarity threshold in log time, and who's below that point.    *
+     * ============================================================================== */
+
+    class TreeIndex {
+        friend class Matrixinator;
+        friend class PairMatrix;
+        friend class DenseMatrix;
+    private:
+        std::vector<Tree> acacia;
+        int numNodes;
+
+        int levels;                     //powers of two in the jump table
+        std::vector<int> lift;          //[level * (numNodes + 1) + node]: 2^level-th ancestor, 0 if none
+        std::vector<double> liftMin;    //lowest similarity among those 2^level ancestors
+        std::vector<int> depth;         //root(s) at 0, fictional node 0 at -1
+        std::vector<int> position;      //a sample's place in depth-first order, -1 for other nodes
+        std::vector<int> first, last;   //range of sample positions below each node, last excluded
+        std::vector<int> joins;         //[q]: lowest common ancestor of the samples at q and q + 1
+        std::vector<std::string> labels; //leaf names by node, only from tree files that have them (Newick)
+
+        void load(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled, unsigned threads);
+        void loadNewick(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled);
+        void layout(const std::atomic<bool>* cancelled);
+        int parentOf(int node) const;
+        int ancestor(int node, int atDepth) const;
+        int common(int a, int b) const;
+
+    public:
+        TreeIndex();
+
+        static std::shared_ptr<const TreeIndex> build(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled = nullptr,
+            unsigned threads = 1);
+        int highest(int node, double threshold) const;
+        int getNumNodes() const;
+        int getNumSamples() const;
+    };
+
+    //hands a run its tree index for a given dendrogram file, possibly one that's shared, loading it with up to the
+    //given number of threads; loading stops (throwing closing code 3) once the flag, if there's one, is set
+    typedef std::function<std::shared_ptr<const TreeIndex>(const std::string&, pck::Progress&, const std::atomic<bool>*, unsigned)> TreeSource;
+
+    /* ============================================================================== *
+     * TreeCache class                                                                *
+     *                                                                                *
+     * Keeps the last few tree indexes built in this session around, keyed by the     *
+     * dendrogram file's identity (path, size and modification time), so sweeping     *
+     * another metadata sheet against the same tree skips loading it all over again.  *
+     * Concurrent requests for the same tree wait for a single build.                 *
+     * ============================================================================== */
+
+    class TreeCache {
+    private:
+        struct Slot {
+            std::string key;        //canonical path
+            uintmax_t size;
+            long long stamp;
+            unsigned long long used;
+            std::shared_future<std::shared_ptr<const TreeIndex>> index;
+        };
+
+        static std::mutex lock;
+        static std::vector<Slot> slots;
+        static unsigned long long clock;
+
+    public:
+        static size_t capacity;     //trees kept at most
+
+        static std::shared_ptr<const TreeIndex> get(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled = nullptr,
+            unsigned threads = 1);
+        static bool has(const std::string& file);
+        static void drop(const std::string& file);
+        static void clear();
+    };
+
+    /* ============================================================================== *
+     * PairMatrix class                                                               *
+     *                                                                                *
+     * Every pair of samples at least as similar as a cutoff, straight from the tree, *
+     * as a sparse matrix in CSR form: two samples pair up when their lowest common   *
+     * ancestor is at least that similar, and the value is the ancestor's similarity  *
+     * (the dense matrix's entries from the cutoff up). Samples are numbered in the   *
+     * tree's depth-first order, so a sample's partners through any one ancestor are  *
+     * a range on either side of the branch it's on. Ancestors that make the cutoff   *
+     * are chained up the tree, so counting every row's pairs takes time linear in    *
+     * nodes, and listing one takes time in its pairs and the ancestors they go by.   *
+     *                                                                                *
+     * Files (.mtxs) are made to be mapped as they are: a header (magic, version,     *
+     * header size, sample count, pair count, cutoff, then the offset of each array), *
+     * followed by the arrays, each starting 8-byte aligned: row pointers (uint64,    *
+     * samples + 1), column indices (uint32, pairs), values (float32, pairs),         *
+     * metadata rows (uint32 per sample, all ones if none), key offsets (uint64,      *
+     * samples + 1) and the keys themselves (UTF-8, back to back).                    *
+     * ============================================================================== */
+
+    class PairMatrix {
+    private:
+        const TreeIndex& tree;
+        double cutoff;
+        std::vector<int> nodes;         //sample nodes, by position
+        std::vector<int> up;            //by node: closest ancestor at least as similar as the cutoff, 0 if none
+        std::vector<uint64_t> offsets;  //row pointers
+
+    public:
+        PairMatrix(const TreeIndex& tree, double cutoff);
+
+        uint64_t getPairs() const;
+        void row(int position, std::vector<uint32_t>& columns, std::vector<float>& values) const;
+        bool save(const std::string& path, const std::vector<uint32_t>& rows, const std::vector<std::string>& keys) const;
+    };
+
+    /* ============================================================================== *
+     * Checkpoint class                                                               *
+     *                                                                                *
+     * Keeps the sweep's results on disk as it goes, so a run that dies can pick up   *
+     * where it left off instead of starting over.                                    *
+     *                                                                                *
+     * The file is a header (magic + fingerprint of the inputs) followed by blocks,   *
+     * each one holding every foreign sample's results for a range of rows (matches   *
+     * going to edge lists aren't kept, only how long each list was by then). Blocks  *
+     * are only ever appended; a block cut short by a crash is simply ignored. A      *
+     * run only writes to a file it created itself, or to one it resumed from, and    *
+     * files are named after their run's inputs and settings.                         *
+     * ============================================================================== */
+
+    class Checkpoint {
+    public:
+        struct Entry {
+            int row;
+            int level;          //which of the run's thresholds
+            bool predicted;
+            std::array<double, 8> octagon;
+            std::vector<std::pair<int, double>> matches; //reference row and similarity
+        };
+        struct List {           //an edge list, as far as a block got with it
+            std::string path;
+            uint64_t length;
+        };
+        static constexpr int interval = 30; //seconds between saves
+
+    private:
+        std::string file;
+        uint64_t fingerprint;
+        std::ofstream out;
+        std::string pending;    //encoded entries not saved yet
+        int from;               //first row not saved yet
+        uint32_t count;         //entries in pending
+        bool restored;          //restore() found a file for these inputs, so it's this run's to carry on
+        std::chrono::time_point<std::chrono::steady_clock> lastSave;
+
+    public:
+        Checkpoint(const std::string& file, uint64_t fingerprint);
+
+        static uint64_t hash(uint64_t seed, const void* data, size_t len);
+
+        int restore(const std::function<void(const Entry&)>& apply, std::vector<List>& lists);
+        bool start(int row);
+        void record(int row, int level, const double* octagon, const std::vector<int>& matches, const std::vector<double>& sims);
+        bool due() const;
+        void save(int row, const std::vector<List>& lists);
+    };
+
+    /* ============================================================================== *
+     * ColumnarWriter class                                                           *
+     *                                                                                *
+     * Builds the binary columnar output (.mtxc), laid out so other tools can map it  *
+     * straight into memory. Little-endian, every section 8-byte aligned:             *
+     *                                                                                *
+     *   header   "MTXCOL01", u32 version, u32 header size, u64 rows, u32 sections,   *
+     *            u32 flags (1 = detailed), f64 threshold                             *
+     *   table    per section: u32 kind, u32 columns, u64 offset, u64 size, and a     *
+     *            32-byte zero-padded name                                            *
+     *   text     u32 entries, u32 0, u64 offsets[entries + 1] into the blob,         *
+     *            u32 codes[rows], then the blob of every distinct value              *
+     *   others   plain arrays of the kind's type, rows * columns long                *
+     *                                                                                *
+     * Variable-length rows go in three sections: NAME.offsets (u64, rows + 1), and   *
+     * the flat NAME.keys (codes into the Key column) and NAME.similarity arrays.     *
+     * ============================================================================== */
+
+    class ColumnarWriter {
+    public:
+        enum class Kind : uint32_t { text = 1, float64 = 2, uint8 = 3, uint32 = 4, uint64 = 5 };
+
+    private:
+        struct Section {
+            std::string name;
+            Kind kind;
+            uint32_t columns;
+            std::string data;
+        };
+
+        uint64_t rows;
+        double threshold;
+        bool detailed;
+        std::vector<Section> sections;
+
+        void add(const std::string& name, Kind kind, uint32_t columns, std::string&& data);
+
+    public:
+        ColumnarWriter(uint64_t rows, double threshold, bool detailed);
+
+        void addText(const std::string& name, const std::vector<std::string>& column);
+        void addMatrix(const std::string& name, const std::vector<double>& values, uint32_t columns);
+        void addBytes(const std::string& name, const std::vector<uint8_t>& values);
+        void addMatches(const std::string& name, const std::vector<uint64_t>& offsets, const std::vector<uint32_t>& keys, const std::vector<double>& sims);
+        bool save(const std::string& path);
+    };
+
+    /* ============================================================================== *
+     * OctagonMatrix class                                                            *
+     *                                                                                *
+     * Every row's 8 octagon values, in one row-major block instead of a vector per   *
+     * sample, plus a bit per row saying whether it has any. They're doubles, unless  *
+     * the matrix is compact: then they're floats, half the memory and twice as many  *
+     * per SIMD register, which the lab values' few significant digits can afford.    *
+     * Either way, predictions are added up in double.                                *
+     *                                                                                *
+     * The 8 octagon fields are:                                                      *
+     * BS22, BS15, BS3, BS8, BS27, BS84, BS18, BS278.                                 *
+     *                                                                                *
+     * Rows may be set from several threads at once, as long as it's different rows.  *
+     * ============================================================================== */
+
+    class OctagonMatrix {
+    private:
+        std::vector<double> wide;                       //rows * 8, unless compact
+        std::vector<float> narrow;                      //rows * 8, if compact
+        std::vector<std::atomic<uint64_t>> present;     //a bit per row
+        size_t rows;
+        bool compact;
+
+        template<class T>
+        static void accumulate(const T* values, const std::vector<int>& picks, const std::vector<double>& weights, double* sums);
+
+    public:
+        OctagonMatrix();
+
+        void reset(size_t rows, bool compact);
+        void grow(size_t rows);
+        void set(size_t row, const double* values);
+        void get(size_t row, double* values) const;
+        void erase(size_t row);
+        void weigh(const std::vector<int>& picks, const std::vector<double>& weights, double* sums) const;
+        bool has(size_t row) const { return (present[row >> 6].load(std::memory_order_relaxed) >> (row & 63)) & 1; }
+        size_t size() const { return rows; }
+        bool isCompact() const { return compact; }
+    };
+
     /* ============================================================================== *
      * Matrixinator class                                                             *
      *                                                                                *
@@ -189,32 +586,197 @@ namespace mtx {
      * and uses that info to work. That's it.                                         *
      * ============================================================================== */
 
-    class Matrixinator : private MatrixConfig {
+    class Matrixinator {
+        friend class QueryService;
     private:
+        struct Outcome {        //results at one of the extra thresholds; the first one's go straight into SS and octagons
+            OctagonMatrix octagons;
+            std::vector<std::vector<std::pair<int, double>>> matches; //reference row and similarity, detailed only
+        };
+
+        RunConfig config;
+        TreeSource source;
+        std::shared_ptr<const TreeIndex> tree;
         std::vector<Metadata> SS;
-        std::vector<Tree> acacia;
+        OctagonMatrix octagons;                     //by SS row: measured ones, and predictions at the first threshold
         std::vector<int> USAsamples;
+        std::vector<std::pair<int, int>> refOrder;  //sample position and row of every reference on the tree, by position
+        std::vector<int> refJoins;                  //[j]: highest join between refOrder[j] and refOrder[j + 1]
+        std::vector<int> strays;                    //reference rows that aren't on the tree
+        std::vector<Outcome> outcomes;
+        std::vector<std::unique_ptr<EdgeWriter>> edgeLists; //one per threshold while sweeping, if there's an edge list
         int numNodes;
         int numSamples;
-        std::chrono::time_point<std::chrono::steady_clock> beg; //benchmarking
-        std::chrono::time_point<std::chrono::steady_clock> end;
+        pck::Progress progress;
+        std::string failure;    //what() of the exception that stopped the run, if any
+        std::thread loader;     //reads the inputs ahead of run(), once preload() is called
+        std::atomic<bool> cancelled{ false };
+        int reached;            //phases done so far, by the loader or an earlier run()
+        int loadCode;
+        long long inputStamp;   //the inputs' sizes and modification times when preloading started
+        std::string checkpointFile; //the checkpoint this run saves to, if it got one of its own
 
         void init();
+        bool readSheet(const char* data, size_t size, bool header);
         void postinit();
         void sweep();
         void output();
-        void closing(int code, WINDOW* mtxcon);
-
-        void bulldozer(int node);
-        double bullSim(int node, int origin);
-        bool isUS(int id);
+        void writeOutput(int level);
+        void writeColumnar(int level);
+        void writePairs();
+        void writeDense();
+        void sampleKeys(std::vector<uint32_t>& rows, std::vector<std::string>& keys);
+        std::string outputSuffix(int level);
+        std::string outputPath(int level, const std::string& extension);
+        std::string outputPath(const std::string& suffix, const std::string& extension);
+        std::string checkpointPath();
+        std::string metaStem();
+        bool matchCells() const;
+        uint64_t inputFingerprint();
+        int runPhases(int upTo);
+        long long stampInputs(const RunConfig& config) const;
+
+        void findMatches(int foreign, const std::vector<double>& thresholds, std::vector<std::vector<int>>& matches, std::vector<std::vector<double>>& similarities) const;
+        int findMatches(int foreign, double threshold, std::vector<int>& matches, std::vector<double>& similarities) const;
+        void blend(const std::vector<int>& matches, const std::vector<double>& similarities, std::array<double, 8>& octagon) const;
+        int sweepRow(int foreign, std::vector<std::vector<int>>& matches, std::vector<std::vector<double>>& similarities);
 
     public:
-        Matrixinator();
+        Matrixinator(const RunConfig& config, TreeSource source = nullptr);
+        ~Matrixinator();
 
         static std::vector<std::wstring> w_sliceNsplice(const std::wstring& wstr, char delim = ' ');
-        void mainSequence();
+        static std::string w_narrow(const std::wstring& wstr);
+        const pck::Progress& getProgress() const;
+        const std::string& getFailure() const;
+        int run(int upTo = 4);
+        void preload();
+        void cancel();
+        bool sameInputs(const RunConfig& config) const;
+        bool adopt(const RunConfig& config);
+        static const char* explain(int code);
+    };
+
+    /* ============================================================================== *
+     * BatchScheduler class                                                           *
+     *                                                                                *
+     * Runs a whole manifest of Matrixinator jobs, several at once, without going     *
+     * over a global thread and memory budget. Jobs on the same dendrogram share its  *
+     * tree index through the TreeCache, so it's only ever built once.                *
+     *                                                                                *
+     * Manifest lines are "tree, metadata[, option...]", options being overwrite,     *
+     * detailed, resume, columnar, compact, compress=gzip|zstd, edges=text|binary,    *
+     * pairs=T (the pair matrix's cutoff), dense=binary|text, threads=N and           *
+     * thresholds=T1/T2/... Lines "threads = N" and "memory = MB" set the budgets;    *
+     * # starts a comment. Relative paths start at the manifest's folder.             *
+     * ============================================================================== */
+
+    class BatchScheduler {
+    public:
+        enum class State { queued, running, finished };
+        struct Job {
+            RunConfig config;
+            std::string label;
+            std::string treeFile;       //canonical, so jobs on the same tree agree on it
+            size_t memory = 0;          //estimated footprint, tree excluded
+            size_t treeMemory = 0;      //estimated footprint of the tree index, paid once per tree
+            State state = State::queued;
+            int code = 0;
+            std::string failure;
+            std::chrono::time_point<std::chrono::steady_clock> started;
+            std::chrono::time_point<std::chrono::steady_clock> ended;
+            std::unique_ptr<Matrixinator> mtx;
+        };
+
+    private:
+        std::vector<Job> jobs;
+        unsigned threadBudget;
+        size_t memoryBudget;
+        std::mutex lock;
+        std::condition_variable changed;
+        std::set<std::string> treesCounted;     //trees already paid for in the memory budget
+        std::map<std::string, int> treeUsers;   //jobs on each tree that haven't finished yet
+
+        bool admissible(const Job& job, unsigned threads, size_t memory, int running) const;
+        size_t cost(const Job& job) const;
+
+    public:
+        BatchScheduler();
+
+        static size_t physicalMemory();
+        bool load(const std::string& manifest, std::string& error);
+        void run(const std::function<void()>& tick);
+
+        std::vector<Job>& getJobs();
+        std::mutex& getLock();
+        unsigned getThreadBudget() const;
+        size_t getMemoryBudget() const;
+    };
+
+    /* ============================================================================== *
+     * QueryService class                                                             *
+     *                                                                                *
+     * Keeps one run's inputs loaded and indexed (but never swept), and answers for   *
+     * single samples over a local socket in about the time it takes to sweep a row.  *
+     *                                                                                *
+     * One request per line, one answer per line, comma separated like the sheets:    *
+     *   predict,KEY        -> ok,KEY,measured|predicted|none[,8 octagon values]      *
+     *   matches,KEY[,MIN]  -> ok,KEY,N[,MatchKey=Similarity...]                      *
+     *   reload             -> ok,reloaded,ROWS                                       *
+     *   status             -> ok,ROWS,REFERENCES,NODES,GENERATION                    *
+     *   shutdown           -> ok,bye                                                 *
+     * MIN and predictions go by the run's first threshold unless told otherwise.     *
+     * Anything else gets "err,<reason>". Reloads are swapped in whole once they're   *
+     * loaded, so queries never wait on them and never see half of one.               *
+     * ============================================================================== */
+
+    class QueryService {
+    private:
+        struct Snapshot {
+            std::unique_ptr<Matrixinator> mtx;      //init and postinit only
+            std::unordered_map<std::wstring, int> rows; //key -> row, first one wins
+            std::vector<char> reference;
+            long long generation;
+        };
+        struct Client {
+            uintptr_t socket;
+            std::thread thread;
+            std::atomic<bool> done{ false };
+        };
+
+        RunConfig config;
+        std::string socketPath;
+        std::shared_ptr<const Snapshot> current;    //only through std::atomic_load/atomic_store
+        std::atomic<bool> reloading, stopping, running;
+        std::atomic<long long> served;
+        uintptr_t server;
+        std::thread listener;
+        std::mutex clientsLock;
+        std::list<Client> clients;
+
+        std::shared_ptr<const Snapshot> load(long long generation, std::string& error);
+        std::string answer(const std::string& request);
+        void serve(Client& client);
+        void listen();
+
+    public:
+        QueryService(const RunConfig& config, const std::string& socketPath = "");
+        ~QueryService();
+
+        static std::string defaultSocket();
+        static int daemon(int argc, char** argv);
+
+        bool start(std::string& error);
+        void stop();
+        bool isRunning() const;
+        bool isReloading() const;
+        long long getServed() const;
+        long long getGeneration() const;
+        const std::string& getSocket() const;
     };
 }
 
+//the Matrixinator's plugin entry point, for the PluginRegistry
+extern "C" const PckPlugin* mtx_plugin_entry(void);
+
 #endif //MATRIXINATOR_HPP
\ No newline at end of file
@@ -33,6 +33,42 @@
 #include <thread>
 #include <chrono>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <streambuf>
+#include <string_view>
+#include <iterator>
+#include <fstream>
+#include <deque>
+#include <condition_variable>
+#include <cstdint>
+
+/* The plugin ABI. A plugin library exports a plain C entry point (pck_plugin_entry, unless its manifest says
+ * otherwise) that hands back a PckPlugin whose abi is PCK_PLUGIN_ABI. run() gets the terminal, curses and all,
+ * until the user goes back; anything but 0 means it couldn't start. Plugins share the framework's own services
+ * (Screen, JobRunner, FileIndex, curses itself), so they're built with the same compiler and runtime, against
+ * the same headers: the ABI number only catches a plugin built against older ones. See PluginRegistry. */
+#define PCK_PLUGIN_ABI 1
+#ifdef _WIN32
+#define PCK_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define PCK_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+extern "C" {
+	typedef struct PckPlugin {
+		uint32_t abi;
+		const char* name;
+		int (*run)(void);
+	} PckPlugin;
+
+	typedef const PckPlugin* (*PckPluginEntry)(void);
+}
 
 namespace pck {
 	constexpr char PCKRELEASE[] = "Beta\0";
@@ -60,6 +96,10 @@ namespace pck {
 	void sleep(const unsigned);
 	void initcolors();
 	std::vector<std::string> sliceNsplice(const std::string& str, char delim);
+	const char* scanFor(const char* from, const char* end, char ch);
+	const wchar_t* scanFor(const wchar_t* from, const wchar_t* end, wchar_t ch);
+	bool hasExtension(const std::filesystem::path& file, const std::string& extension);
+	bool hasPackedExtension(const std::filesystem::path& file, const std::string& extension);
 
 	void wprinterr(WINDOW* win, const char* message, ...);
 	void wprintok(WINDOW* win, const char* message, ...);
@@ -68,43 +108,304 @@ namespace pck {
 	void spinner(int duration, WINDOW* scr = stdscr); //ME FANCY HURR DURR
 
 
+	/* ============================================================================== *
+	 * Tokens class                                                                   *
+	 *                                                                                *
+	 * Splits a string on a delimiter without copying or allocating anything: it's a  *
+	 * range of string views into the original, which has to outlive it. Delimiters  *
+	 * are found with scanFor(), 16 or 32 bytes at a time (SSE2 or AVX2, whichever    *
+	 * the CPU has).                                                                  *
+	 *                                                                                *
+	 * By default empty fields are skipped, like sliceNsplice does. With keepInner,   *
+	 * the ones between two delimiters are kept and only an empty first or last       *
+	 * field is dropped, like w_sliceNsplice does.                                    *
+	 * ============================================================================== */
+
+	template<class Ch>
+	class BasicTokens {
+		typedef std::basic_string_view<Ch> view;
+		const Ch* first;
+		const Ch* last;
+		Ch delim;
+		bool keepInner;
+
+	public:
+		class iterator {
+			const BasicTokens* owner = nullptr;
+			const Ch* next = nullptr;         //where the field after this one starts
+			view field;
+			bool done = true;
+
+			void advance()
+			{
+				while (!done) {
+					if (next == nullptr) {
+						done = true;
+						return;
+					}
+					const Ch* start = next;
+					const Ch* stop = scanFor(start, owner->last, owner->delim);
+					next = (stop < owner->last) ? stop + 1 : nullptr;
+					field = view(start, stop - start);
+
+					if (!field.empty())
+						return;
+					if (owner->keepInner && start != owner->first && next != nullptr)
+						return;
+				}
+			}
+
+		public:
+			typedef std::input_iterator_tag iterator_category;
+			typedef view value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const view* pointer;
+			typedef const view& reference;
+
+			iterator() {}
+			iterator(const BasicTokens* owner) : owner(owner), next(owner->first), done(false) { advance(); }
+
+			const view& operator*() const { return field; }
+			const view* operator->() const { return &field; }
+			iterator& operator++() { advance(); return *this; }
+			iterator operator++(int) { iterator old = *this; advance(); return old; }
+			bool operator==(const iterator& other) const { return done == other.done && (done || next == other.next); }
+			bool operator!=(const iterator& other) const { return !(*this == other); }
+		};
+
+		BasicTokens(view str, Ch delim, bool keepInner = false)
+			: first(str.data()), last(str.data() + str.size()), delim(delim), keepInner(keepInner) {}
+
+		iterator begin() const { return (first == last) ? iterator() : iterator(this); }
+		iterator end() const { return iterator(); }
+	};
+
+	typedef BasicTokens<char> Tokens;
+	typedef BasicTokens<wchar_t> WTokens;
+
+	/* ============================================================================== *
+	 * Progress class                                                                 *
+	 *                                                                                *
+	 * Lock-free channel for a worker thread to tell the UI thread how it's doing.    *
+	 * The worker calls begin() once per phase and advance() as it goes, preferrably *
+	 * in batches; the UI polls the getters whenever it feels like redrawing.         *
+	 * Counters sit on their own cache lines so polling never slows the worker down.  *
+	 * ============================================================================== */
+
+	class Progress {
+		alignas(64) std::atomic<long long> done;
+		alignas(64) std::atomic<long long> matched;
+		alignas(64) std::atomic<long long> total;
+		std::atomic<long long> started; //steady clock ticks at the start of the phase
+		std::atomic<int> phase;
+		std::atomic<bool> finished;
+
+	public:
+		Progress();
+
+		void begin(int phase, long long total = 0);
+		void setTotal(long long total);
+		void advance(long long count, long long matches = 0)
+		{
+			done.fetch_add(count, std::memory_order_relaxed);
+			if (matches)
+				matched.fetch_add(matches, std::memory_order_relaxed);
+		}
+		void finish();
+
+		int getPhase() const;
+		bool isFinished() const;
+		long long getDone() const;
+		long long getTotal() const;
+		long long getMatched() const;
+		double elapsed() const;
+		double rate() const;
+		double eta() const;
+	};
+
+	/* ============================================================================== *
+	 * JobRunner class                                                                *
+	 *                                                                                *
+	 * Runs utilities' jobs on worker threads of its own, so the menus never wait on  *
+	 * them. A job is a Task: run() does the work and hands back its closing code     *
+	 * (0 being OK), and a Task that keeps a Progress lets the status panel follow    *
+	 * it. Jobs wait their turn in submission order until a worker is free.           *
+	 *                                                                                *
+	 * Nothing in here touches curses: the UI thread asks for a snapshot() whenever   *
+	 * it redraws (Menu::showJobPanel). A finished job's Task is let go right away,   *
+	 * along with whatever it held; only its outcome is kept, for the last few.       *
+	 * ============================================================================== */
+
+	class JobRunner {
+	public:
+		enum class State { queued, running, finished };
+
+		class Task {
+		public:
+			virtual ~Task() {}
+			virtual int run(std::string& failure) = 0;         //on a worker thread; "failure" says what went wrong, if anything
+			virtual const Progress* getProgress() const { return nullptr; }
+			virtual const char* phaseName(int /*phase*/) const { return "running"; }
+			virtual void cancel() {}                            //from any thread; it's up to run() to notice
+		};
+
+		struct Status {
+			int id;
+			std::string label;
+			State state;
+			int code;
+			std::string failure;
+			std::string phase;
+			long long done, total;
+			double rate;                //phase items per second
+			double seconds;             //since it started, or how long it took
+		};
+
+	private:
+		struct Job {
+			int id;
+			std::string label;
+			std::unique_ptr<Task> task; //gone once it's finished
+			State state;
+			int code;
+			std::string failure;
+			std::chrono::time_point<std::chrono::steady_clock> started;
+			std::chrono::time_point<std::chrono::steady_clock> ended;
+		};
+
+		static const size_t keptFinished = 20;
+
+		std::deque<Job> jobs;           //in submission order
+		std::vector<std::thread> workers;
+		unsigned maxWorkers;
+		int nextId;
+		bool stopping;
+		std::mutex lock;
+		std::condition_variable changed;
+
+		void work();
+		Job* find(int id);
+
+	public:
+		JobRunner(unsigned workers = 2);
+		~JobRunner();
+		JobRunner(const JobRunner&) = delete;
+		JobRunner& operator=(const JobRunner&) = delete;
+
+		static JobRunner& shared();
+		int submit(const std::string& label, std::unique_ptr<Task> task);
+		std::vector<Status> snapshot();
+		int active();
+		void shutdown();
+	};
+
+	/* ============================================================================== *
+	 * Screen class                                                                   *
+	 *                                                                                *
+	 * What the terminal should look like, kept by the framework instead of redrawn   *
+	 * from scratch: menus and config screens print into it, and flush() hands curses *
+	 * only the cells that actually changed. Every write marks the columns it touched *
+	 * on its row; flush() holds those up against what stdscr has and sends only the  *
+	 * differences, so moving a cursor or flipping a flag costs a few bytes, even     *
+	 * over a slow connection. erase() starts a new frame, checked cell by cell.      *
+	 *                                                                                *
+	 * Prompts and windows of their own may still use curses directly: nothing here   *
+	 * assumes the terminal matches the model, only the cells it's told to draw. If   *
+	 * something covered stdscr (a window since deleted, a plugin), invalidate() has  *
+	 * the next flush() repaint everything. resize() follows the terminal's new size, *
+	 * never below the menus' minimum.                                                *
+	 * ============================================================================== */
+
+	class Screen {
+		std::vector<chtype> cells;    //rows * cols
+		std::vector<int> dirtyFrom;   //per row, first column written since the last flush
+		std::vector<int> dirtyTo;     //per row, one past the last one; nothing if it's not past dirtyFrom
+		int rows, cols;
+		bool everything;              //next flush repaints it all
+
+		Screen();
+		void fit();
+		void mark(int y, int from, int to);
+
+	public:
+		Screen(const Screen&) = delete;
+		Screen& operator=(const Screen&) = delete;
+
+		static Screen& shared();
+		int height();
+		int width();
+		void erase();
+		void erase(int y, int x = 0);
+		int print(int y, int x, const std::string& text, chtype attr = A_NORMAL);
+		int printf(int y, int x, chtype attr, const char* format, ...);
+		void paint(int y, int x, int length, chtype attr);
+		void flush();
+		void invalidate();
+		void resize(int minY, int minX);
+	};
+
 	/* ============================================================================== *
 	 * Menu class                                                                     *
 	 *                                                                                *
-	 * Auxiliary superclass for other classes' integrated menus.                      *
+	 * Auxiliary superclass for other classes' integrated menus. They draw into the   *
+	 * Screen, so each keystroke only repaints the options it changed.                *
+	 *                                                                                *
+	 * While waiting on a key, menus keep the JobRunner's status panel up to date on  *
+	 * the screen's last jobRows lines, a few times a second. Until the first job     *
+	 * comes in, there's no panel at all.                                             *
 	 * ============================================================================== */
 	class Menu {
 	public:
 		static const int minX = 120;
 		static const int minY = 30;
+		static const int jobRows = 6;     //status panel, header line included
+		static const int tickMs = 250;    //how long a menu waits on a key before redrawing the panel
 		const std::vector<int> selectkeys = { KEY_RIGHT, KEY_ENTER, '\n', '\r', PADENTER };
 
 		void menu(const int startY, const std::vector<std::string>& options, const bool isMain = false);
 		void updatepos(int& curpos, const int& newpos, const int& startY, const std::vector<std::string>& opts, int jumps = 0);
+		void showJobPanel();
 		virtual void parseopt(int& option) = 0;
 
 		//template<class T>
-		void printopts(const std::vector<std::string>&);
+		void printopts(const int startY, const std::vector<std::string>& collection);
 	};
 
 	/* ============================================================================== *
 	 * DisplayQueue class                                                             *
 	 *                                                                                *
 	 * Auxiliary class for displaying its given display items in a queue-styled menu. *
-	 * Will display up to 9 items at a time.                                          *
+	 * Will display up to 9 items at a time, and only ever draws those 9.             *
+	 *                                                                                *
+	 * Typing narrows the items down to the ones containing what was typed, backspace *
+	 * widens them again. Narrowing works off an index of the items' characters, and  *
+	 * each keystroke only looks at what the previous one left.                       *
 	 *                                                                                *
 	 * menu() will return the index of the selected item in display.                  *
 	 * ============================================================================== */
 
 	class DisplayQueue : private Menu {
+		static const int window = 9;
 		std::vector<std::string> display;
+		std::vector<std::vector<int>> byChar;                   //items containing each character
+		std::unordered_map<unsigned, std::vector<int>> byPair;  //items containing each pair of adjacent characters
+		std::vector<std::vector<int>> narrowed;                 //items left after each typed character
+		std::string query;
 		int startY;
-		int hidden;
+		int top;    //first row on screen
+		int cursor; //selected row
 
-		void scroll(bool);
+		void buildIndex();
+		void narrow(char ch);
+		void widen();
+		int shownCount() const;
+		int shownItem(int row) const;
+		void printrow(int row);
+		void render();
+		void jump(int row);
 		void parseopt(int& option) { return; }
 	public:
-		DisplayQueue() { startY = 0; hidden = 0; }
+		DisplayQueue() { startY = 0; top = 0; cursor = 0; }
 		DisplayQueue(std::vector<std::string> display, int startY);
 		int qmenu();
 	};
@@ -115,6 +416,9 @@ namespace pck {
 	 * Auxiliary class for finding files of a specific extension in a given folder.   *
 	 * If possible, instance objects of this class should be called "dognose" or      *
 	 * similar variants. (^:                                                          *
+	 *                                                                                *
+	 * Folders are sniffed in parallel, one task per subfolder. sniff() hands every   *
+	 * result to the caller as soon as it's found, and every folder as it's read.    *
 	 * ============================================================================== */
 
 	class FileSniffer {
@@ -124,33 +428,328 @@ namespace pck {
 		//2 = file name with path from given root
 
 		std::string path2string(std::filesystem::directory_entry);
+		bool matchesExtension(const std::filesystem::path& file) const;
+		bool isExcluded(const std::filesystem::path& file) const;
 	public:
 		static std::string fileName(std::string str, unsigned mode, const std::string pathref = "");
 		static bool exists(std::string filepath);
-		std::string extension;
+		std::string extension;            //"xml", or several as "xml|nwk"; compressed copies (.gz, .zst on top of it) match too
 		std::string path;
+		std::vector<std::string> exclude; //globs (* and ?) matched against file and folder names
+		int maxDepth = -1;                //-1 = no limit, 0 = root folder only
+		unsigned threads = 0;             //0 = one per hardware thread
 
-		std::pair<bool, std::vector<std::string>> find();
+		bool sniff(const std::function<void(const std::string&)>& found, const std::function<void(const std::string&)>& entered = nullptr);
 		void setMaxLen(size_t newlen);
 		size_t getMaxLen();
 		void togglePrintMode();
 	};
 
+	/* ============================================================================== *
+	 * FileIndex class                                                                *
+	 *                                                                                *
+	 * Persistent index of the files the pickers care about, one per root folder.     *
+	 * It's saved to disk between sessions and reconciled on startup by comparing     *
+	 * folder modification times, then kept up to date by watching the folder tree    *
+	 * for as long as Peacock is running. Lookups never touch the disk. Whole trees   *
+	 * (the first scan, or after losing track of changes) are read by a FileSniffer. *
+	 * ============================================================================== */
+
+	class FileIndex {
+		struct Folder {
+			long long mtime = 0;
+			std::set<std::string> files;      //names of indexed files directly in this folder
+			std::set<std::string> subfolders;
+		};
+
+		std::string root;
+		std::filesystem::path store;          //where this index is saved
+		std::map<std::string, Folder> folders; //keyed by path from root, "" being root itself
+		mutable std::mutex lock;
+		std::thread watcher;
+		std::atomic<bool> stopping;
+		std::atomic<bool> dirty;
+
+		static std::mutex registryLock;
+		static std::map<std::string, std::unique_ptr<FileIndex>> registry;
+		static std::set<std::string> building;   //roots whose first scan is under way, outside the lock
+		static std::condition_variable built;
+
+		FileIndex(const std::string& root);
+		std::filesystem::path fullPath(const std::string& folder) const;
+		bool wanted(const std::filesystem::path& file) const;
+		bool scanFolder(const std::string& folder);
+		bool scanTree(const std::string& folder);
+		void dropFolder(const std::string& folder);
+		void reconcile();
+		bool load();
+		void save();
+		void watch();
+
+	public:
+		static const std::vector<std::string> indexed; //extensions worth indexing
+		~FileIndex();
+
+		static std::pair<bool, std::vector<std::string>> lookup(const std::string& root, const std::string& extension);
+		static void closeAll();
+		std::pair<bool, std::vector<std::string>> find(const std::string& extension) const;
+	};
+
+	/* ============================================================================== *
+	 * Packer class                                                                   *
+	 *                                                                                *
+	 * Wide stream buffer that writes a gzip (.gz) or zstd (.zst) file, for putting   *
+	 * under any std::wostream. Characters are narrowed to bytes like a plain         *
+	 * wfstream would, gathered in 1 MB blocks and handed to a thread of its own that *
+	 * compresses and writes them in order, so the writer never waits on the codec    *
+	 * unless it gets a few blocks ahead.                                             *
+	 *                                                                                *
+	 * Formats are only there if their library was around at build time; check with  *
+	 * available(). close() says whether everything made it to disk. Opening with     *
+	 * append starts a new gzip member (or zstd frame) at the end of the file.        *
+	 * ============================================================================== */
+
+	class Packer : public std::wstreambuf {
+	public:
+		enum Format { plain, gzip, zstd };
+
+	private:
+		static const size_t blockSize = 1 << 20;
+		static const size_t maxQueued = 4;    //blocks waiting on the codec before the writer has to
+
+		Format format;
+		std::ofstream file;
+		std::vector<wchar_t> putArea;
+		std::vector<char> filling;            //block being narrowed into
+		std::deque<std::vector<char>> queue;
+		std::mutex lock;
+		std::condition_variable changed;
+		std::thread worker;
+		bool closing;
+		std::atomic<bool> failed;
+
+		void narrowPut();
+		void handOver();
+		void compress();
+
+	protected:
+		int_type overflow(int_type ch) override;
+		int sync() override;
+
+	public:
+		Packer();
+		~Packer();
+
+		static bool available(Format format);
+		static const char* extension(Format format);
+		static const char* name(Format format);
+		static Format fromExtension(const std::string& file);
+
+		bool open(const std::string& path, Format format, bool append = false);
+		bool close();
+	};
+
+	/* ============================================================================== *
+	 * Unpacker class                                                                 *
+	 *                                                                                *
+	 * Read side of the Packer: decompresses a gzip or zstd file as it's read, a      *
+	 * chunk at a time, so nothing ever lands on disk uncompressed. The format comes  *
+	 * from the file's first bytes, not its name; anything else is read as is.        *
+	 * Concatenated gzip members and zstd frames are read one after another.          *
+	 *                                                                                *
+	 * feed() hands the file over a block at a time, for parsers that split what      *
+	 * they read between threads: each block ends at the last whole record in it and  *
+	 * the rest starts the next one, so only a block's worth is in memory at once.    *
+	 * ============================================================================== */
+
+	class Unpacker {
+		struct Codec;                     //whichever library's state, kept out of this header
+		static const size_t blockSize = 64 << 20; //what feed() hands over at a time, at least
+
+		Packer::Format format;
+		std::ifstream file;
+		std::unique_ptr<Codec> codec;
+		std::vector<char> input;
+		bool drained;                     //nothing left in the file
+		bool ended;                       //nothing left, period
+
+		void refill();
+
+	public:
+		Unpacker();
+		~Unpacker();
+
+		static Packer::Format sniff(const std::string& path);
+
+		bool open(const std::string& path);
+		size_t read(char* out, size_t size);
+		bool feed(const std::function<bool(const char* data, size_t size, bool last, size_t& used)>& take);
+		void close();
+	};
+
+	/* ============================================================================== *
+	 * MappedFile class                                                               *
+	 *                                                                                *
+	 * A whole file as one read-only block of memory, for parsers that want to jump   *
+	 * around it or split it between threads. Plain files are memory mapped, so the   *
+	 * OS pages them in as they're touched; packed ones (see Unpacker) are            *
+	 * decompressed into memory instead, as are files that can't be mapped. Parsers   *
+	 * that can take a packed file a block at a time use Unpacker::feed() instead.    *
+	 * A copy that's being made stops as soon as "cancelled" is set, if there is one. *
+	 *                                                                                *
+	 * create() goes the other way: a new file of a given size, mapped for writing,   *
+	 * so an output can be filled in any order (and from any thread) in place.        *
+	 * ============================================================================== */
+
+	class MappedFile {
+		const char* view;
+		size_t length;
+		void* mapping;                    //OS handles, null when the file's copied instead
+		void* handle;
+		std::vector<char> copy;
+		bool writable;
+
+		bool readAll(const std::string& path, const std::atomic<bool>* cancelled);
+
+	public:
+		MappedFile();
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool open(const std::string& path, const std::atomic<bool>* cancelled = nullptr);
+		bool create(const std::string& path, size_t size);
+		void close();
+		const char* data() const { return view; }
+		char* writableData() { return (writable) ? (char*)view : nullptr; }
+		size_t size() const { return length; }
+	};
+
+	/* ============================================================================== *
+	 * Tracer class                                                                   *
+	 *                                                                                *
+	 * Timeline of what every thread was busy with, for a trace viewer (Chrome's      *
+	 * about:tracing, Perfetto and the like). Spans go into a ring buffer per thread, *
+	 * so recording never waits on other threads, and a thread that records a lot     *
+	 * only keeps its latest spans. dump() writes out everything recorded since the   *
+	 * last dump as Chrome trace-event JSON.                                          *
+	 *                                                                                *
+	 * Don't use it directly, use the PCK_TRACE_* macros below: unless PCK_TRACE is   *
+	 * defined for the whole project, they compile to nothing at all.                 *
+	 * ============================================================================== */
+
+	class Tracer {
+		struct Span {
+			const char* name;             //string literal, only the pointer is kept
+			long long start, end;         //nanoseconds since the program started
+		};
+		struct Ring {
+			std::mutex lock;              //only ever contended by dump()
+			std::vector<Span> spans;
+			size_t next = 0;              //oldest span, where the next one goes once full
+			unsigned thread = 0;
+			bool retired = false;         //its thread's gone, drop it after the next dump
+		};
+		struct Owner;
+
+		static std::mutex registryLock;
+		static std::vector<std::shared_ptr<Ring>> rings;
+		static unsigned threads;
+
+		static Ring& local();
+
+	public:
+		static size_t capacity;           //spans kept per thread
+
+		static long long now();
+		static void record(const char* name, long long start, long long end);
+		static bool dump(const std::string& path);
+	};
+
+	// Records a span from its construction to the end of the scope it's in
+	class TraceScope {
+		const char* name;
+		long long start;
+
+	public:
+		TraceScope(const char* name);
+		~TraceScope();
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+	};
+
+#ifdef PCK_TRACE
+#define PCK_TRACE_JOIN2(a, b) a##b
+#define PCK_TRACE_JOIN(a, b) PCK_TRACE_JOIN2(a, b)
+#define PCK_TRACE_SCOPE(name) pck::TraceScope PCK_TRACE_JOIN(pckTraceScope, __LINE__)(name)
+#define PCK_TRACE_DUMP(path) pck::Tracer::dump(path)
+#else
+#define PCK_TRACE_SCOPE(name) ((void)0)
+#define PCK_TRACE_DUMP(path) ((void)0)
+#endif
+
+	/* ============================================================================== *
+	 * PluginRegistry class                                                           *
+	 *                                                                                *
+	 * Every utility the main menu offers. Built-in ones are registered with their    *
+	 * entry point; the rest are found in the plugins folder (next to the             *
+	 * executable), one manifest per utility: a small text file ending in .plugin,    *
+	 * with "name = ..." and "library = ..." lines (the library's path being          *
+	 * relative to the folder) and, optionally, "entry = ..." for the entry point's   *
+	 * name. # starts a comment.                                                      *
+	 *                                                                                *
+	 * Only the manifests are read at startup. A library is loaded the first time     *
+	 * its utility is picked, and stays loaded from then on, so adding utilities      *
+	 * costs the framework nothing until they're used.                                *
+	 * ============================================================================== */
+
+	class PluginRegistry {
+	public:
+		struct Entry {
+			std::string name;
+			std::string library;        //empty for built-ins
+			std::string symbol;         //entry point's name in the library
+			PckPluginEntry entry;       //built-ins from the start, the rest once loaded
+			const PckPlugin* plugin;    //null until first picked
+			void* handle;               //the loaded library, if any
+			std::string error;          //why it couldn't be loaded, if it couldn't
+		};
+
+	private:
+		std::vector<Entry> entries;
+
+		bool load(Entry& entry);
+
+	public:
+		PluginRegistry() = default;
+		~PluginRegistry();
+		PluginRegistry(const PluginRegistry&) = delete;
+		PluginRegistry& operator=(const PluginRegistry&) = delete;
+
+		static std::string defaultFolder();
+		void addBuiltin(const std::string& name, PckPluginEntry entry);
+		int discover(const std::string& folder);
+		const std::vector<Entry>& getEntries() const;
+		bool open(size_t index, int& code, std::string& error);
+	};
+
 	/* ============================================================================== *
 	 * Peacock class                                                                  *
 	 *                                                                                *
 	 * Core class of the Peacock Framwork. Hosts the main menu and handles calls to   *
-	 * other classes for other projects.                                              *
+	 * other classes for other projects, through the PluginRegistry.                  *
 	 * ============================================================================== */
 
 	class Peacock : public Menu {
 
 	private:
 		std::vector<std::string> projects;
+		PluginRegistry plugins;
 		int startY;     //tells us where header ends
 	
 		void parseopt(int& option);
 		void printheader();
+		bool confirmExit();
 
 	public:
 		bool stdscr_initialized = false;
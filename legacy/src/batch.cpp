@@ -0,0 +1,281 @@
+#include "matrixinator.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace mtx {
+	// ===============================================================================
+	//                                 BatchScheduler                                =
+	// ===============================================================================
+
+	namespace fs = std::filesystem;
+
+	// Constructor: default budgets are every hardware thread and three quarters of the RAM
+	BatchScheduler::BatchScheduler()
+	{
+		threadBudget = std::max(1u, std::thread::hardware_concurrency());
+		memoryBudget = physicalMemory() / 4 * 3;
+	}
+
+	// Installed RAM, in bytes
+	size_t BatchScheduler::physicalMemory()
+	{
+#ifdef _WIN32
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (GlobalMemoryStatusEx(&status))
+			return (size_t)status.ullTotalPhys;
+		return (size_t)4 << 30;
+#else
+		long pages = sysconf(_SC_PHYS_PAGES), pagesize = sysconf(_SC_PAGE_SIZE);
+		return (pages > 0 && pagesize > 0) ? (size_t)pages * (size_t)pagesize : (size_t)4 << 30;
+#endif
+	}
+
+	// Trims spaces and tabs off both ends
+	static std::string trim(const std::string& str)
+	{
+		size_t first = str.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			return "";
+		return str.substr(first, str.find_last_not_of(" \t\r") - first + 1);
+	}
+
+	// Reads the manifest. On failure, error says which line and why.
+	bool BatchScheduler::load(const std::string& manifest, std::string& error)
+	{
+		std::ifstream file(manifest);
+		if (!file.is_open()) {
+			error = "could not open the manifest";
+			return false;
+		}
+
+		jobs.clear();
+		fs::path base = fs::absolute(fs::path(manifest)).parent_path();
+		std::string line;
+		int lineNum = 0;
+
+		while (std::getline(file, line)) {
+			++lineNum;
+			line = trim(line.substr(0, line.find('#')));
+			if (line.empty())
+				continue;
+
+			std::string where = "line " + std::to_string(lineNum) + ": ";
+
+			//budgets
+			if (line.find(',') == std::string::npos && line.find('=') != std::string::npos) {
+				std::string key = trim(line.substr(0, line.find('=')));
+				long long value = std::atoll(trim(line.substr(line.find('=') + 1)).c_str());
+				if (value <= 0) {
+					error = where + "budgets must be positive";
+					return false;
+				}
+
+				if (key == "threads")
+					threadBudget = (unsigned)value;
+				else if (key == "memory")
+					memoryBudget = (size_t)value << 20;
+				else {
+					error = where + "unknown budget \"" + key + "\"";
+					return false;
+				}
+				continue;
+			}
+
+			std::vector<std::string> pieces;
+			for (std::string_view piece : pck::Tokens(line, ','))
+				pieces.push_back(trim(std::string(piece)));
+			if (pieces.size() < 2) {
+				error = where + "expected \"tree, metadata[, options]\"";
+				return false;
+			}
+
+			fs::path tree = fs::path(pieces[0]), meta = fs::path(pieces[1]);
+			tree = (tree.is_relative() ? base / tree : tree).lexically_normal();
+			meta = (meta.is_relative() ? base / meta : meta).lexically_normal();
+
+			Job job;
+			if (!job.config.setInputs(tree, meta)) {
+				error = where + "tree and metadata files must share a root folder";
+				return false;
+			}
+
+			for (size_t i = 2; i < pieces.size(); ++i) {
+				if (pieces[i] == "overwrite")
+					job.config.overwrite = true;
+				else if (pieces[i] == "detailed")
+					job.config.detailed = true;
+				else if (pieces[i] == "resume")
+					job.config.resume = true;
+				else if (pieces[i] == "columnar")
+					job.config.columnar = true;
+				else if (pieces[i] == "compact")
+					job.config.compact = true;
+				else if (pieces[i] == "edges=text" || pieces[i] == "edges=binary")
+					job.config.edges = (pieces[i] == "edges=text") ? EdgeWriter::text : EdgeWriter::binary;
+				else if (pieces[i] == "compress=gzip" || pieces[i] == "compress=zstd") {
+					job.config.compression = (pieces[i] == "compress=gzip") ? pck::Packer::gzip : pck::Packer::zstd;
+					if (!pck::Packer::available(job.config.compression)) {
+						error = where + pieces[i].substr(9) + " compression isn't available in this build";
+						return false;
+					}
+				}
+				else if (pieces[i].compare(0, 8, "threads=") == 0 && std::atoi(pieces[i].c_str() + 8) > 0)
+					job.config.threads = (unsigned)std::atoi(pieces[i].c_str() + 8);
+				else if (pieces[i] == "dense=binary" || pieces[i] == "dense=text")
+					job.config.dense = (pieces[i] == "dense=binary") ? DenseMatrix::binary : DenseMatrix::text;
+				else if (pieces[i].compare(0, 6, "pairs=") == 0) {
+					if (!job.config.setPairCutoff(pieces[i].substr(6))) {
+						error = where + "the pair matrix cutoff must be from 0 up to 100";
+						return false;
+					}
+				}
+				else if (pieces[i].compare(0, 11, "thresholds=") == 0) {
+					if (!job.config.setThresholds(pieces[i].substr(11))) {
+						error = where + "thresholds must be above 0 and up to 100";
+						return false;
+					}
+				}
+				else {
+					error = where + "unknown option \"" + pieces[i] + "\"";
+					return false;
+				}
+			}
+
+			if (!job.config.ioDefined()) {
+				error = where + "could not find both files";
+				return false;
+			}
+
+			std::error_code ec;
+			job.label = meta.filename().string();
+			job.treeFile = fs::weakly_canonical(tree, ec).string();
+			//wide strings and per-row vectors: a loaded sheet runs about 8 times its size on disk,
+			//a laid out tree about 6 times (mostly the jump table, a few entries per node per level); packed files are about 20 times smaller
+			job.memory = (size_t)fs::file_size(meta, ec) * ((pck::Unpacker::sniff(meta.string()) != pck::Packer::plain) ? 160 : 8);
+			job.treeMemory = (size_t)fs::file_size(tree, ec) * ((pck::Unpacker::sniff(tree.string()) != pck::Packer::plain) ? 120 : 6);
+			jobs.push_back(std::move(job));
+		}
+
+		if (jobs.empty()) {
+			error = "the manifest has no jobs";
+			return false;
+		}
+
+		//jobs without a thread count split the budget evenly among those that may run at once
+		unsigned share = std::max(1u, threadBudget / (unsigned)std::min<size_t>(jobs.size(), threadBudget));
+		for (auto& job : jobs) {
+			if (job.config.threads == 0)
+				job.config.threads = share;
+		}
+		return true;
+	}
+
+	// Memory a job would add to the running total
+	size_t BatchScheduler::cost(const Job& job) const
+	{
+		return job.memory + ((treesCounted.count(job.treeFile) == 0) ? job.treeMemory : 0);
+	}
+
+	// True if a job fits in what's left of the budgets. With nothing running, anything goes.
+	bool BatchScheduler::admissible(const Job& job, unsigned threads, size_t memory, int running) const
+	{
+		if (running == 0)
+			return true;
+		return threads + job.config.threads <= threadBudget && memory + cost(job) <= memoryBudget;
+	}
+
+	// Runs every job, in manifest order, as many at once as the budgets allow.
+	// Tick is called on this thread every 100ms or so, for the caller to show how things are going.
+	void BatchScheduler::run(const std::function<void()>& tick)
+	{
+		std::vector<std::thread> workers(jobs.size());
+		std::vector<char> reaped(jobs.size(), 0);
+		unsigned usedThreads = 0;
+		size_t usedMemory = 0, nextJob = 0;
+		int running = 0;
+
+		treeUsers.clear();
+		for (auto& job : jobs)
+			++treeUsers[job.treeFile];
+
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			//return what finished jobs were holding, and their tree once no other job is going to want it
+			for (size_t i = 0; i < nextJob; ++i) {
+				if (jobs[i].state == State::finished && !reaped[i]) {
+					reaped[i] = 1;
+					usedThreads -= jobs[i].config.threads;
+					usedMemory -= jobs[i].memory;
+					if (--treeUsers[jobs[i].treeFile] == 0 && treesCounted.erase(jobs[i].treeFile) > 0) {
+						usedMemory -= jobs[i].treeMemory;
+						TreeCache::drop(jobs[i].config.paths.getFullFilepath(false)); //or the cache would keep it
+					}
+					--running;
+				}
+			}
+
+			while (nextJob < jobs.size() && admissible(jobs[nextJob], usedThreads, usedMemory, running)) {
+				Job& job = jobs[nextJob];
+				usedMemory += cost(job);
+				treesCounted.insert(job.treeFile); //paid for until the last job on it is done
+				usedThreads += job.config.threads;
+				++running;
+
+				job.state = State::running;
+				job.started = std::chrono::steady_clock::now();
+				job.mtx.reset(new Matrixinator(job.config, TreeCache::get));
+
+				workers[nextJob] = std::thread([this, &job]() {
+					int code = job.mtx->run();
+
+					std::lock_guard<std::mutex> done(lock);
+					job.code = code;
+					job.failure = job.mtx->getFailure();
+					job.mtx.reset(); //free the sheet right away, the budget counts on it
+					job.ended = std::chrono::steady_clock::now();
+					job.state = State::finished;
+					changed.notify_all();
+				});
+				++nextJob;
+			}
+
+			if (running == 0 && nextJob == jobs.size())
+				break;
+
+			changed.wait_for(guard, std::chrono::milliseconds(100));
+			guard.unlock();
+			tick();
+			guard.lock();
+		}
+		guard.unlock();
+
+		for (auto& worker : workers) {
+			if (worker.joinable())
+				worker.join();
+		}
+		treesCounted.clear();
+		tick();
+	}
+
+	// Getters. Lock getLock() while looking at running jobs.
+	std::vector<BatchScheduler::Job>& BatchScheduler::getJobs()
+	{
+		return jobs;
+	}
+	std::mutex& BatchScheduler::getLock()
+	{
+		return lock;
+	}
+	unsigned BatchScheduler::getThreadBudget() const
+	{
+		return threadBudget;
+	}
+	size_t BatchScheduler::getMemoryBudget() const
+	{
+		return memoryBudget;
+	}
+}
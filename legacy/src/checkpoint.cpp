@@ -0,0 +1,216 @@
+#include "matrixinator.hpp"
+#include <cstring>
+#include <cstdio>
+
+namespace mtx {
+	// ===============================================================================
+	//                                   Checkpoint                                  =
+	// ===============================================================================
+
+	static const char MAGIC[8] = { 'M', 'T', 'X', 'C', 'K', 'P', 'T', '3' };
+	static const uint32_t BLOCK = 0x314B4C42; //"BLK1"
+	static const uint32_t BLOCKEND = 0x31444E45; //"END1"
+
+	// Raw little helpers for the binary format
+	template<class T>
+	static void put(std::string& buffer, const T& value)
+	{
+		buffer.append((const char*)&value, sizeof(T));
+	}
+	template<class T>
+	static bool get(std::istream& in, T& value)
+	{
+		return (bool)in.read((char*)&value, sizeof(T));
+	}
+
+	// Constructor
+	Checkpoint::Checkpoint(const std::string& file, uint64_t fingerprint)
+	{
+		this->file = file;
+		this->fingerprint = fingerprint;
+		from = 0;
+		count = 0;
+		restored = false;
+		lastSave = std::chrono::steady_clock::now();
+	}
+
+	// FNV-1a, chainable through seed
+	uint64_t Checkpoint::hash(uint64_t seed, const void* data, size_t len)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		if (seed == 0)
+			seed = 14695981039346656037ULL;
+
+		for (size_t i = 0; i < len; ++i) {
+			seed ^= bytes[i];
+			seed *= 1099511628211ULL;
+		}
+		return seed;
+	}
+
+	// Reads back every complete block, handing each entry to "apply", and the edge lists as the last one left
+	// them. Returns the row to continue the sweep from, or 0 if there's no checkpoint for these inputs. Blocks
+	// stop counting at the first one whose edge lists aren't on disk anymore.
+	int Checkpoint::restore(const std::function<void(const Entry&)>& apply, std::vector<List>& lists)
+	{
+		lists.clear();
+		std::ifstream in(file, std::ifstream::binary);
+		if (!in.is_open())
+			return 0;
+
+		char magic[8];
+		uint64_t print;
+		if (!in.read(magic, 8) || memcmp(magic, MAGIC, 8) != 0 || !get(in, print) || print != fingerprint)
+			return 0;
+		restored = true;
+
+		std::streamoff good = in.tellg();
+		int resumeAt = 0;
+		std::vector<Entry> block;
+
+		while (true) {
+			uint32_t tag, entries;
+			int32_t first, last;
+			uint32_t numLists;
+			if (!get(in, tag) || tag != BLOCK || !get(in, first) || !get(in, last) || !get(in, entries) || first != resumeAt || !get(in, numLists))
+				break;
+
+			std::vector<List> blockLists(numLists);
+			bool intact = true;
+			for (List& list : blockLists) {
+				uint32_t length;
+				intact = intact && get(in, list.length) && get(in, length) && length > 0 && length < 4096;
+				if (intact) {
+					list.path.resize(length);
+					intact = (bool)in.read(&list.path[0], length);
+				}
+
+				//the list got shorter (or went away) since, so the matches this block stands for aren't all there
+				std::error_code ec;
+				const uintmax_t size = std::filesystem::file_size(list.path, ec);
+				intact = intact && !ec && size >= list.length;
+			}
+
+			block.clear();
+			for (uint32_t i = 0; i < entries && intact; ++i) {
+				Entry entry;
+				int32_t row;
+				uint8_t level, predicted;
+				uint32_t numMatches;
+
+				intact = get(in, row) && get(in, level) && get(in, predicted);
+				entry.row = row;
+				entry.level = level;
+				entry.predicted = predicted != 0;
+				if (intact && entry.predicted)
+					intact = (bool)in.read((char*)entry.octagon.data(), sizeof(double) * 8);
+				intact = intact && get(in, numMatches);
+
+				for (uint32_t j = 0; j < numMatches && intact; ++j) {
+					int32_t ref;
+					double sim;
+					intact = get(in, ref) && get(in, sim);
+					entry.matches.emplace_back(ref, sim);
+				}
+				block.push_back(std::move(entry));
+			}
+
+			if (!intact || !get(in, tag) || tag != BLOCKEND)
+				break; //cut short, everything from here on gets redone
+
+			for (auto& entry : block)
+				apply(entry);
+			lists.swap(blockLists);
+			resumeAt = last;
+			good = in.tellg();
+		}
+		in.close();
+
+		//drop whatever trails the last complete block, new blocks go right after it
+		std::error_code ec;
+		std::filesystem::resize_file(file, (uintmax_t)good, ec);
+		return resumeAt;
+	}
+
+	// Starts saving from the given row, on to the file restore() read or into a brand new one. Row 0 means a
+	// fresh file. False if there's a file in the way that isn't this run's to write over (another run on the same
+	// inputs may be saving to it), in which case nothing's saved and it's left alone.
+	bool Checkpoint::start(int row)
+	{
+		if (!restored) {
+			//created exclusively, so two runs never end up writing the same file
+			FILE* created = std::fopen(file.c_str(), "wbx");
+			if (created == nullptr)
+				return false;
+			std::fclose(created);
+		}
+
+		if (row == 0) {
+			out.open(file, std::ofstream::binary | std::ofstream::trunc);
+			out.write(MAGIC, 8);
+			out.write((const char*)&fingerprint, sizeof(fingerprint));
+			out.flush();
+		}
+		else
+			out.open(file, std::ofstream::binary | std::ofstream::app);
+
+		from = row;
+		count = 0;
+		pending.clear();
+		lastSave = std::chrono::steady_clock::now();
+		return out.is_open();
+	}
+
+	// Queues one foreign sample's results at one threshold. Octagon may be null if there was no prediction.
+	void Checkpoint::record(int row, int level, const double* octagon, const std::vector<int>& matches, const std::vector<double>& sims)
+	{
+		put(pending, (int32_t)row);
+		put(pending, (uint8_t)level);
+		put(pending, (uint8_t)(octagon != nullptr));
+		if (octagon != nullptr)
+			pending.append((const char*)octagon, sizeof(double) * 8);
+
+		put(pending, (uint32_t)matches.size());
+		for (size_t i = 0; i < matches.size(); ++i) {
+			put(pending, (int32_t)matches[i]);
+			put(pending, sims[i]);
+		}
+		++count;
+	}
+
+	// True once it's been long enough since the last save
+	bool Checkpoint::due() const
+	{
+		return std::chrono::steady_clock::now() - lastSave >= std::chrono::seconds(interval);
+	}
+
+	// Appends everything queued as the block covering every row before "row", with the edge lists as they are
+	// right then (their matches aren't kept here, just how far each file had got)
+	void Checkpoint::save(int row, const std::vector<List>& lists)
+	{
+		lastSave = std::chrono::steady_clock::now();
+		if (!out.is_open() || row <= from)
+			return;
+
+		std::string header;
+		put(header, BLOCK);
+		put(header, (int32_t)from);
+		put(header, (int32_t)row);
+		put(header, count);
+		put(header, (uint32_t)lists.size());
+		for (const List& list : lists) {
+			put(header, list.length);
+			put(header, (uint32_t)list.path.size());
+			header.append(list.path);
+		}
+
+		out.write(header.data(), header.size());
+		out.write(pending.data(), pending.size());
+		out.write((const char*)&BLOCKEND, sizeof(BLOCKEND));
+		out.flush();
+
+		pending.clear();
+		count = 0;
+		from = row;
+	}
+}
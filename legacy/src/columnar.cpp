@@ -0,0 +1,142 @@
+#include "matrixinator.hpp"
+#include <cstring>
+#include <unordered_map>
+
+namespace mtx {
+	// ===============================================================================
+	//                                ColumnarWriter                                 =
+	// ===============================================================================
+
+	static const char MAGIC[8] = { 'M', 'T', 'X', 'C', 'O', 'L', '0', '1' };
+	static const uint32_t VERSION = 1;
+
+	// Raw little helpers for the binary format
+	template<class T>
+	static void put(std::string& buffer, const T& value)
+	{
+		buffer.append((const char*)&value, sizeof(T));
+	}
+	template<class T>
+	static void putAll(std::string& buffer, const std::vector<T>& values)
+	{
+		if (!values.empty())
+			buffer.append((const char*)values.data(), values.size() * sizeof(T));
+	}
+	static void align(std::string& buffer)
+	{
+		buffer.append((8 - buffer.size() % 8) % 8, '\0');
+	}
+
+	// Constructor
+	ColumnarWriter::ColumnarWriter(uint64_t rows, double threshold, bool detailed)
+	{
+		this->rows = rows;
+		this->threshold = threshold;
+		this->detailed = detailed;
+	}
+
+	// Adds a section, padded so the next one starts 8-byte aligned
+	void ColumnarWriter::add(const std::string& name, Kind kind, uint32_t columns, std::string&& data)
+	{
+		align(data);
+		sections.push_back({ name, kind, columns, std::move(data) });
+	}
+
+	// Dictionary-encodes a text column: each distinct value stored once, each row a 32-bit code
+	void ColumnarWriter::addText(const std::string& name, const std::vector<std::string>& column)
+	{
+		std::unordered_map<std::string, uint32_t> codes;
+		std::vector<uint32_t> rowCodes(column.size());
+		std::vector<uint64_t> offsets(1, 0);
+		std::string blob;
+
+		for (size_t i = 0; i < column.size(); ++i) {
+			auto code = codes.emplace(column[i], (uint32_t)codes.size());
+			if (code.second) {
+				blob += column[i];
+				offsets.push_back(blob.size());
+			}
+			rowCodes[i] = code.first->second;
+		}
+
+		std::string data;
+		put(data, (uint32_t)codes.size());
+		put(data, (uint32_t)0);
+		putAll(data, offsets);
+		putAll(data, rowCodes);
+		align(data);
+		data += blob;
+		add(name, Kind::text, 1, std::move(data));
+	}
+
+	// Row-major float64 matrix, "columns" wide
+	void ColumnarWriter::addMatrix(const std::string& name, const std::vector<double>& values, uint32_t columns)
+	{
+		std::string data;
+		putAll(data, values);
+		add(name, Kind::float64, columns, std::move(data));
+	}
+
+	// One byte per row
+	void ColumnarWriter::addBytes(const std::string& name, const std::vector<uint8_t>& values)
+	{
+		std::string data;
+		putAll(data, values);
+		add(name, Kind::uint8, 1, std::move(data));
+	}
+
+	// Variable-length rows: offsets[rows + 1] into the flat keys and sims arrays
+	void ColumnarWriter::addMatches(const std::string& name, const std::vector<uint64_t>& offsets, const std::vector<uint32_t>& keys, const std::vector<double>& sims)
+	{
+		std::string data;
+		putAll(data, offsets);
+		add(name + ".offsets", Kind::uint64, 1, std::move(data));
+		data.clear();
+		putAll(data, keys);
+		add(name + ".keys", Kind::uint32, 1, std::move(data));
+		data.clear();
+		putAll(data, sims);
+		add(name + ".similarity", Kind::float64, 1, std::move(data));
+	}
+
+	// Writes the header, the section table and every section. False if the file couldn't be written.
+	bool ColumnarWriter::save(const std::string& path)
+	{
+		//header: magic, version, header size, rows, section count, flags, threshold
+		//section table: kind, columns, offset, size, name (32 bytes, zero padded)
+		const uint32_t headerSize = 8 + 4 + 4 + 8 + 4 + 4 + 8;
+		const uint32_t entrySize = 4 + 4 + 8 + 8 + 32;
+		std::string head;
+
+		head.append(MAGIC, 8);
+		put(head, VERSION);
+		put(head, headerSize);
+		put(head, rows);
+		put(head, (uint32_t)sections.size());
+		put(head, (uint32_t)(detailed ? 1 : 0));
+		put(head, threshold);
+
+		uint64_t offset = headerSize + (uint64_t)entrySize * sections.size();
+		for (Section& section : sections) {
+			char name[32];
+			memset(name, 0, sizeof(name));
+			strncpy(name, section.name.c_str(), sizeof(name) - 1);
+
+			put(head, (uint32_t)section.kind);
+			put(head, section.columns);
+			put(head, offset);
+			put(head, (uint64_t)section.data.size());
+			head.append(name, sizeof(name));
+			offset += section.data.size();
+		}
+
+		std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write(head.data(), head.size());
+		for (Section& section : sections)
+			file.write(section.data.data(), section.data.size());
+		return (bool)file;
+	}
+}
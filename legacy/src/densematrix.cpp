@@ -0,0 +1,254 @@
+#include "matrixinator.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace mtx {
+	// ===============================================================================
+	//                                  DenseMatrix                                  =
+	// ===============================================================================
+
+	static const char MAGIC[8] = { 'M', 'T', 'X', 'D', 'N', 'S', '0', '1' };
+	static const uint32_t VERSION = 1;
+	static const uint32_t HEADER = 64;  //the matrix starts right after, on a cache line
+
+	// Next multiple of 8
+	static uint64_t aligned(uint64_t offset)
+	{
+		return (offset + 7) & ~(uint64_t)7;
+	}
+
+	// Runs "work" on this thread and threads - 1 others, and waits for all of them
+	static void spread(unsigned threads, const std::function<void()>& work)
+	{
+		std::vector<std::thread> pool;
+		for (unsigned t = 1; t < threads; ++t)
+			pool.emplace_back(work);
+		work();
+		for (auto& th : pool)
+			th.join();
+	}
+
+	// Constructor: children lists, in the same order layout() visits them, so their sample ranges go up
+	DenseMatrix::DenseMatrix(const TreeIndex& tree) : tree(tree)
+	{
+		const int size = tree.numNodes + 1;
+		childStart.assign(size + 1, 0);
+		children.assign(size, 0);
+		for (int i = 1; i < size; ++i)
+			++childStart[tree.parentOf(i) + 1];
+		for (int i = 0; i < size; ++i)
+			childStart[i + 1] += childStart[i];
+		std::vector<int> fill(childStart.begin(), childStart.end() - 1);
+		for (int i = 1; i < size; ++i)
+			children[fill[tree.parentOf(i)]++] = i;
+	}
+
+	// File extension for a format
+	std::string DenseMatrix::extension(Format format, pck::Packer::Format compression)
+	{
+		if (format == text)
+			return std::string(".csv") + pck::Packer::extension(compression);
+		return ".mtxd";
+	}
+
+	// For menus and such
+	const char* DenseMatrix::name(Format format)
+	{
+		static const char* names[] = { "None", "Binary", "Text" };
+		return names[format];
+	}
+
+	// Samples on the tree, i.e. rows (and columns)
+	int DenseMatrix::getSamples() const
+	{
+		return tree.last[0];
+	}
+
+	// Fills rows [r0, r1) x columns [c0, c1) of the matrix into values, a row every "stride" floats. Every node
+	// covering part of it on both sides paints its own sample's row, and each child's rows against the rest of
+	// its range, so every cell is written once, by the pair's lowest common ancestor.
+	void DenseMatrix::block(int r0, int r1, int c0, int c1, float* values, size_t stride) const
+	{
+		auto paint = [&](int rowFrom, int rowTo, int colFrom, int colTo, float similarity) {
+			if (colFrom >= colTo)
+				return;
+			for (int r = rowFrom; r < rowTo; ++r)
+				std::fill(values + (r - r0) * stride + (colFrom - c0), values + (r - r0) * stride + (colTo - c0), similarity);
+		};
+
+		std::vector<int> stack = { 0 }; //no recursion, trees can be as deep as they have samples
+		while (!stack.empty()) {
+			const int node = stack.back();
+			stack.pop_back();
+
+			const int rowFrom = std::max(r0, tree.first[node]), rowTo = std::min(r1, tree.last[node]);
+			const int colFrom = std::max(c0, tree.first[node]), colTo = std::min(c1, tree.last[node]);
+			const float similarity = (node == 0) ? 0.0f : (float)tree.acacia[node].similarity;
+
+			const int own = tree.position[node];
+			if (own >= rowFrom && own < rowTo)
+				paint(own, own + 1, colFrom, colTo, similarity);
+
+			//children below the block's first row, then on until they're past its last
+			const int* kids = children.data() + childStart[node];
+			const int* kidsEnd = children.data() + childStart[node + 1];
+			kids = std::partition_point(kids, kidsEnd, [&](int child) { return tree.last[child] <= rowFrom; });
+			for (; kids != kidsEnd && tree.first[*kids] < rowTo; ++kids) {
+				const int child = *kids, from = tree.first[child], to = tree.last[child];
+				if (from == to)
+					continue;
+
+				const int rowsFrom = std::max(rowFrom, from), rowsTo = std::min(rowTo, to);
+				paint(rowsFrom, rowsTo, colFrom, std::min(colTo, std::max(colFrom, from)), similarity);
+				paint(rowsFrom, rowsTo, std::max(colFrom, std::min(colTo, to)), colTo, similarity);
+				if (from < colTo && to > colFrom)
+					stack.push_back(child);
+			}
+		}
+	}
+
+	// Writes the matrix, with each sample's metadata row and key, in whichever format. False if the file
+	// can't be written.
+	bool DenseMatrix::save(const std::string& path, Format format, pck::Packer::Format compression, const std::vector<uint32_t>& rows,
+		const std::vector<std::string>& keys, unsigned threads) const
+	{
+		if (format == text)
+			return saveText(path, compression, keys, std::max(threads, 1u));
+		return saveBinary(path, rows, keys, std::max(threads, 1u));
+	}
+
+	// The binary format, filled in place: each thread takes tiles of the upper triangle and also writes
+	// them transposed below the diagonal
+	bool DenseMatrix::saveBinary(const std::string& path, const std::vector<uint32_t>& rows, const std::vector<std::string>& keys, unsigned threads) const
+	{
+		const uint64_t samples = (uint64_t)getSamples();
+		std::vector<uint64_t> keyOffsets(1, 0);
+		for (const std::string& key : keys)
+			keyOffsets.push_back(keyOffsets.back() + key.size());
+
+		//where each array starts
+		uint64_t sections[4];
+		sections[0] = HEADER;
+		sections[1] = aligned(sections[0] + samples * samples * sizeof(float));
+		sections[2] = aligned(sections[1] + samples * sizeof(uint32_t));
+		sections[3] = aligned(sections[2] + (samples + 1) * sizeof(uint64_t));
+
+		pck::MappedFile file;
+		if (!file.create(path, (size_t)(sections[3] + keyOffsets.back())))
+			return false;
+		char* out = file.writableData();
+
+		memset(out, 0, HEADER);
+		char* at = out;
+		memcpy(at, MAGIC, 8); at += 8;
+		memcpy(at, &VERSION, sizeof(VERSION)); at += sizeof(VERSION);
+		memcpy(at, &HEADER, sizeof(HEADER)); at += sizeof(HEADER);
+		memcpy(at, &samples, sizeof(samples)); at += sizeof(samples);
+		memcpy(at, sections, sizeof(sections));
+
+		memcpy(out + sections[1], rows.data(), rows.size() * sizeof(uint32_t));
+		memcpy(out + sections[2], keyOffsets.data(), keyOffsets.size() * sizeof(uint64_t));
+		for (size_t q = 0; q < keys.size(); ++q)
+			memcpy(out + sections[3] + keyOffsets[q], keys[q].data(), keys[q].size());
+
+		//tiles (i, j) with i <= j, row after row
+		const int n = (int)samples, tiles = (n + TILE - 1) / TILE;
+		std::vector<std::pair<int, int>> upper;
+		for (int i = 0; i < tiles; ++i) {
+			for (int j = i; j < tiles; ++j)
+				upper.push_back({ i, j });
+		}
+
+		float* matrix = (float*)(out + sections[0]);
+		std::atomic<size_t> next(0);
+		spread(threads, [&]() {
+			std::vector<float> tile((size_t)TILE * TILE);
+			for (size_t t = next.fetch_add(1); t < upper.size(); t = next.fetch_add(1)) {
+				PCK_TRACE_SCOPE("dense tile");
+				const int r0 = upper[t].first * TILE, r1 = std::min(n, r0 + TILE);
+				const int c0 = upper[t].second * TILE, c1 = std::min(n, c0 + TILE);
+				block(r0, r1, c0, c1, tile.data(), TILE);
+
+				for (int r = r0; r < r1; ++r)
+					memcpy(matrix + (size_t)r * n + c0, tile.data() + (size_t)(r - r0) * TILE, (c1 - c0) * sizeof(float));
+				if (r0 != c0) {
+					for (int c = c0; c < c1; ++c) {
+						float* row = matrix + (size_t)c * n;
+						for (int r = r0; r < r1; ++r)
+							row[r] = tile[(size_t)(r - r0) * TILE + (c - c0)];
+					}
+				}
+			}
+		});
+
+		file.close();
+		return true;
+	}
+
+	// The text format, a band of rows at a time: threads fill the band's tiles, then turn its rows into
+	// lines, and the lines are written out in order
+	bool DenseMatrix::saveText(const std::string& path, pck::Packer::Format compression, const std::vector<std::string>& keys, unsigned threads) const
+	{
+		pck::Packer packer;
+		std::wfstream file;
+		std::wostream output(nullptr);
+		if (compression != pck::Packer::plain) {
+			if (!packer.open(path, compression))
+				return false;
+			output.rdbuf(&packer);
+		}
+		else {
+			file.open(path, std::wfstream::out | std::wfstream::trunc);
+			if (!file.is_open())
+				return false;
+			output.rdbuf(file.rdbuf());
+		}
+
+		//keys are the sheet's own characters, one per byte, so they widen back as they are
+		auto widen = [](const std::string& line) { return std::wstring(line.begin(), line.end()); };
+		std::string header = "Key";
+		for (const std::string& key : keys)
+			header += "," + key;
+		output << widen(header) << L"\n";
+
+		const int n = getSamples(), tiles = (n + TILE - 1) / TILE;
+		std::vector<float> band((size_t)TILE * n);
+		std::vector<std::string> lines(TILE);
+		for (int r0 = 0; r0 < n; r0 += TILE) {
+			const int r1 = std::min(n, r0 + TILE);
+
+			std::atomic<int> next(0);
+			spread(threads, [&]() {
+				for (int j = next.fetch_add(1); j < tiles; j = next.fetch_add(1)) {
+					PCK_TRACE_SCOPE("dense tile");
+					block(r0, r1, j * TILE, std::min(n, (j + 1) * TILE), band.data() + (size_t)j * TILE, n);
+				}
+			});
+
+			next = r0;
+			spread(threads, [&]() {
+				char number[32];
+				for (int r = next.fetch_add(1); r < r1; r = next.fetch_add(1)) {
+					std::string& line = lines[r - r0];
+					line = keys[r];
+					for (int c = 0; c < n; ++c) {
+						snprintf(number, sizeof(number), ",%g", band[(size_t)(r - r0) * n + c]);
+						line += number;
+					}
+				}
+			});
+
+			for (int r = r0; r < r1; ++r)
+				output << widen(lines[r - r0]) << L"\n";
+		}
+
+		output.flush();
+		bool ok = !output.fail();
+		if (compression != pck::Packer::plain)
+			ok = packer.close() && ok;
+		else
+			file.close();
+		return ok;
+	}
+}
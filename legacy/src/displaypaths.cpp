@@ -1,4 +1,5 @@
 #include "matrixinator.hpp"
+#include <cstring>
 
 namespace mtx {
 	// ===============================================================================
@@ -36,7 +37,8 @@ namespace mtx {
 		if (path.find_first_of("\\") == std::string::npos || path.length() <= charlimit)
 			return path;
 
-		std::vector<std::string> pieces = pck::sliceNsplice(path, '\\');
+		pck::Tokens folders(path, '\\');
+		std::vector<std::string> pieces(folders.begin(), folders.end());
 		std::string result;
 
 		if (pieces.size() == 1)
@@ -129,7 +131,7 @@ namespace mtx {
 		return metaFile;
 	}
 
-	// Dendrogram .xml file
+	// Dendrogram .xml/.nwk file
 	std::string DisplayPaths::getTree()
 	{
 		return treeFile;
@@ -194,12 +196,20 @@ namespace mtx {
 				ch = '\\';
 		}
 
-		std::vector<std::string> filePieces = pck::sliceNsplice(file, '\\');
+		pck::Tokens folders(file, '\\');
+		std::vector<std::string_view> filePieces(folders.begin(), folders.end());
+		if (filePieces.empty())
+			return;
 
-		//this is a specialized matrixinator class, any other file types are irrelevant
-		std::string extension = filePieces.back().substr(filePieces.back().length() - 3, 3);
+		//this is a specialized matrixinator class, any other file types are irrelevant (compressed or not)
+		std::string bare(filePieces.back());
+		bare.resize(bare.length() - std::strlen(pck::Packer::extension(pck::Packer::fromExtension(bare))));
+		size_t dot = bare.find_last_of('.');
+		if (dot == std::string::npos)
+			return;
+		std::string extension = bare.substr(dot + 1);
 		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-		if (extension != "csv" && extension != "xml")
+		if (extension != "csv" && extension != "xml" && extension != "nwk" && extension != "newick")
 			return;
 
 		std::string* ptr;
@@ -212,7 +222,7 @@ namespace mtx {
 			ptr = &treeRoot;
 		}
 
-		for (std::vector<std::string>::const_iterator it = filePieces.begin(); it != filePieces.end(); ++it) {
+		for (std::vector<std::string_view>::const_iterator it = filePieces.begin(); it != filePieces.end(); ++it) {
 			if (it == filePieces.end() - 1) {
 				if (extension == "csv")
 					metaFile = *it;
@@ -220,7 +230,8 @@ namespace mtx {
 					treeFile = *it;
 			}
 			else {
-				ptr->append(*it + "\\");
+				ptr->append(*it);
+				ptr->append("\\");
 			}
 		}
 	}
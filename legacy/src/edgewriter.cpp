@@ -0,0 +1,164 @@
+#include "matrixinator.hpp"
+#include <iomanip>
+
+namespace mtx {
+	// ===============================================================================
+	//                                   EdgeWriter                                  =
+	// ===============================================================================
+
+	static const char MAGIC[8] = { 'M', 'T', 'X', 'E', 'D', 'G', '0', '1' };
+	static const uint32_t VERSION = 1;
+
+	// Constructor
+	EdgeWriter::EdgeWriter() : output(nullptr)
+	{
+		format = none;
+		compression = pck::Packer::plain;
+		rows = nullptr;
+	}
+
+	// Destructor: an unclosed list still gets finished
+	EdgeWriter::~EdgeWriter()
+	{
+		close();
+	}
+
+	// What goes after the output's own name and suffix
+	std::string EdgeWriter::extension(Format format, pck::Packer::Format compression)
+	{
+		if (format == binary)
+			return "-edges.mtxe";
+		return std::string("-edges.csv") + pck::Packer::extension(compression);
+	}
+
+	// For menus and such
+	const char* EdgeWriter::name(Format format)
+	{
+		static const char* names[] = { "None", "Text", "Binary" };
+		return names[format];
+	}
+
+	// Starts a new list for the matches at one threshold or, given the length a checkpoint saw it at, carries on
+	// with the one already there (anything written after that is dropped). False if the file can't be created.
+	bool EdgeWriter::open(const std::string& path, Format format, pck::Packer::Format compression, const std::vector<Metadata>& rows, double threshold, uint64_t length)
+	{
+		close();
+		this->rows = &rows;
+		this->path = path;
+		this->compression = compression;
+
+		const bool carryOn = length > 0;
+		if (carryOn) {
+			std::error_code ec;
+			const uintmax_t size = std::filesystem::file_size(path, ec);
+			if (ec || size < length)
+				return false;
+			std::filesystem::resize_file(path, length, ec);
+			if (ec)
+				return false;
+		}
+
+		if (format == binary) {
+			raw.open(path, std::ofstream::binary | ((carryOn) ? std::ofstream::app : std::ofstream::trunc));
+			if (!raw.is_open())
+				return false;
+
+			const uint32_t flags = 0;
+			const uint64_t samples = rows.size();
+			if (!carryOn) {
+				pending.append(MAGIC, 8);
+				pending.append((const char*)&VERSION, sizeof(VERSION));
+				pending.append((const char*)&flags, sizeof(flags));
+				pending.append((const char*)&samples, sizeof(samples));
+				pending.append((const char*)&threshold, sizeof(threshold));
+			}
+		}
+		else if (format == text) {
+			if (compression != pck::Packer::plain) {
+				if (!packer.open(path, compression, carryOn))
+					return false;
+				output.rdbuf(&packer);
+			}
+			else {
+				file.open(path, std::wfstream::out | ((carryOn) ? std::wfstream::app : std::wfstream::trunc));
+				if (!file.is_open())
+					return false;
+				output.rdbuf(file.rdbuf());
+			}
+			output.clear();
+			output << std::setprecision(8) << std::fixed;
+			if (!carryOn)
+				output << L"ForeignKey,ReferenceKey,Similarity\n";
+		}
+
+		this->format = format;
+		return true;
+	}
+
+	// One match. Rows are the metadata's, same as everywhere else.
+	void EdgeWriter::add(int foreign, int reference, double similarity)
+	{
+		if (format == text)
+			output << (*rows)[foreign].data.front() << L"," << (*rows)[reference].data.front() << L"," << similarity << L"\n";
+		else if (format == binary) {
+			const uint32_t pair[2] = { (uint32_t)foreign, (uint32_t)reference };
+			pending.append((const char*)pair, sizeof(pair));
+			pending.append((const char*)&similarity, sizeof(similarity));
+			if (pending.size() >= (1 << 20)) {
+				raw.write(pending.data(), pending.size());
+				pending.clear();
+			}
+		}
+	}
+
+	// Gets every match added so far into the file, and returns how long the file is then (0 if that failed). A
+	// compressed list closes its current member and starts another, so it can be carried on from right there.
+	uint64_t EdgeWriter::mark()
+	{
+		if (format == text) {
+			output.flush();
+			if (output.rdbuf() == &packer && (!packer.close() || !packer.open(path, compression, true)))
+				output.setstate(std::ios::badbit); //close() owns up to it
+		}
+		else if (format == binary) {
+			raw.write(pending.data(), pending.size());
+			pending.clear();
+			raw.flush();
+		}
+		else
+			return 0;
+
+		std::error_code ec;
+		uintmax_t length = std::filesystem::file_size(path, ec);
+		return (ec || ((format == text) ? output.fail() : !raw)) ? 0 : (uint64_t)length;
+	}
+
+	// Where the list's going
+	const std::string& EdgeWriter::getPath() const
+	{
+		return path;
+	}
+
+	// Writes out what's left and closes the file. False if anything went wrong along the way.
+	bool EdgeWriter::close()
+	{
+		bool ok = true;
+		if (format == text) {
+			output.flush();
+			ok = !output.fail();
+			if (output.rdbuf() == &packer)
+				ok = packer.close() && ok;
+			else
+				file.close();
+			output.rdbuf(nullptr);
+		}
+		else if (format == binary) {
+			raw.write(pending.data(), pending.size());
+			pending.clear();
+			ok = (bool)raw;
+			raw.close();
+		}
+		format = none;
+		return ok;
+	}
+}
@@ -0,0 +1,559 @@
+#include "pckcore.hpp"
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace pck {
+	// ===============================================================================
+	//                                   FileIndex                                   =
+	// ===============================================================================
+
+	namespace fs = std::filesystem;
+
+	// Statics
+	std::mutex FileIndex::registryLock;
+	std::map<std::string, std::unique_ptr<FileIndex>> FileIndex::registry;
+	std::set<std::string> FileIndex::building;
+	std::condition_variable FileIndex::built;
+	const std::vector<std::string> FileIndex::indexed = { "xml", "csv", "nwk", "newick", "xml.gz", "csv.gz", "nwk.gz", "newick.gz", "xml.zst", "csv.zst", "nwk.zst", "newick.zst" };
+
+	// Root folders are compared and hashed in a single spelling
+	static std::string normalizeRoot(std::string root)
+	{
+		for (auto& ch : root) {
+			if (ch == '/')
+				ch = '\\';
+#ifdef _WIN32
+			ch = (char)::tolower((unsigned char)ch);
+#endif
+		}
+		if (!root.empty() && root.back() != '\\')
+			root.push_back('\\');
+		return root;
+	}
+
+	// Folder where every index gets saved: local app data if there's one, temp folder otherwise
+	static fs::path indexFolder()
+	{
+		const char* base = std::getenv("LOCALAPPDATA");
+		if (base == nullptr)
+			base = std::getenv("XDG_CACHE_HOME");
+
+		std::error_code ec;
+		fs::path folder;
+		if (base != nullptr)
+			folder = fs::path(base) / "Peacock" / "index";
+		else if (std::getenv("HOME") != nullptr)
+			folder = fs::path(std::getenv("HOME")) / ".cache" / "Peacock" / "index";
+		else
+			folder = fs::temp_directory_path(ec) / "Peacock" / "index";
+
+		fs::create_directories(folder, ec);
+		return folder;
+	}
+
+	// FNV-1a, so the same root maps to the same index file across builds
+	static std::string hashName(const std::string& str)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (unsigned char ch : str) {
+			hash ^= ch;
+			hash *= 1099511628211ULL;
+		}
+
+		char name[24];
+		snprintf(name, sizeof(name), "%016llx.idx", (unsigned long long)hash);
+		return name;
+	}
+
+	// Folder modification time, or 0 if it's gone
+	static long long folderTime(const fs::path& folder)
+	{
+		std::error_code ec;
+		auto stamp = fs::last_write_time(folder, ec);
+		return (ec) ? 0 : (long long)stamp.time_since_epoch().count();
+	}
+
+	// Constructor: load whatever was saved, or sniff the whole tree if there's nothing
+	FileIndex::FileIndex(const std::string& root) : stopping(false), dirty(false)
+	{
+		this->root = root;
+		store = indexFolder() / hashName(root);
+
+		if (!load()) {
+			folders.clear();
+			scanTree("");
+			save();
+		}
+
+		watcher = std::thread(&FileIndex::watch, this);
+	}
+
+	// Destructor: stop watching and leave an up to date copy on disk
+	FileIndex::~FileIndex()
+	{
+		stopping = true;
+		if (watcher.joinable())
+			watcher.join();
+
+		if (dirty)
+			save();
+	}
+
+	// Real path to a folder kept as a path from root
+	fs::path FileIndex::fullPath(const std::string& folder) const
+	{
+		std::string full = root + folder;
+		for (auto& ch : full) {
+			if (ch == '\\')
+				ch = '/';
+		}
+		return fs::path(full);
+	}
+
+	// True if the file has any of the indexed extensions
+	bool FileIndex::wanted(const fs::path& file) const
+	{
+		for (auto& ext : indexed) {
+			if (hasExtension(file, ext))
+				return true;
+		}
+		return false;
+	}
+
+	// Reads one folder's listing into the index. Subfolders it didn't know about are read in full (see
+	// scanTree()), the ones that are gone are dropped. Returns false if the folder couldn't be read.
+	bool FileIndex::scanFolder(const std::string& folder)
+	{
+		Folder listing;
+		fs::path full = fullPath(folder);
+		listing.mtime = folderTime(full);
+
+		std::error_code err;
+		fs::directory_iterator it(full, fs::directory_options::skip_permission_denied, err);
+		if (err) {
+			dropFolder(folder);
+			return false;
+		}
+
+		for (; !err && it != fs::directory_iterator(); it.increment(err)) {
+			std::error_code staterr;
+			if (it->is_directory(staterr)) {
+				if (!it->is_symlink(staterr))
+					listing.subfolders.insert(it->path().filename().string());
+			}
+			else if (wanted(it->path()))
+				listing.files.insert(it->path().filename().string());
+		}
+
+		std::string prefix = (folder.empty()) ? "" : folder + "\\";
+		std::vector<std::string> fresh, gone;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			auto known = folders.find(folder);
+
+			for (auto& sub : listing.subfolders) {
+				if (folders.find(prefix + sub) == folders.end())
+					fresh.push_back(prefix + sub);
+			}
+			if (known != folders.end()) {
+				for (auto& sub : known->second.subfolders) {
+					if (listing.subfolders.count(sub) == 0)
+						gone.push_back(prefix + sub);
+				}
+			}
+
+			folders[folder] = std::move(listing);
+			dirty = true;
+		}
+
+		for (auto& sub : gone)
+			dropFolder(sub);
+		for (auto& sub : fresh)
+			scanTree(sub);
+		return true;
+	}
+
+	// Reads a folder and everything under it from scratch, sniffed in parallel and put together as the results
+	// come in, then swaps that in for whatever the index had there. Returns false if the folder couldn't be read.
+	bool FileIndex::scanTree(const std::string& folder)
+	{
+		std::string prefix = (folder.empty()) ? "" : folder + "\\";
+		std::map<std::string, Folder> fresh;
+
+		//packed copies are matched on top of the plain extensions
+		FileSniffer dognose;
+		for (auto& ext : indexed) {
+			if (ext.find('.') == std::string::npos)
+				dognose.extension += (dognose.extension.empty()) ? ext : "|" + ext;
+		}
+		dognose.path = fullPath(folder).string();
+		dognose.togglePrintMode(); //file name with path from root
+
+		bool readable = dognose.sniff(
+			[&](const std::string& file) {
+				size_t slash = file.find_last_of('\\');
+				if (slash == std::string::npos)
+					fresh[folder].files.insert(file);
+				else
+					fresh[prefix + file.substr(0, slash)].files.insert(file.substr(slash + 1));
+			},
+			[&](const std::string& sub) {
+				std::string current = (sub.empty()) ? folder : prefix + sub;
+				fresh[current].mtime = folderTime(fullPath(current));
+				if (sub.empty())
+					return;
+
+				size_t slash = sub.find_last_of('\\');
+				if (slash == std::string::npos)
+					fresh[folder].subfolders.insert(sub);
+				else
+					fresh[prefix + sub.substr(0, slash)].subfolders.insert(sub.substr(slash + 1));
+			});
+
+		if (!readable) {
+			dropFolder(folder);
+			return false;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (folder.empty())
+			folders.clear();
+		else {
+			folders.erase(folder);
+			for (auto it = folders.lower_bound(prefix); it != folders.end() && it->first.compare(0, prefix.length(), prefix) == 0;)
+				it = folders.erase(it);
+		}
+		folders.merge(fresh);
+		dirty = true;
+		return true;
+	}
+
+	// Forgets a folder and everything under it
+	void FileIndex::dropFolder(const std::string& folder)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::string prefix = folder + "\\";
+
+		folders.erase(folder);
+		for (auto it = folders.lower_bound(prefix); it != folders.end() && it->first.compare(0, prefix.length(), prefix) == 0;)
+			it = folders.erase(it);
+		dirty = true;
+	}
+
+	// Re-reads only the folders whose modification time moved since the index was saved
+	void FileIndex::reconcile()
+	{
+		std::vector<std::pair<std::string, long long>> known;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (auto& folder : folders)
+				known.emplace_back(folder.first, folder.second.mtime);
+		}
+
+		for (auto& folder : known) {
+			if (stopping)
+				return;
+
+			long long stamp = folderTime(fullPath(folder.first));
+			if (stamp == 0) {
+				dropFolder(folder.first);
+			}
+			else if (stamp != folder.second) {
+				bool stillThere;
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					stillThere = folders.count(folder.first) > 0; //might have been dropped with its parent
+				}
+				if (stillThere)
+					scanFolder(folder.first);
+			}
+		}
+	}
+
+	// Loads the saved index. Returns false if there's none, or if it's for something else.
+	bool FileIndex::load()
+	{
+		std::ifstream file(store);
+		if (!file.is_open())
+			return false;
+
+		std::string line, exts;
+		for (auto& ext : indexed)
+			exts.append(ext + " ");
+
+		if (!std::getline(file, line) || line != "PCKINDEX 1")
+			return false;
+		if (!std::getline(file, line) || line != root)
+			return false;
+		if (!std::getline(file, line) || line != exts)
+			return false; //indexed extensions changed, start over
+
+		Folder* current = nullptr;
+		while (std::getline(file, line)) {
+			if (line.length() < 2 || line[1] != '\t')
+				return false;
+
+			if (line[0] == 'D') {
+				size_t tab = line.find('\t', 2);
+				if (tab == std::string::npos)
+					return false;
+				current = &folders[line.substr(tab + 1)];
+				try {
+					current->mtime = std::stoll(line.substr(2, tab - 2));
+				}
+				catch (const std::exception&) { //mangled, start over
+					return false;
+				}
+			}
+			else if (current == nullptr)
+				return false;
+			else if (line[0] == 'S')
+				current->subfolders.insert(line.substr(2));
+			else if (line[0] == 'F')
+				current->files.insert(line.substr(2));
+		}
+
+		return !folders.empty();
+	}
+
+	// Saves the index next to the others, replacing the old copy in one go
+	void FileIndex::save()
+	{
+		fs::path temp = store;
+		temp += ".tmp";
+
+		{
+			std::ofstream file(temp, std::ofstream::trunc);
+			if (!file.is_open())
+				return;
+
+			std::lock_guard<std::mutex> guard(lock);
+			file << "PCKINDEX 1\n" << root << "\n";
+			for (auto& ext : indexed)
+				file << ext << " ";
+			file << "\n";
+
+			for (auto& folder : folders) {
+				file << "D\t" << folder.second.mtime << "\t" << folder.first << "\n";
+				for (auto& sub : folder.second.subfolders)
+					file << "S\t" << sub << "\n";
+				for (auto& name : folder.second.files)
+					file << "F\t" << name << "\n";
+			}
+			dirty = false;
+		}
+
+		std::error_code ec;
+		fs::rename(temp, store, ec);
+	}
+
+	// Watcher thread: catch up with what changed while Peacock was closed, then follow changes live.
+	// Changed folders are simply re-read; lost events mean a full reconcile.
+	void FileIndex::watch()
+	{
+		reconcile();
+		if (dirty)
+			save();
+
+		int idle = 0; //quarter-seconds without changes, saves are held back until things calm down
+		auto settle = [&](const std::set<std::string>& changed) {
+			for (auto& folder : changed)
+				scanFolder(folder);
+			idle = changed.empty() ? idle + 1 : 0;
+			if (dirty && idle >= 8)
+				save();
+		};
+
+#ifdef _WIN32
+		HANDLE dir = CreateFileW(fullPath("").c_str(), FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+			FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+		if (dir == INVALID_HANDLE_VALUE)
+			return;
+
+		OVERLAPPED ov = {};
+		ov.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+		alignas(DWORD) char buffer[64 * 1024];
+
+		while (!stopping) {
+			ResetEvent(ov.hEvent);
+			if (!ReadDirectoryChangesW(dir, buffer, sizeof(buffer), TRUE,
+				FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME, NULL, &ov, NULL))
+				break;
+
+			while (!stopping && WaitForSingleObject(ov.hEvent, 250) == WAIT_TIMEOUT)
+				settle({});
+
+			if (stopping) {
+				CancelIo(dir);
+				WaitForSingleObject(ov.hEvent, INFINITE);
+				break;
+			}
+
+			DWORD bytes = 0;
+			GetOverlappedResult(dir, &ov, &bytes, FALSE);
+			if (bytes == 0) { //buffer overflowed, we don't know what changed
+				scanTree("");
+				continue;
+			}
+
+			std::set<std::string> changed;
+			for (char* at = buffer;;) {
+				FILE_NOTIFY_INFORMATION* info = (FILE_NOTIFY_INFORMATION*)at;
+				std::wstring name(info->FileName, info->FileNameLength / sizeof(WCHAR));
+				size_t slash = name.find_last_of(L'\\');
+				changed.insert((slash == std::wstring::npos) ? "" : fs::path(name.substr(0, slash)).string());
+
+				if (info->NextEntryOffset == 0)
+					break;
+				at += info->NextEntryOffset;
+			}
+			settle(changed);
+		}
+
+		CloseHandle(ov.hEvent);
+		CloseHandle(dir);
+#else
+		int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+		std::map<int, std::string> watches;
+		std::set<std::string> watched;
+
+		//keep one watch per indexed folder, inotify isn't recursive
+		auto syncWatches = [&]() {
+			std::vector<std::string> fresh;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				for (auto& folder : folders) {
+					if (watched.count(folder.first) == 0)
+						fresh.push_back(folder.first);
+				}
+			}
+			for (auto& folder : fresh) {
+				int wd = inotify_add_watch(fd, fullPath(folder).c_str(), mask);
+				if (wd >= 0) {
+					watches[wd] = folder;
+					watched.insert(folder);
+				}
+			}
+		};
+		syncWatches();
+
+		alignas(struct inotify_event) char buffer[64 * 1024];
+		while (!stopping) {
+			pollfd pfd = { fd, POLLIN, 0 };
+			if (poll(&pfd, 1, 250) <= 0) {
+				settle({});
+				continue;
+			}
+
+			std::set<std::string> changed;
+			bool overflow = false;
+			ssize_t len;
+			while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+				for (char* at = buffer; at < buffer + len;) {
+					struct inotify_event* ev = (struct inotify_event*)at;
+					if (ev->mask & IN_Q_OVERFLOW)
+						overflow = true;
+					else if (ev->mask & IN_IGNORED) {
+						watched.erase(watches[ev->wd]);
+						watches.erase(ev->wd);
+					}
+					else if (watches.count(ev->wd))
+						changed.insert(watches[ev->wd]);
+					at += sizeof(struct inotify_event) + ev->len;
+				}
+			}
+
+			if (overflow)
+				scanTree("");
+			settle(changed);
+			syncWatches();
+		}
+
+		close(fd);
+#endif
+	}
+
+	// public:
+
+	// Indexed files with the given extension under root, sorted, each with its path from root
+	std::pair<bool, std::vector<std::string>> FileIndex::find(const std::string& extension) const
+	{
+		std::vector<std::string> results;
+		std::string ext = extension;
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (auto& folder : folders) {
+				std::string prefix = (folder.first.empty()) ? "" : folder.first + "\\";
+				for (auto& name : folder.second.files) {
+					if (hasPackedExtension(fs::path(name), ext))
+						results.push_back(prefix + name);
+				}
+			}
+		}
+
+		std::sort(results.begin(), results.end());
+		return std::pair<bool, std::vector<std::string>>(!results.empty(), results);
+	}
+
+	// Looks files up in the index for root, opening (and from then on watching) it on first use. Opening may
+	// mean scanning the whole tree: that's done outside the registry's lock, so only lookups for the same root
+	// wait on it.
+	std::pair<bool, std::vector<std::string>> FileIndex::lookup(const std::string& root, const std::string& extension)
+	{
+		std::string key = normalizeRoot(root);
+		std::error_code ec;
+		if (key.empty() || !fs::is_directory(fs::path(root), ec))
+			return std::pair<bool, std::vector<std::string>>(false, {});
+
+		std::unique_lock<std::mutex> guard(registryLock);
+		built.wait(guard, [&]() { return building.count(key) == 0; });
+		auto slot = registry.find(key);
+		if (slot == registry.end()) {
+			building.insert(key);
+			guard.unlock();
+
+			std::unique_ptr<FileIndex> fresh;
+			try {
+				fresh.reset(new FileIndex(key));
+			}
+			catch (...) {
+				guard.lock();
+				building.erase(key);
+				built.notify_all();
+				throw;
+			}
+
+			guard.lock();
+			building.erase(key);
+			slot = registry.emplace(key, std::move(fresh)).first;
+			built.notify_all();
+		}
+		FileIndex* index = slot->second.get();
+		guard.unlock();
+
+		return index->find(extension);
+	}
+
+	// Stops every watcher and saves every index. Call before leaving the program.
+	void FileIndex::closeAll()
+	{
+		std::lock_guard<std::mutex> guard(registryLock);
+		registry.clear();
+	}
+}
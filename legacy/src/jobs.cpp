@@ -0,0 +1,183 @@
+#include "pckcore.hpp"
+#include <algorithm>
+#include <exception>
+
+namespace pck {
+	// ===============================================================================
+	//                                   JobRunner                                   =
+	// ===============================================================================
+
+	// Constructor. Workers aren't started until there's something for them to do.
+	JobRunner::JobRunner(unsigned workers)
+	{
+		maxWorkers = std::max(workers, 1u);
+		nextId = 1;
+		stopping = false;
+	}
+
+	// Destructor
+	JobRunner::~JobRunner()
+	{
+		shutdown();
+	}
+
+	// The framework's own, shared by every utility
+	JobRunner& JobRunner::shared()
+	{
+		static JobRunner runner;
+		return runner;
+	}
+
+	// Job by id, if it's still around. Lock held.
+	JobRunner::Job* JobRunner::find(int id)
+	{
+		for (Job& job : jobs) {
+			if (job.id == id)
+				return &job;
+		}
+		return nullptr;
+	}
+
+	// Queues a job and hands back its id, or 0 if the runner's shutting down (and the task was dropped)
+	int JobRunner::submit(const std::string& label, std::unique_ptr<Task> task)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping || task == nullptr)
+			return 0;
+
+		Job job;
+		job.id = nextId++;
+		job.label = label;
+		job.task = std::move(task);
+		job.state = State::queued;
+		job.code = 0;
+		jobs.push_back(std::move(job));
+
+		while (workers.size() < maxWorkers)
+			workers.emplace_back(&JobRunner::work, this);
+		changed.notify_one();
+		return jobs.back().id;
+	}
+
+	// Worker thread: takes the oldest queued job, runs it outside the lock, and records how it went
+	void JobRunner::work()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			auto next = std::find_if(jobs.begin(), jobs.end(), [](const Job& job) { return job.state == State::queued; });
+			if (stopping)
+				return;
+			if (next == jobs.end()) {
+				changed.wait(guard);
+				continue;
+			}
+
+			next->state = State::running;
+			next->started = std::chrono::steady_clock::now();
+			const int id = next->id;
+			Task* task = next->task.get();
+			guard.unlock();
+
+			std::string failure;
+			int code;
+			try {
+				code = task->run(failure);
+			}
+			catch (const std::exception & e) {
+				failure = e.what();
+				code = 10;
+			}
+			catch (...) {
+				code = 10;
+			}
+
+			guard.lock();
+			std::unique_ptr<Task> done;
+			if (Job* job = find(id)) {
+				job->state = State::finished;
+				job->ended = std::chrono::steady_clock::now();
+				job->code = code;
+				job->failure = failure;
+				done = std::move(job->task);
+			}
+
+			//only the last few outcomes are worth showing
+			size_t finished = std::count_if(jobs.begin(), jobs.end(), [](const Job& job) { return job.state == State::finished; });
+			for (auto it = jobs.begin(); it != jobs.end() && finished > keptFinished; ) {
+				if (it->state == State::finished) {
+					it = jobs.erase(it);
+					--finished;
+				}
+				else
+					++it;
+			}
+
+			//whatever the task held may take a while to free, and nobody needs the lock for that
+			guard.unlock();
+			done.reset();
+			guard.lock();
+		}
+	}
+
+	// Every job's state, running ones first, then queued ones in the order they'll go, then finished ones
+	// from the latest back
+	std::vector<JobRunner::Status> JobRunner::snapshot()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto now = std::chrono::steady_clock::now();
+		std::vector<Status> running, queued, finished;
+
+		for (const Job& job : jobs) {
+			Status status = { job.id, job.label, job.state, job.code, job.failure, std::string(), 0, 0, 0, 0 };
+			if (job.state == State::running) {
+				status.seconds = std::chrono::duration<double>(now - job.started).count();
+				if (const Progress* progress = job.task->getProgress()) {
+					status.phase = job.task->phaseName(progress->getPhase());
+					status.done = progress->getDone();
+					status.total = progress->getTotal();
+					status.rate = progress->rate();
+				}
+				else
+					status.phase = job.task->phaseName(-1);
+				running.push_back(status);
+			}
+			else if (job.state == State::queued)
+				queued.push_back(status);
+			else {
+				status.seconds = std::chrono::duration<double>(job.ended - job.started).count();
+				finished.push_back(status);
+			}
+		}
+
+		running.insert(running.end(), queued.begin(), queued.end());
+		running.insert(running.end(), finished.rbegin(), finished.rend());
+		return running;
+	}
+
+	// Jobs that are running or waiting to
+	int JobRunner::active()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return (int)std::count_if(jobs.begin(), jobs.end(), [](const Job& job) { return job.state != State::finished; });
+	}
+
+	// Drops every queued job, tells the running ones to stop, and waits for them. No more jobs after this.
+	void JobRunner::shutdown()
+	{
+		std::vector<std::thread> leaving;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+			jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [](const Job& job) { return job.state == State::queued; }), jobs.end());
+			for (Job& job : jobs) {
+				if (job.state == State::running)
+					job.task->cancel();
+			}
+			leaving.swap(workers);
+		}
+		changed.notify_all();
+
+		for (auto& worker : leaving)
+			worker.join();
+	}
+}
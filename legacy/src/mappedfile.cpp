@@ -0,0 +1,200 @@
+#include "pckcore.hpp"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace pck {
+	// ===============================================================================
+	//                                   MappedFile                                  =
+	// ===============================================================================
+
+	// Constructor
+	MappedFile::MappedFile()
+	{
+		view = nullptr;
+		length = 0;
+		mapping = nullptr;
+		handle = nullptr;
+		writable = false;
+	}
+
+	// Destructor
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	// Maps the file, or reads it all in if it's packed or won't map. False if it can't be read at all, or if
+	// "cancelled" got set while reading it in.
+	bool MappedFile::open(const std::string& path, const std::atomic<bool>* cancelled)
+	{
+		close();
+		if (Unpacker::sniff(path) != Packer::plain)
+			return readAll(path, cancelled);
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize)) {
+			CloseHandle(file);
+			return false;
+		}
+		if (fileSize.QuadPart == 0) { //nothing to map
+			CloseHandle(file);
+			return true;
+		}
+
+		HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const void* address = (map != nullptr) ? MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (address == nullptr) {
+			if (map != nullptr)
+				CloseHandle(map);
+			CloseHandle(file);
+			return readAll(path, cancelled);
+		}
+
+		handle = file;
+		mapping = map;
+		view = (const char*)address;
+		length = (size_t)fileSize.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			::close(fd);
+			return false;
+		}
+		if (info.st_size == 0) { //nothing to map
+			::close(fd);
+			return true;
+		}
+
+		void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); //the mapping keeps the file around
+		if (address == MAP_FAILED)
+			return readAll(path, cancelled);
+
+		madvise(address, (size_t)info.st_size, MADV_WILLNEED);
+		mapping = address;
+		view = (const char*)address;
+		length = (size_t)info.st_size;
+#endif
+		return true;
+	}
+
+	// Makes a new file "size" bytes long (replacing any that's there) and maps it for writing. False if it
+	// can't be made or mapped; there's no falling back to memory here, the point is not to need that much of it.
+	bool MappedFile::create(const std::string& path, size_t size)
+	{
+		close();
+
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		if (size == 0) { //nothing to map
+			CloseHandle(file);
+			writable = true;
+			return true;
+		}
+
+		const unsigned long long wanted = size;
+		HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)(wanted >> 32), (DWORD)(wanted & 0xFFFFFFFF), nullptr);
+		void* address = (map != nullptr) ? MapViewOfFile(map, FILE_MAP_WRITE, 0, 0, 0) : nullptr;
+		if (address == nullptr) {
+			if (map != nullptr)
+				CloseHandle(map);
+			CloseHandle(file);
+			return false;
+		}
+
+		handle = file;
+		mapping = map;
+#else
+		int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return false;
+		if (size == 0) {
+			::close(fd);
+			writable = true;
+			return true;
+		}
+		if (ftruncate(fd, (off_t)size) != 0) {
+			::close(fd);
+			return false;
+		}
+
+		void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (address == MAP_FAILED)
+			return false;
+
+		mapping = address;
+#endif
+		view = (const char*)address;
+		length = size;
+		writable = true;
+		return true;
+	}
+
+	// Reads the whole file into memory, decompressing it if need be. Gives up (and lets go of what it has) once
+	// "cancelled" is set.
+	bool MappedFile::readAll(const std::string& path, const std::atomic<bool>* cancelled)
+	{
+		Unpacker source;
+		if (!source.open(path))
+			return false;
+
+		std::error_code ec;
+		uintmax_t onDisk = std::filesystem::file_size(path, ec);
+		copy.reserve((ec) ? 0 : (size_t)onDisk);
+
+		size_t got;
+		do {
+			if (cancelled != nullptr && *cancelled) {
+				std::vector<char>().swap(copy);
+				return false;
+			}
+			size_t used = copy.size();
+			copy.resize(used + (1 << 20));
+			got = source.read(copy.data() + used, 1 << 20);
+			copy.resize(used + got);
+		} while (got > 0);
+
+		view = copy.data();
+		length = copy.size();
+		return true;
+	}
+
+	// Unmaps the file or lets go of its copy
+	void MappedFile::close()
+	{
+#ifdef _WIN32
+		if (mapping != nullptr) {
+			UnmapViewOfFile(view);
+			CloseHandle((HANDLE)mapping);
+			CloseHandle((HANDLE)handle);
+		}
+#else
+		if (mapping != nullptr)
+			munmap(mapping, length);
+#endif
+		mapping = nullptr;
+		handle = nullptr;
+		view = nullptr;
+		length = 0;
+		writable = false;
+		copy = std::vector<char>();
+	}
+}
@@ -1,16 +1,107 @@
 #include "matrixinator.hpp"
 #include <fstream>
 #include <cstring>
+#include <algorithm>
 
 namespace mtx {
+    // ===============================================================================
+    //                                   RunConfig                                   =
+    // ===============================================================================
+
+    // True if both I/O files exist
+    bool RunConfig::ioDefined()
+    {
+        return pck::FileSniffer::exists(paths.getFullFilepath(true)) && pck::FileSniffer::exists(paths.getFullFilepath(false));
+    }
+
+    // Points the paths at both files. DisplayPaths wants one root folder for them, so this takes the
+    // deepest one they share; false if there's none.
+    bool RunConfig::setInputs(const std::filesystem::path& tree, const std::filesystem::path& meta)
+    {
+        std::filesystem::path root;
+        auto ti = tree.begin(), mi = meta.begin();
+        for (; ti != tree.end() && mi != meta.end() && *ti == *mi && std::next(ti) != tree.end() && std::next(mi) != meta.end(); ++ti, ++mi)
+            root /= *ti;
+        if (root.empty())
+            return false;
+
+        paths.setFolder(root.string() + "\\");
+        paths.setFile(meta.lexically_relative(root).string());
+        paths.setFile(tree.lexically_relative(root).string());
+        return true;
+    }
+
+    // Reads a list of similarity thresholds, such as "80" or "70/75/80". Anything but digits and dots
+    // separates them. False (and no change) unless every one of them is above 0 and up to 100.
+    bool RunConfig::setThresholds(const std::string& list)
+    {
+        std::vector<double> values;
+        std::string number;
+        if (list.find('-') != std::string::npos) //no negatives, and no ranges either
+            return false;
+
+        for (size_t i = 0; i <= list.size(); ++i) {
+            if (i < list.size() && (isdigit((unsigned char)list[i]) || list[i] == '.'))
+                number += list[i];
+            else if (!number.empty()) {
+                double value = atof(number.c_str());
+                if (value <= 0 || value > 100)
+                    return false;
+                if (std::find(values.begin(), values.end(), value) == values.end())
+                    values.push_back(value);
+                number.clear();
+            }
+        }
+
+        if (values.empty())
+            return false;
+        thresholds = values;
+        return true;
+    }
+
+    // The thresholds, the way setThresholds reads them
+    std::string RunConfig::thresholdList() const
+    {
+        std::string list;
+        char number[32];
+        for (const double& value : thresholds) {
+            snprintf(number, sizeof(number), "%g", value);
+            list += (list.empty()) ? number : std::string("/") + number;
+        }
+        return list;
+    }
+
+    // Reads the pair matrix's cutoff: above 0 and up to 100, or 0 for no pair matrix at all.
+    // False (and no change) if it's anything else.
+    bool RunConfig::setPairCutoff(const std::string& value)
+    {
+        char* end = nullptr;
+        double cutoff = strtod(value.c_str(), &end);
+        while (end != nullptr && isspace((unsigned char)*end))
+            ++end;
+        if (value.empty() || end == value.c_str() || *end != '\0' || cutoff < 0 || cutoff > 100)
+            return false;
+
+        pairCutoff = cutoff;
+        return true;
+    }
+
+    // Number of threads the sweep gets to use
+    unsigned RunConfig::sweepThreads() const
+    {
+        unsigned count = (threads > 0) ? threads : std::thread::hardware_concurrency();
+        return (count > 0) ? count : 1;
+    }
+
     // ===============================================================================
     //                                  MatrixConfig                                 =
     // ===============================================================================
 
     // Statics
-    bool MatrixConfig::detailed = false;
-    bool MatrixConfig::overwrite = false;
-    DisplayPaths MatrixConfig::paths = DisplayPaths::DisplayPaths();
+    RunConfig MatrixConfig::session = RunConfig();
+    std::unique_ptr<Matrixinator> MatrixConfig::preloaded;
+    static std::mutex leavingLock;
+    static std::vector<std::future<void>> leaving; //runs being let go of, see letGo()
 
     // Constructors
     MatrixConfig::MatrixConfig() 
@@ -22,13 +113,15 @@ namespace mtx {
     }
 
     // TODO: .ini file configuration load from this (or another?) constructor
-    MatrixConfig::MatrixConfig(std::string tf, std::string mf, std::string rf, bool ow, bool dt) 
+    MatrixConfig::MatrixConfig(std::string tf, std::string mf, std::string rf, bool ow, bool dt, bool rs, bool cl) 
     {
-        paths.setFolder(rf);
-        paths.setFile(mf);
-        paths.setFile(tf);
-        overwrite = ow;
-        detailed = dt;
+        session.paths.setFolder(rf);
+        session.paths.setFile(mf);
+        session.paths.setFile(tf);
+        session.overwrite = ow;
+        session.detailed = dt;
+        session.resume = rs;
+        session.columnar = cl;
         ioDefined = checkFile(true) && checkFile(false);
         init_color(gray, 500, 500, 500);
         init_pair(10, gray, COLOR_BLACK);
@@ -37,34 +130,159 @@ namespace mtx {
     // Toggle overwrite
     void MatrixConfig::toggleOverwrite() 
     {
-        overwrite = !overwrite;
+        session.overwrite = !session.overwrite;
     }
 
     // Toggle detailed mode
     void MatrixConfig::toggleDetailed() 
     {
-        detailed = !detailed;
+        session.detailed = !session.detailed;
+    }
+
+    // Toggle resume from checkpoint
+    void MatrixConfig::toggleResume() 
+    {
+        session.resume = !session.resume;
+    }
+
+    // Toggle columnar output
+    void MatrixConfig::toggleColumnar() 
+    {
+        session.columnar = !session.columnar;
+    }
+
+    // Toggle compact (float32) octagons
+    void MatrixConfig::toggleCompact() 
+    {
+        session.compact = !session.compact;
+    }
+
+    // Next compression format that's built in, wrapping around to none
+    void MatrixConfig::cycleCompression() 
+    {
+        do {
+            session.compression = (pck::Packer::Format)((session.compression + 1) % 3);
+        } while (!pck::Packer::available(session.compression));
+    }
+
+    // Next edge list format, wrapping around to none
+    void MatrixConfig::cycleEdges() 
+    {
+        session.edges = (EdgeWriter::Format)((session.edges + 1) % 3);
+    }
+
+    // Next dense matrix format, wrapping around to none
+    void MatrixConfig::cycleDense() 
+    {
+        session.dense = (DenseMatrix::Format)((session.dense + 1) % 3);
+    }
+
+    // Cancels a run and destroys it on a thread of its own: waiting for its loader to notice never holds up the menus.
+    // The thread's kept track of until it's done, so closeAll() can wait for it.
+    static void letGo(std::unique_ptr<Matrixinator> mtx)
+    {
+        if (mtx == nullptr)
+            return;
+        mtx->cancel();
+
+        std::lock_guard<std::mutex> guard(leavingLock);
+        leaving.erase(std::remove_if(leaving.begin(), leaving.end(), [](std::future<void>& gone) {
+            return gone.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), leaving.end());
+        leaving.push_back(std::async(std::launch::async, [](std::unique_ptr<Matrixinator> mtx) { mtx.reset(); }, std::move(mtx)));
+    }
+
+    // Lets go of the preloaded inputs and waits for every run that's being let go of. Call before leaving the
+    // program, so none of them outlives what they use (the tree cache, for one).
+    void MatrixConfig::closeAll()
+    {
+        letGo(std::move(preloaded));
+
+        std::lock_guard<std::mutex> guard(leavingLock);
+        for (auto& gone : leaving)
+            gone.get();
+        leaving.clear();
+    }
+
+    // Starts reading the selected inputs in the background once both are set. A preload of anything else is
+    // cancelled and let go of.
+    void MatrixConfig::preload()
+    {
+        if (preloaded && preloaded->sameInputs(session))
+            return;
+
+        letGo(std::move(preloaded));
+        if (session.ioDefined()) {
+            preloaded.reset(new Matrixinator(session, TreeCache::get));
+            preloaded->preload();
+        }
     }
 
     // Checks if file exist at readFolder
     bool MatrixConfig::checkFile(bool metafile) 
     {
 
-        std::fstream chk(paths.getFullFilepath(metafile), std::fstream::in);
+        std::fstream chk(session.paths.getFullFilepath(metafile), std::fstream::in);
         bool check = chk.is_open();
         chk.close();
 
         return check;
     }
 
+    // A run as one of the framework's jobs: its phases go on the runner's thread, the status panel follows its progress
+    class MatrixJob : public pck::JobRunner::Task {
+        std::unique_ptr<Matrixinator> mtx;
+
+    public:
+        MatrixJob(std::unique_ptr<Matrixinator> mtx) : mtx(std::move(mtx)) {}
+
+        int run(std::string& failure) override
+        {
+            int code = mtx->run();
+            failure = mtx->getFailure();
+            if (failure.empty() && Matrixinator::explain(code) != nullptr)
+                failure = Matrixinator::explain(code);
+            return code;
+        }
+        const pck::Progress* getProgress() const override
+        {
+            return &mtx->getProgress();
+        }
+        const char* phaseName(int phase) const override
+        {
+            static const char* phases[] = { "reading", "indexing", "sweeping", "writing" };
+            return phases[(phase >= 0 && phase < 4) ? phase : 0];
+        }
+        void cancel() override
+        {
+            mtx->cancel();
+        }
+    };
+
     // Option parser
     void MatrixConfig::parseopt(int& option)
     {
         if (!folder) {
             if (option == 0) { //init program
-                Matrixinator* mtx = new Matrixinator();
-                mtx->mainSequence();
-                delete mtx;
+                if (!session.ioDefined()) {
+                    move(20, 0); attron(COLOR_PAIR(pck::ERRCOLOR));
+                    printw("<I/O Files have not been defined! Press any key.>");
+                    attroff(COLOR_PAIR(pck::ERRCOLOR));
+                    getch();
+                    move(20, 0); clrtoeol();
+                }
+                else {
+                    std::unique_ptr<Matrixinator> mtx;
+                    if (preloaded && preloaded->adopt(session)) //inputs already read, or on their way
+                        mtx = std::move(preloaded);
+                    else
+                        mtx.reset(new Matrixinator(session, TreeCache::get)); //same tree as last time? no need to reload it
+
+                    //off it goes: the menu's free again as soon as it's queued
+                    std::string label = std::filesystem::path(session.paths.getFullFilepath(true)).filename().string();
+                    pck::JobRunner::shared().submit(label, std::unique_ptr<pck::JobRunner::Task>(new MatrixJob(std::move(mtx))));
+                    showJobPanel();
+                }
             }
             else if (option == 1) { //config folders
                 setFolders();
@@ -73,17 +291,55 @@ namespace mtx {
             }
             else if (option == 2) { //toggle overwrite
                 toggleOverwrite();
-                if (overwrite == false)
-                    mvchgat(2, 9, 9, COLOR_PAIR(pck::ERRCOLOR), 120, NULL);
-                else
-                    mvchgat(2, 9, 9, COLOR_PAIR(pck::OKCOLOR), 121, NULL);
+                statistiks();
             }
             else if (option == 3) { //toggle detailed
                 toggleDetailed();
-                if (detailed == false)
-                    mvchgat(2, 21, 8, COLOR_PAIR(pck::ERRCOLOR), 120, NULL);
-                else
-                    mvchgat(2, 21, 8, COLOR_PAIR(pck::OKCOLOR), 121, NULL);
+                statistiks();
+            }
+            else if (option == 4) { //toggle resume
+                toggleResume();
+                statistiks();
+            }
+            else if (option == 5) { //toggle columnar
+                toggleColumnar();
+                statistiks();
+            }
+            else if (option == 6) { //toggle compact
+                toggleCompact();
+                statistiks();
+            }
+            else if (option == 7) { //compression
+                cycleCompression();
+                statistiks();
+            }
+            else if (option == 8) { //edge list
+                cycleEdges();
+                statistiks();
+            }
+            else if (option == 9) { //thresholds
+                askThresholds();
+                printheader();
+                option = 0;
+            }
+            else if (option == 10) { //pair matrix
+                askPairCutoff();
+                printheader();
+                option = 0;
+            }
+            else if (option == 11) { //dense matrix
+                cycleDense();
+                statistiks();
+            }
+            else if (option == 12) { //batch manifest
+                runBatch();
+                printheader();
+                option = 0;
+            }
+            else if (option == 13) { //query service
+                runService();
+                printheader();
+                option = 0;
             }
         }
         else {
@@ -95,100 +351,68 @@ namespace mtx {
                 getnstr(in, 790);
 
                 if (strcmp(in, "reset") == 0)
-                    paths.setFolder("");
+                    session.paths.setFolder("");
 
                 else if (in[0] != '\0') {
-                    paths.setFolder(in);
+                    session.paths.setFolder(in);
                 }
 
-                for (int i = 8; i < getmaxy(stdscr); ++i) {
-                    move(i, 0); clrtoeol();
-                }
-
-                move(3, 30); clrtoeol();
-                attron(A_BOLD);
-                mvprintw(3, 30, " %s", paths.getVFolder().c_str());
-                attroff(A_BOLD);
-                refresh();
+                pck::Screen& screen = pck::Screen::shared();
+                for (int i = 8; i < screen.height() - jobRows; ++i) //the prompt and however far the answer went
+                    screen.erase(i);
 
                 curs_set(0); raw(); noecho();
             }
-            else if (option == 1 || option == 2) { // 1 = dendrogram .xml | 2 = metadata .csv
-                pck::FileSniffer dognose;
-                dognose.path = paths.getRFolder();
-                (option == 1) ?
-                    dognose.extension = "xml" :
-                    dognose.extension = "csv";
-                dognose.togglePrintMode(); //default filename, we want file + path from root
-                std::pair<bool, std::vector<std::string>> results = dognose.find();
+            else if (option == 1 || option == 2) { // 1 = dendrogram .xml/.nwk/.newick | 2 = metadata .csv
+                //the index hands back the same file + path from root a FileSniffer would, minus the rescan
+                std::string extension = (option == 1) ? "xml|nwk|newick" : "csv";
+                std::pair<bool, std::vector<std::string>> results = pck::FileIndex::lookup(session.paths.getRFolder(), extension);
 
+                pck::Screen& screen = pck::Screen::shared();
                 if (results.first == false) {
-                    //because pck::(w)printerr doesn't do well with C-strings apparently
-                    move(8, 0); attron(COLOR_PAIR(pck::ERRCOLOR));
-                    printw("<no .%s files found in the specified folder - please try a different path. press any key.>", dognose.extension.c_str());
-                    attroff(COLOR_PAIR(pck::ERRCOLOR));
+                    screen.printf(8, 0, COLOR_PAIR(pck::ERRCOLOR), "<no %s files found in the specified folder - please try a different path. press any key.>",
+                        (option == 1) ? ".xml/.nwk/.newick" : ".csv");
+                    screen.flush();
                     getch();
-                    move(8, 0); clrtoeol();
+                    screen.erase(8);
                 }
                 else {
                     //trim visuals
                     std::vector<std::string> visuals;
                     for (auto& item : results.second) {
-                        if (item.length() > paths.getCharLim())
-                            visuals.push_back(paths.pathTrimmer(item));
+                        if (item.length() > session.paths.getCharLim())
+                            visuals.push_back(session.paths.pathTrimmer(item));
                         else
                             visuals.push_back(item);
                     }
 
-                    attron(COLOR_PAIR(pck::OKCOLOR));
-                    mvprintw(8, 0, "%d result(s) found. ", results.second.size());
-                    attroff(COLOR_PAIR(pck::OKCOLOR));
-                    printw("Please select a file, or press F1 to go back.");
+                    int x = screen.printf(8, 0, COLOR_PAIR(pck::OKCOLOR), "%d result(s) found. ", (int)results.second.size());
+                    screen.print(8, x, "Please select a file, or press F1 to go back.");
 
-                    pck::DisplayQueue displ(visuals, 10);
+                    pck::DisplayQueue displ(std::move(visuals), 10);
                     int choice = displ.qmenu();
-                    if (choice >= 0) {
-                        paths.setFile(results.second.at(choice));
-                        attron(A_BOLD);
-                        if (option == 1) {
-                            move(3, 30); clrtoeol();
-                            mvprintw(3, 30, " %s", paths.getVFolder().c_str());
-                            move(4, 30); clrtoeol();
-                            mvprintw(4, 30, " %s", paths.getTree().c_str());
-                        }
-                        else {
-                            move(3, 30); clrtoeol();
-                            mvprintw(3, 30, " %s", paths.getVFolder().c_str());
-                            move(5, 30); clrtoeol();
-                            mvprintw(5, 30, " %s", paths.getMeta().c_str());
-                        }
-                        attroff(A_BOLD);
-                    }
+                    if (choice >= 0)
+                        session.paths.setFile(results.second.at(choice));
 
-                    for (int i = 0; i < 11; ++i) {
-                        move(8 + i, 0); clrtoeol();
-                    }
+                    for (int i = 0; i < 12; ++i)
+                        screen.erase(8 + i);
                 }
             }
             ioDefined = checkFile(true) && checkFile(false);
-            move(2, 14); clrtoeol(); move(2, 14);
-            (ioDefined) ?
-                pck::printok("set.\n") :
-                pck::printerr("not set.\n");
+            showFiles();
+            preload(); //whatever changed, the background load follows the selection
         }
     }
 
     // Print header
     void MatrixConfig::printheader() 
     {
-        clear(); move(0, 0); //raw(); curs_set(0); pck::initcolors(); nonl();
-        resize_term(0, 0);
+        pck::Screen& screen = pck::Screen::shared();
+        screen.erase(); //raw(); curs_set(0); pck::initcolors(); nonl();
         folder = false;
-        attron(COLOR_PAIR(115));
-        printw("The Matrixinator v%s (%s)\n", MTXVER, MTXREL);      //0
-        printw("---------------------------------------------\n");  //1
-        attroff(COLOR_PAIR(115));
-        statistiks(); //2
+        screen.printf(0, 0, COLOR_PAIR(115), "The Matrixinator v%s (%s)", MTXVER, MTXREL);     //0
+        screen.print(1, 0, "---------------------------------------------", COLOR_PAIR(115)); //1
+        statistiks(); //2-3
 
         startY = 4;
         opts = {
@@ -196,30 +420,44 @@ namespace mtx {
             "Configure folders and files",
             "Toggle Overwrite",
             "Toggle Detailed mode",
+            "Toggle Resume from checkpoint",
+            "Toggle Columnar output",
+            "Toggle Compact octagons",
+            "Cycle output compression",
+            "Cycle match edge list",
+            "Set similarity thresholds",
+            "Set pair matrix cutoff",
+            "Cycle dense matrix output",
+            "Run batch manifest",
+            "Start query service",
             "Back to Peacock Framework (F1)"
         };
-        printopts(opts);
+        printopts(startY, opts);
         int any = -1;
         updatepos(any, 0, startY, opts);
-        refresh();
+        showJobPanel();
+        screen.flush();
     }
 
     // Main config UI
     void MatrixConfig::mtxMenu() 
     {
         printheader();
+        preload();
         menu(startY, opts);
+
+        //back to the framework: nothing's going to use it now
+        letGo(std::move(preloaded));
     }
 
     // UI for setting folders - does NOT work without curses mode on!
     void MatrixConfig::setFolders() 
     {
+        pck::Screen& screen = pck::Screen::shared();
         folder = true;
-        clear(); move(0, 0);
-        attron(COLOR_PAIR(pck::RAINBOW5));
-        printw("The Matrixinator - Folder Configuration\n" //0
-            "---------------------------------------------\n\n"); //1
-        attroff(COLOR_PAIR(pck::RAINBOW5));
+        screen.erase();
+        screen.print(0, 0, "The Matrixinator - Folder Configuration", COLOR_PAIR(pck::RAINBOW5));       //0
+        screen.print(1, 0, "---------------------------------------------", COLOR_PAIR(pck::RAINBOW5)); //1
         const std::vector<std::string> folderOptions = { //3
             "Current root folder:",
             "Current dendrogram file:",
@@ -228,47 +466,277 @@ namespace mtx {
         };
         int any = -1;
 
-        mvprintw(2, 0, "I/O files are ");
-        (ioDefined) ?
-            pck::printok("set.\n") :
-            pck::printerr("not set.\n");
-
-        printopts(folderOptions);
+        printopts(3, folderOptions);
         updatepos(any, 0, 3, folderOptions);
-        attron(A_BOLD);
-        mvprintw(3, 30, " %s", paths.getVFolder().c_str());
-        mvprintw(4, 30, " %s", paths.getTree().c_str());
-        mvprintw(5, 30, " %s", paths.getMeta().c_str());
-        attroff(A_BOLD);
+        showFiles();
+        showJobPanel();
+        screen.flush();
 
         menu(3, folderOptions);
     }
 
-    // Returns the state of I/O files existence
-    bool MatrixConfig::isIOdefined()
+    // The folder screen's current picks, and whether they make a pair of I/O files
+    void MatrixConfig::showFiles()
     {
-        return ioDefined;
+        pck::Screen& screen = pck::Screen::shared();
+        screen.erase(2);
+        int x = screen.print(2, 0, "I/O files are ");
+        (ioDefined) ?
+            screen.print(2, x, "set.", COLOR_PAIR(pck::OKCOLOR)) :
+            screen.print(2, x, "not set.", COLOR_PAIR(pck::ERRCOLOR));
+
+        screen.erase(3, 30);
+        screen.erase(4, 30);
+        screen.erase(5, 30);
+        screen.print(3, 30, " " + session.paths.getVFolder(), A_BOLD);
+        screen.print(4, 30, " " + session.paths.getTree(), A_BOLD);
+        screen.print(5, 30, " " + session.paths.getMeta(), A_BOLD);
     }
 
-    // Print flags
-    void MatrixConfig::statistiks() 
+    // Prompt for the similarity thresholds: one for a regular run, several for one output each in a single sweep
+    void MatrixConfig::askThresholds()
     {
-        printw("Flags: | "); //start-end (chars)
-        (overwrite) ?
-            pck::printok("Overwrite") : //9-18 (9)
-            pck::printerr("Overwrite");
-        printw(" | ");
+        curs_set(1); noraw(); echo();
 
-        (detailed) ?
-            pck::printok("Detailed") : //21-29 (8)
-            pck::printerr("Detailed");
-        printw(" | ");
+        char in[200]; in[0] = '\0';
+        mvprintw(20, 0, "Current thresholds: %s. Type new ones (e.g. 80, or 70/75/80/85/90/95), or leave the field empty to keep them.\n-> ",
+            session.thresholdList().c_str());
+        getnstr(in, 190);
 
-        (ioDefined) ?
-            pck::printok("I/O Files") : //32-41 (9)
-            pck::printerr("I/O Files");
+        curs_set(0); raw(); noecho();
+        if (in[0] != '\0' && !session.setThresholds(in)) {
+            for (int i = 20; i < 23; ++i) {
+                move(i, 0); clrtoeol();
+            }
+            move(20, 0); attron(COLOR_PAIR(pck::ERRCOLOR));
+            printw("<thresholds must be above 0 and up to 100 - press any key.>");
+            attroff(COLOR_PAIR(pck::ERRCOLOR));
+            getch();
+        }
+    }
 
-        printw("\n\n");
+    // Prompt for the pair matrix's cutoff, 0 turning it off
+    void MatrixConfig::askPairCutoff()
+    {
+        curs_set(1); noraw(); echo();
 
+        char in[200]; in[0] = '\0';
+        mvprintw(20, 0, "Current pair matrix cutoff: %g. Type a new one (0 for no pair matrix), or leave the field empty to keep it.\n-> ",
+            session.pairCutoff);
+        getnstr(in, 190);
+
+        curs_set(0); raw(); noecho();
+        if (in[0] != '\0' && !session.setPairCutoff(in)) {
+            for (int i = 20; i < 23; ++i) {
+                move(i, 0); clrtoeol();
+            }
+            move(20, 0); attron(COLOR_PAIR(pck::ERRCOLOR));
+            printw("<the cutoff must be from 0 up to 100 - press any key.>");
+            attroff(COLOR_PAIR(pck::ERRCOLOR));
+            getch();
+        }
+    }
+
+    // One line per job in the batch status window
+    static void showJobs(WINDOW* batchcon, BatchScheduler& batch, int tick)
+    {
+        static const char spin[] = { '\\', '|', '/', '-' };
+        static const char* phases[] = { "reading", "indexing", "sweeping", "writing" };
+        const int width = getmaxx(batchcon) - 2, rows = getmaxy(batchcon) - 5;
+        auto now = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> guard(batch.getLock());
+        std::vector<BatchScheduler::Job>& jobs = batch.getJobs();
+
+        for (int i = 0; i < (int)jobs.size() && i < rows; ++i) {
+            BatchScheduler::Job& job = jobs[i];
+            char line[300];
+
+            if (job.state == BatchScheduler::State::queued)
+                snprintf(line, sizeof(line), "  %-40.40s queued", job.label.c_str());
+
+            else if (job.state == BatchScheduler::State::running) {
+                const pck::Progress& progress = job.mtx->getProgress();
+                int phase = progress.getPhase();
+                double secs = std::chrono::duration<double>(now - job.started).count();
+                snprintf(line, sizeof(line), "%c %-40.40s %-8s %lld/%lld | %.0f/s | %.0fs", spin[tick % 4], job.label.c_str(),
+                    phases[(phase >= 0 && phase < 4) ? phase : 0], progress.getDone(), progress.getTotal(), progress.rate(), secs);
+            }
+            else {
+                double secs = std::chrono::duration<double>(job.ended - job.started).count();
+                snprintf(line, sizeof(line), "  %-40.40s %s (code %d) in %.2fs %s", job.label.c_str(),
+                    (job.code == 0) ? "OK" : "FAILURE", job.code, secs, job.failure.c_str());
+            }
+
+            mvwprintw(batchcon, 3 + i, 1, "%-*.*s", width, width, line);
+        }
+        wrefresh(batchcon);
+    }
+
+    // UI for running a batch manifest: asks for one, then follows every job until they're all done
+    void MatrixConfig::runBatch()
+    {
+        curs_set(1); noraw(); echo();
+
+        char in[800]; in[0] = '\0';
+        mvprintw(20, 0, "Please type the path to a batch manifest. Leave the field empty to go back.\n-> ");
+        getnstr(in, 790);
+
+        curs_set(0); raw(); noecho();
+        for (int i = 20; i < 22; ++i) {
+            move(i, 0); clrtoeol();
+        }
+        refresh();
+        if (in[0] == '\0')
+            return;
+
+        BatchScheduler batch;
+        std::string error;
+        if (!batch.load(in, error)) {
+            move(20, 0); attron(COLOR_PAIR(pck::ERRCOLOR));
+            printw("<%s - press any key.>", error.c_str());
+            attroff(COLOR_PAIR(pck::ERRCOLOR));
+            getch();
+            move(20, 0); clrtoeol();
+            return;
+        }
+
+        int maxY, maxX; getmaxyx(stdscr, maxY, maxX);
+        maxY /= 2;
+
+        WINDOW* batchcon = newwin(maxY, maxX, maxY, 0);
+        wborder(batchcon, '|', '|', '-', '-', '#', '#', '#', '#');
+        mvwprintw(batchcon, 1, 1, "Running %d job(s) on up to %u threads and %llu MB... ", (int)batch.getJobs().size(),
+            batch.getThreadBudget(), (unsigned long long)(batch.getMemoryBudget() >> 20));
+        wrefresh(batchcon);
+
+        int tick = 0;
+        batch.run([&]() { showJobs(batchcon, batch, tick++); });
+
+        int ok = 0;
+        for (auto& job : batch.getJobs())
+            ok += (job.code == 0);
+        mvwprintw(batchcon, getmaxy(batchcon) - 2, 1, "Batch done: ");
+        pck::wprintok(batchcon, "%d OK", ok);
+        wprintw(batchcon, ", ");
+        if (ok == (int)batch.getJobs().size())
+            wprintw(batchcon, "0 failed");
+        else
+            pck::wprinterr(batchcon, "%d failed", (int)batch.getJobs().size() - ok);
+        wprintw(batchcon, ". Press any key to continue.");
+        wrefresh(batchcon);
+        getch();
+
+        wclear(batchcon);
+        wrefresh(batchcon);
+        delwin(batchcon);
+        pck::Screen::shared().invalidate(); //the window's gone, but so is what it covered
+    }
+
+    // UI for the query service: keeps it up, with a few live counters, until a key is pressed
+    void MatrixConfig::runService()
+    {
+        int maxY, maxX; getmaxyx(stdscr, maxY, maxX);
+        maxY /= 2;
+
+        WINDOW* servcon = newwin(maxY, maxX, maxY, 0);
+        wborder(servcon, '|', '|', '-', '-', '#', '#', '#', '#');
+        mvwprintw(servcon, 1, 1, "Loading inputs for the query service... ");
+        wrefresh(servcon);
+
+        QueryService service(session);
+        std::string error;
+        if (!session.ioDefined()) {
+            pck::wprinterr(servcon, "I/O Files have not been defined!");
+            wprintw(servcon, " Press any key to continue.");
+        }
+        else if (!service.start(error)) {
+            pck::wprinterr(servcon, "failed.");
+            mvwprintw(servcon, 2, 1, "-> %s. Press any key to continue.", error.c_str());
+        }
+        else {
+            pck::wprintok(servcon, "done.");
+            mvwprintw(servcon, 2, 1, "Listening on %s", service.getSocket().c_str());
+            mvwprintw(servcon, 3, 1, "Requests: predict,KEY | matches,KEY[,MIN] | reload | status | shutdown");
+            mvwprintw(servcon, getmaxy(servcon) - 2, 1, "Press any key to stop the service.");
+
+            nodelay(stdscr, TRUE);
+            while (service.isRunning() && getch() == ERR) {
+                mvwprintw(servcon, 5, 1, "Queries served: %lld | Generation: %lld %-12s", service.getServed(),
+                    service.getGeneration(), (service.isReloading()) ? "(reloading)" : "");
+                wrefresh(servcon);
+                pck::sleep(200);
+            }
+            nodelay(stdscr, FALSE);
+            service.stop();
+
+            mvwprintw(servcon, getmaxy(servcon) - 2, 1, "%-*s", getmaxx(servcon) - 2, "");
+            mvwprintw(servcon, getmaxy(servcon) - 2, 1, "Service stopped after %lld queries. Press any key to continue.", service.getServed());
+        }
+        wrefresh(servcon);
+        getch();
+
+        wclear(servcon);
+        wrefresh(servcon);
+        delwin(servcon);
+        pck::Screen::shared().invalidate(); //the window's gone, but so is what it covered
+    }
+
+    // Returns the state of I/O files existence
+    bool MatrixConfig::isIOdefined()
+    {
+        return ioDefined;
+    }
+
+    // Print flags, on the rows under the title: onto the second one once the first is full
+    void MatrixConfig::statistiks() 
+    {
+        pck::Screen& screen = pck::Screen::shared();
+        int y = 2, x = 0;
+        screen.erase(2);
+        screen.erase(3);
+
+        auto put = [&](const std::string& text, chtype attr) {
+            if (y == 2 && x + (int)text.size() > screen.width()) {
+                y = 3; x = 0;
+            }
+            x = screen.print(y, x, text, attr);
+        };
+        auto flag = [&](const char* name, bool on) {
+            put(name, COLOR_PAIR((on) ? pck::OKCOLOR : pck::ERRCOLOR));
+            put(" | ", A_NORMAL);
+        };
+        char setting[64];
+
+        put("Flags: | ", A_NORMAL);
+        flag("Overwrite", session.overwrite);
+        flag("Detailed", session.detailed);
+        flag("Resume", session.resume);
+        flag("Columnar", session.columnar);
+        flag("Compact", session.compact);
+        flag("I/O Files", ioDefined);
+
+        put("Thresholds: " + session.thresholdList(), A_NORMAL);
+        put(std::string(" | Compression: ") + pck::Packer::name(session.compression), A_NORMAL);
+        put(std::string(" | Edges: ") + EdgeWriter::name(session.edges), A_NORMAL);
+        (session.pairCutoff > 0) ?
+            snprintf(setting, sizeof(setting), " | Pairs: %g", session.pairCutoff) :
+            snprintf(setting, sizeof(setting), " | Pairs: None");
+        put(setting, A_NORMAL);
+        put(std::string(" | Dense: ") + DenseMatrix::name(session.dense), A_NORMAL);
     }
-}
\ No newline at end of file
+}
+// Runs the config menu as a plugin would: until the user goes back
+static int runMatrixinator(void)
+{
+    mtx::MatrixConfig config;
+    config.mtxMenu();
+    return 0;
+}
+
+// Plugin entry point, see PluginRegistry
+extern "C" const PckPlugin* mtx_plugin_entry(void)
+{
+    static const PckPlugin plugin = { PCK_PLUGIN_ABI, "The Matrixinator", &runMatrixinator };
+    return &plugin;
+}
@@ -2,357 +2,828 @@
 #include <fstream>
 #include <sstream>
 #include <exception>
+#include <stdexcept>
+#include <cstring>
+#include <cwchar>
+#include <cctype>
+#include <climits>
+#include <iterator>
+#include <unordered_map>
 
 namespace mtx {
 	// ===============================================================================
 	//                                  Matrixinator                                 =
 	// ===============================================================================
 
-	// Constructor
-	Matrixinator::Matrixinator()
+	// Constructor. Source may hand over a shared tree index; without one, the run builds its own.
+	Matrixinator::Matrixinator(const RunConfig& config, TreeSource source)
 	{
+		this->config = config;
+		this->source = source;
 		numNodes = 0;
 		numSamples = 0;
+		reached = 0;
+		loadCode = 0;
+		inputStamp = 0;
 	}
 
-	// Wide-string slice n' splice, matrixinator-exclusive
-	std::vector<std::wstring> Matrixinator::w_sliceNsplice(const std::wstring& wstr, char delim)
+	// Destructor: a preload that's still going is told to stop, and waited for
+	Matrixinator::~Matrixinator()
 	{
-		std::vector<std::wstring> res;
-		std::wstringstream sstr(wstr);
-		std::wstring temp;
-
-		// if there is no delimiter or string
-		if (wstr.empty())
-			return res;
-
-		if (wstr.find_first_of(delim) == std::string::npos) {
-			std::getline<wchar_t, std::char_traits<wchar_t>, std::allocator<wchar_t>>(sstr, temp, delim);
-			res.push_back(temp);
-			return res;
-		}
+		cancel();
+		if (loader.joinable())
+			loader.join();
+	}
 
-		// remove leading delims
-		if (wstr[0] == delim)
-			sstr.ignore(INT_MAX, delim);
+	// Getters for whoever's watching the run from another thread
+	const pck::Progress& Matrixinator::getProgress() const
+	{
+		return progress;
+	}
+	const std::string& Matrixinator::getFailure() const
+	{
+		return failure;
+	}
 
-		while (std::getline<wchar_t, std::char_traits<wchar_t>, std::allocator<wchar_t>>(sstr, temp, delim)) {
-			//if (!temp.empty())
-			res.push_back(temp);
-		}
+	// Wide string back to the bytes it was read from
+	std::string Matrixinator::w_narrow(const std::wstring& wstr)
+	{
+		std::string str(wstr.size(), '\0');
+		for (size_t i = 0; i < wstr.size(); ++i)
+			str[i] = (char)wstr[i];
+		return str;
+	}
 
+	// Wide-string slice n' splice, matrixinator-exclusive. Keeps empty pieces, save for a leading or trailing one.
+	std::vector<std::wstring> Matrixinator::w_sliceNsplice(const std::wstring& wstr, char delim)
+	{
+		std::vector<std::wstring> res;
+		for (std::wstring_view piece : pck::WTokens(wstr, (wchar_t)delim, true))
+			res.emplace_back(piece);
 		return res;
 	}
 
-	// True if the given ID is an USA sample, false otherwise
-	bool Matrixinator::isUS(int id)
+	// What one worker makes of its share of the sheet
+	struct SheetChunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+		std::vector<Metadata> rows;
+		std::vector<int> references;      //rows from the US, counted from the chunk's first
+		std::vector<double> octagons;     //8 per reference, in the same order
+		bool stopped = false;             //hit an empty row: nothing past it counts
+		bool broken = false;              //the row it stopped at had a single field
+	};
+
+	// End of the row starting at "row": the first newline that isn't inside a quoted field, or the end
+	static const char* rowEnd(const char* row, const char* end)
 	{
-		for (int& sample : USAsamples)
-			if (sample == id) return true;
-
-		return false;
+		bool quoted = false;
+		const char* from = row;
+		while (true) {
+			const char* newline = (const char*)memchr(from, '\n', end - from);
+			if (newline == nullptr)
+				return end;
+
+			for (const char* ch = (const char*)memchr(from, '"', newline - from); ch != nullptr; ch = (const char*)memchr(ch + 1, '"', newline - ch - 1))
+				quoted = !quoted;
+			if (!quoted)
+				return newline;
+			from = newline + 1;
+		}
 	}
 
-	// Carry all the node IDs from sample to root, adding them to the nodes' lists along the way
-	void Matrixinator::bulldozer(int node)
+	// Splits a row into wide fields the way w_sliceNsplice does: on every comma, minus the empty field
+	// before a leading comma and the one after a trailing comma
+	static void splitRow(const char* begin, const char* end, std::vector<std::wstring>& pieces)
 	{
-		//direct-access code
-		if (!acacia[node].sample) return;
-		std::vector<int> changeList;
-		int parent = acacia[node].IDs.second;
-
-		while (acacia[parent].IDs.first >= 1) {
-			changeList.push_back(acacia[node].IDs.first);
-			node = parent;
-			parent = acacia[parent].IDs.second;
-
-			for (int& item : changeList)
-				acacia[node].childList.insert(item);
+		pieces.clear();
+		for (std::string_view field : pck::Tokens(std::string_view(begin, end - begin), ',', true)) {
+			pieces.emplace_back(field.size(), L'\0');
+			std::wstring& piece = pieces.back();
+			for (size_t i = 0; i < field.size(); ++i)
+				piece[i] = (wchar_t)(unsigned char)field[i]; //byte for byte, like the wide streams read them
 		}
+	}
 
-		//node 1, parent 0
-		for (int& item : changeList)
-			acacia[node].childList.insert(item);
+	// Parses one chunk's rows, stopping at the first empty one (or as soon as the run's cancelled)
+	static void parseChunk(SheetChunk& chunk, pck::Progress& progress, const std::atomic<bool>& cancelled)
+	{
+		std::vector<std::wstring> pieces;
+		int count = 0;
 
+		for (const char* row = chunk.begin; row < chunk.end && !cancelled; ) {
+			const char* next = rowEnd(row, chunk.end);
+			const char* last = (next > row && next[-1] == '\r') ? next - 1 : next; //text mode drops the CR of a CRLF
 
-		//method-access code
-		//if (!acacia.at(node).isSample()) return;
+			splitRow(row, last, pieces);
+			if (pieces.empty()) {
+				chunk.stopped = true;
+				break;
+			}
+			if (pieces.size() < 2) {
+				chunk.stopped = chunk.broken = true;
+				break;
+			}
+			while (pieces.size() > 28)
+				pieces.pop_back();
 
-		//std::vector<int> changeList;
-		//int parent = acacia.at(node).getParentID();
+			Metadata temp;
+			if (pieces[1] == L"US" || pieces[1] == L"USA") {
+				chunk.references.push_back((int)chunk.rows.size());
 
-		//while (acacia.at(parent).getID() >= 1) {
-		//	changeList.push_back(acacia.at(node).getID());
-		//	node = parent;
-		//	parent = acacia.at(parent).getParentID();
+				//separate octagon
+				std::array<double, 8> oct;
+				for (int i = 7; i >= 0; --i) {
+					oct[i] = (pieces.empty()) ? 0 : std::wcstod(pieces.back().c_str(), nullptr);
+					if (!pieces.empty())
+						pieces.pop_back();
+				}
+				chunk.octagons.insert(chunk.octagons.end(), oct.begin(), oct.end());
+			}
 
-		//	//add change list into parent's child list
-		//	for (auto& item : changeList)
-		//		acacia.at(node).addChild(item);
-		//}
+			temp.setData(pieces);
+			chunk.rows.push_back(std::move(temp));
 
-		////node 1, parent 0
-		//for (auto& item : changeList)
-		//	acacia.at(node).addChild(item);
+			if (++count % 4096 == 0)
+				progress.advance(4096);
+			row = (next < chunk.end) ? next + 1 : chunk.end;
+		}
+		progress.advance(count % 4096);
 	}
 
-	// Compare a "node"'s similarity to "origin". Returns 0 if it's below 80%.
-	double Matrixinator::bullSim(int node, int origin)
+	// How much of "data" is whole rows: up to right after the last newline that isn't inside quotes. Data starts
+	// at a row.
+	static size_t wholeRows(const char* data, size_t size)
 	{
-		if (!acacia[node].sample) return 0;
-
-		int parent = acacia[node].IDs.second;
-
-		while (acacia[parent].IDs.first >= 1) {
-			// the almighty time saver
-			if (acacia[node].similarity < 80)
-				return 0;
+		const char* end = data + size;
+		const char* row = data;
+		for (const char* next = rowEnd(row, end); next < end; next = rowEnd(row, end))
+			row = next + 1;
+		return row - data;
+	}
 
-			for (const int& it : acacia[parent].childList) {
-				if (it == origin)
-					return acacia[parent].similarity;
+	// Reads (part of) the metadata sheet, split in chunks at row boundaries and parsed in parallel, adding its rows
+	// after any already read. Rows come out in file order, same as reading them one by one. The header's skipped
+	// if "header" is set. False once it's come to the empty row that ends the sheet: nothing after it counts.
+	bool Matrixinator::readSheet(const char* data, size_t size, bool header)
+	{
+		PCK_TRACE_SCOPE("read metadata");
+		const char* end = data + size;
+		const char* first = data;
+		if (header) {
+			first = (const char*)memchr(data, '\n', size);
+			if (first == nullptr)
+				return false;
+			++first;
+		}
+		if (first == end)
+			return true;
+
+		//about 4 chunks per thread, none under a megabyte
+		const size_t body = end - first;
+		const size_t count = std::max<size_t>(1, std::min<size_t>((size_t)config.sweepThreads() * 4, body >> 20));
+		std::vector<const char*> cuts(count + 1);
+		for (size_t i = 0; i <= count; ++i)
+			cuts[i] = first + body / count * i;
+		cuts[count] = end;
+
+		//whether each cut lands inside quotes depends on every quote before it: count them per chunk first
+		std::vector<char> parity(count, 0);
+		std::vector<std::future<void>> tasks;
+		for (size_t i = 0; i < count; ++i) {
+			tasks.push_back(std::async(std::launch::async, [&, i]() {
+				PCK_TRACE_SCOPE("count quotes");
+				char odd = 0;
+				for (const char* ch = cuts[i]; (ch = (const char*)memchr(ch, '"', cuts[i + 1] - ch)) != nullptr; ++ch)
+					odd ^= 1;
+				parity[i] = odd;
+			}));
+		}
+		for (auto& task : tasks)
+			task.get();
+		tasks.clear();
+
+		//then move every cut up to the start of the next row (a chunk with no row starting in it stays empty)
+		std::vector<SheetChunk> chunks(count);
+		chunks[0].begin = first;
+		bool quoted = false;
+		for (size_t i = 1; i < count; ++i) {
+			quoted ^= (parity[i - 1] != 0);
+			const char* ch = cuts[i];
+			for (bool inside = quoted; ch < end; ++ch) {
+				if (*ch == '"')
+					inside = !inside;
+				else if (*ch == '\n' && !inside)
+					break;
 			}
-
-			node = parent;
-			parent = acacia[parent].IDs.second;
+			chunks[i].begin = (ch < end) ? ch + 1 : end;
+			chunks[i - 1].end = chunks[i].begin;
+		}
+		chunks[count - 1].end = end;
+
+		for (auto& chunk : chunks)
+			tasks.push_back(std::async(std::launch::async, [&]() {
+				PCK_TRACE_SCOPE("parse rows");
+				parseChunk(chunk, progress, cancelled);
+			}));
+		for (auto& task : tasks)
+			task.get();
+		if (cancelled)
+			throw 3;
+
+		//stitch them back together, in order, up to the first empty row
+		size_t total = SS.size();
+		for (auto& chunk : chunks) {
+			total += chunk.rows.size();
+			if (chunk.stopped)
+				break;
 		}
-		// deprecated fail-safe
-		return acacia[node].similarity;
+		if (total > SS.capacity())
+			SS.reserve(std::max(total, SS.capacity() * 2));
+		octagons.grow(total);
+
+		for (auto& chunk : chunks) {
+			for (size_t i = 0; i < chunk.references.size(); ++i) {
+				const int row = (int)SS.size() + chunk.references[i];
+				const double* octagon = chunk.octagons.data() + i * 8;
+				USAsamples.push_back(row);
+				if (std::any_of(octagon, octagon + 8, [](double value) { return value != -2; })) //all -2 means none at all
+					octagons.set(row, octagon);
+			}
+			std::vector<double>().swap(chunk.octagons);
+			std::move(chunk.rows.begin(), chunk.rows.end(), std::back_inserter(SS));
+			std::vector<Metadata>().swap(chunk.rows);
+
+			if (chunk.broken)
+				throw std::out_of_range("row " + std::to_string(SS.size() + 1) + " of the metadata has a single field");
+			if (chunk.stopped)
+				return false;
+		}
+		return true;
 	}
 
 	// Init phase: read files to memory
 	void Matrixinator::init()
 	{
-		//read metadata file
-		std::wfstream* wfptr = new std::wfstream(paths.getFullFilepath(true), std::wfstream::in);
-		wfptr->ignore(INT_MAX, '\n');
-		int cnt = 0; std::wstring* in = new std::wstring; std::vector<std::wstring>* pieces = new std::vector<std::wstring>;
+		//read metadata file: mapped whole and parsed by every thread, or if it's packed, decompressed and parsed a
+		//block at a time
+		const std::string metaFile = config.paths.getFullFilepath(true);
+		octagons.reset(0, config.compact);
+		if (pck::Unpacker::sniff(metaFile) == pck::Packer::plain) {
+			pck::MappedFile sheet;
+			if (!sheet.open(metaFile, &cancelled)) {
+				if (cancelled)
+					throw 3;
+				throw std::runtime_error("can't read " + config.paths.getMeta());
+			}
+			readSheet(sheet.data(), sheet.size(), true);
+		}
+		else {
+			pck::Unpacker sheet;
+			if (!sheet.open(metaFile))
+				throw std::runtime_error("can't read " + config.paths.getMeta());
+			bool header = true;
+			sheet.feed([&](const char* data, size_t size, bool last, size_t& used) {
+				used = (last) ? size : wholeRows(data, size);
+				if (used == 0)
+					return true; //not even one whole row yet
+				const bool more = readSheet(data, used, header);
+				header = false;
+				return more;
+			});
+		}
 
-		while (!wfptr->eof()) {
-			Metadata* temp = new Metadata();
+		numSamples = (int)SS.size();
 
-			in->clear(); pieces->clear();
-			std::getline<wchar_t, std::char_traits<wchar_t>, std::allocator<wchar_t>>(*wfptr, *in, '\n');
+		//the tree may already be loaded and shared with other runs
+		std::string treeFile = config.paths.getFullFilepath(false);
+		tree = (source) ? source(treeFile, progress, &cancelled, config.sweepThreads()) : TreeIndex::build(treeFile, progress, &cancelled, config.sweepThreads());
+		numNodes = tree->getNumNodes();
 
-			*pieces = w_sliceNsplice(*in, ',');
-			if (pieces->empty()) break;
-			//because trailing commas are also returned by wide slicing (intended)
-			else {
-				while (pieces->size() > 28)
-					pieces->pop_back();
+		//integrity check
+		for (std::vector<Metadata>::iterator it = SS.begin(); it != SS.end(); ++it) {
+			if (it->getData().at(0).empty()) { //no key, no sample
+				octagons.erase(it - SS.begin());
+				it = SS.erase(it);
+				--numSamples;
+				if (it == SS.end())
+					break;
 			}
+		}
+	}
 
-			if (pieces->at(1) == L"US" || pieces->at(1) == L"USA") {
-				USAsamples.push_back(cnt);
-
-				//separate octagon
-				std::array<double, 8> oct;
-				for (int i = 7; i >= 0; --i) {
-					double duo;
-					std::wstringstream(pieces->back()) >> duo;
-					oct[i] = duo;
-					pieces->pop_back();
+	// Post-init phase: prepare data structures
+	void Matrixinator::postinit()
+	{
+		const std::vector<Tree>& acacia = tree->acacia;
+		progress.setTotal(numNodes);
+
+		//node-sample association: by name if the tree has leaf names that match any keys, in order otherwise
+		bool joined = false;
+		if (!tree->labels.empty()) {
+			std::unordered_map<std::string, int> rows;
+			for (int row = 0; row < (int)SS.size(); ++row)
+				rows.emplace(w_narrow(SS[row].data[0]), row);
+
+			for (int i = 1; i <= numNodes; ++i) {
+				if (i % 4096 == 0)
+					progress.advance(4096);
+				if (!acacia[i].sample)
+					continue;
+				auto row = rows.find(tree->labels[i]);
+				if (row != rows.end() && SS[row->second].nodeNumber == 0) { //a key named twice only gets the first leaf
+					SS[row->second].nodeNumber = i;
+					joined = true;
 				}
-
-				temp->setOctagon(oct);
 			}
-
-			temp->setData(*pieces);
-			SS.push_back(*temp);
-			delete temp;
-
-			++cnt;
 		}
+		if (!joined) {
+			int sCount = 0;
+			for (int i = 1; i <= numNodes; ++i) {
+				if (i % 4096 == 0 && tree->labels.empty()) //already counted while joining by name
+					progress.advance(4096);
+				if (acacia[i].sample && sCount < (int)SS.size()) { //a sheet cut short by an empty row has fewer rows than the tree has samples
+					SS[sCount].nodeNumber = i;
+					++sCount;
+				}
+			}
+		}
+		progress.advance(numNodes % 4096);
+
+		//references in the tree's sample order, so the ones below any node sit next to each other
+		const TreeIndex& index = *tree;
+		for (int& item : USAsamples) {
+			int node = SS[item].nodeNumber;
+			if (node >= 1 && node <= numNodes && index.position[node] >= 0)
+				refOrder.push_back(std::make_pair(index.position[node], item));
+			else
+				strays.push_back(item);
+		}
+		std::sort(refOrder.begin(), refOrder.end());
 
-		numSamples = (int)SS.size();
-		wfptr->close();
+		for (size_t j = 0; j + 1 < refOrder.size(); ++j) {
+			int join = index.joins[refOrder[j].first];
+			for (int q = refOrder[j].first + 1; q < refOrder[j + 1].first; ++q) {
+				if (index.depth[index.joins[q]] < index.depth[join])
+					join = index.joins[q];
+			}
+			refJoins.push_back(join);
+		}
+	}
 
-		//because fuck wide stuff, honestly
-		delete wfptr; delete in; delete pieces;
+	// Where the sweep's checkpoint lives: next to the metadata file, tagged with the run's fingerprint so runs on
+	// the same sheet with other thresholds or options each get their own
+	std::string Matrixinator::checkpointPath()
+	{
+		char tag[24];
+		snprintf(tag, sizeof(tag), "-%016llx", (unsigned long long)inputFingerprint());
+		return config.paths.getLeadingPath(true) + "\\" + metaStem() + tag + "-checkpoint.bin";
+	}
 
-		//let's work with thin streams this time, shall we? (read tree file)
-		std::fstream file(paths.getFullFilepath(false), std::fstream::in);
-		Tree* starter = new Tree();
-		starter->setIDs(0, 0);
-		starter->setSim(0.0);
-		acacia.push_back(*starter);
-		delete starter;
+	// Matches go in the output's own cells: detailed, and not going to an edge list instead
+	bool Matrixinator::matchCells() const
+	{
+		return config.detailed && config.edges == EdgeWriter::none;
+	}
 
-		std::string buffer;
-		int id, parentid;
-		double sim;
-		file.ignore(INT_MAX, '\"');
+	// Metadata file name without its extension, or its compression's
+	std::string Matrixinator::metaStem()
+	{
+		std::string meta = config.paths.getMeta();
+		meta.resize(meta.length() - std::strlen(pck::Packer::extension(pck::Packer::fromExtension(meta))));
+		return meta.substr(0, meta.find_last_of('.'));
+	}
 
+	// Fingerprint of everything the sweep's results depend on, so stale checkpoints are never resumed
+	uint64_t Matrixinator::inputFingerprint()
+	{
+		uint64_t print = 0;
+		for (bool metafile : { true, false }) {
+			std::string file = config.paths.getFullFilepath(metafile);
+			std::error_code ec;
+			uintmax_t size = std::filesystem::file_size(file, ec);
+			long long stamp = (long long)std::filesystem::last_write_time(file, ec).time_since_epoch().count();
+
+			print = Checkpoint::hash(print, file.data(), file.size());
+			print = Checkpoint::hash(print, &size, sizeof(size));
+			print = Checkpoint::hash(print, &stamp, sizeof(stamp));
+		}
 
-		while (!file.eof()) {
-			Tree* temp = new Tree();
+		int shape[4] = { numSamples, numNodes, (int)USAsamples.size(), (int)config.detailed | ((config.edges != EdgeWriter::none) ? 2 : 0) | ((config.compact) ? 4 : 0) };
+		print = Checkpoint::hash(print, config.thresholds.data(), config.thresholds.size() * sizeof(double));
+		return Checkpoint::hash(print, shape, sizeof(shape));
+	}
 
-			std::getline(file, buffer, '\"');
-			std::stringstream(buffer) >> id;
+	// Finds the reference samples at least as similar to a foreign one as each of the thresholds, all in one go.
+	// A reference matches when the foreign sample can climb up to their common ancestor without going through
+	// anything less similar than the threshold, and it's as similar as that ancestor. Matches come in reference
+	// order, so octagons add up exactly like they always have.
+	void Matrixinator::findMatches(int foreign, const std::vector<double>& thresholds, std::vector<std::vector<int>>& matches, std::vector<std::vector<double>>& similarities) const
+	{
+		const TreeIndex& index = *tree;
+		const size_t levels = thresholds.size();
+		matches.resize(levels);
+		similarities.resize(levels);
+		for (size_t i = 0; i < levels; ++i) {
+			matches[i].clear();
+			similarities[i].clear();
+		}
 
-			file.ignore(INT_MAX, '\"');
-			buffer.clear();
-			std::getline(file, buffer, '\"');
-			std::stringstream(buffer) >> parentid;
+		int node = SS[foreign].nodeNumber;
+		if (node < 1 || node > numNodes || !index.acacia[node].sample)
+			return;
+
+		//how far up each threshold lets the sample go; they're all on the same path, the lowest goes the farthest
+		std::vector<int> tops(levels);
+		int widest = 0;
+		for (size_t i = 0; i < levels; ++i) {
+			tops[i] = index.highest(node, thresholds[i]);
+			if (tops[i] != 0 && (widest == 0 || index.depth[tops[i]] < index.depth[widest]))
+				widest = tops[i];
+		}
+		if (widest == 0)
+			return;
+
+		std::vector<std::vector<std::pair<int, double>>> picks(levels);
+		auto take = [&](int row, int position, double sim) {
+			for (size_t i = 0; i < levels; ++i) {
+				if (tops[i] != 0 && index.first[tops[i]] <= position && position < index.last[tops[i]])
+					picks[i].push_back(std::make_pair(row, sim));
+			}
+		};
+		auto higher = [&](int a, int b) { return (index.depth[b] < index.depth[a]) ? b : a; };
+
+		//references below the widest top, walking out both ways from the sample. The common ancestor with
+		//each is the highest join in between, which only ever gets higher the farther out it goes.
+		const int at = index.position[node];
+		auto lo = std::lower_bound(refOrder.begin(), refOrder.end(), std::make_pair(index.first[widest], INT_MIN));
+		auto hi = std::lower_bound(refOrder.begin(), refOrder.end(), std::make_pair(index.last[widest], INT_MIN));
+		auto split = std::lower_bound(lo, hi, std::make_pair(at, INT_MIN));
+
+		int join = 0;
+		for (auto it = split; it != hi; ++it) {
+			if (it == split) {
+				join = (it->first == at) ? node : index.joins[at];
+				for (int q = at + 1; q < it->first; ++q)
+					join = higher(join, index.joins[q]);
+			}
+			else
+				join = higher(join, refJoins[(it - refOrder.begin()) - 1]);
 
-			file.ignore(INT_MAX, '\"');
-			buffer.clear();
-			std::getline(file, buffer, '\"');
-			std::stringstream(buffer) >> sim;
+			if (it->second != foreign)
+				take(it->second, it->first, index.acacia[join].similarity);
+		}
+		for (auto it = split; it != lo; ) {
+			--it;
+			if (it + 1 == split) {
+				join = index.joins[it->first];
+				for (int q = it->first + 1; q < at; ++q)
+					join = higher(join, index.joins[q]);
+			}
+			else
+				join = higher(join, refJoins[it - refOrder.begin()]);
 
-			if (file.peek() != '/')
-				temp->makeSample();
+			if (it->second != foreign)
+				take(it->second, it->first, index.acacia[join].similarity);
+		}
 
-			temp->setIDs(id, parentid);
-			temp->setSim(sim);
-			acacia.push_back(*temp);
+		//a sample that climbs all the way to its root matches everything the root doesn't cover, as similar
+		//as the root itself: the old pair-by-pair walk's fail-safe did the same, so results stay the same
+		if (index.parentOf(widest) == 0) {
+			const double sim = index.acacia[widest].similarity;
+			auto outside = [&](int row) {
+				for (size_t i = 0; i < levels; ++i) {
+					if (tops[i] == widest && row != foreign)
+						picks[i].push_back(std::make_pair(row, sim));
+				}
+			};
+			for (auto it = refOrder.begin(); it != lo; ++it)
+				outside(it->second);
+			for (auto it = hi; it != refOrder.end(); ++it)
+				outside(it->second);
+			for (const int& row : strays)
+				outside(row);
+		}
 
-			delete temp;
-			file.ignore(INT_MAX, '\"');
+		for (size_t i = 0; i < levels; ++i) {
+			std::sort(picks[i].begin(), picks[i].end());
+			for (auto& pick : picks[i]) {
+				matches[i].push_back(pick.first);
+				similarities[i].push_back(pick.second);
+			}
 		}
+	}
 
-		numNodes = (int)acacia.size() - 1; //node 0 is a fictional node
-		file.close();
+	// Same as above, for a single threshold
+	int Matrixinator::findMatches(int foreign, double threshold, std::vector<int>& matches, std::vector<double>& similarities) const
+	{
+		std::vector<std::vector<int>> allMatches;
+		std::vector<std::vector<double>> allSims;
+		findMatches(foreign, std::vector<double>(1, threshold), allMatches, allSims);
+		matches.swap(allMatches[0]);
+		similarities.swap(allSims[0]);
+		return (int)matches.size();
+	}
 
-		//integrity check
-		for (std::vector<Metadata>::iterator it = SS.begin(); it != SS.end(); ++it) {
-			if (it->getData().at(0).empty()) { //no key, no sample
-				it = SS.erase(it);
-				--numSamples;
-				if (it == SS.end())
-					break;
-			}
+	// Weighs the matches' octagons by their similarity into a single predicted octagon
+	void Matrixinator::blend(const std::vector<int>& matches, const std::vector<double>& similarities, std::array<double, 8>& octagon) const
+	{
+		if (matches.size() == 1) {
+			octagons.get(matches[0], octagon.data());
+			return;
 		}
+
+		//add up all the similarities between origins and foreign
+		double tempSim = 0;
+		for (const double& it : similarities)
+			tempSim += it;
+
+		//origins' octagon values times the similarity of origin samples to the foreign sample, all added up
+		octagon.fill(0);
+		octagons.weigh(matches, similarities, octagon.data());
+
+		//then divide these values by the added similarity "tempSim"
+		for (int i = 0; i < 8; ++i)
+			octagon[i] /= tempSim;
 	}
 
-	// Post-init phase: prepare data structures
-	void Matrixinator::postinit()
+	// Sweeps a single foreign sample against every reference sample, at every threshold. Fills in its octagon (and
+	// matches, if they go in the output's cells) and hands back the matches found. Only touches the foreign row, so rows
+	// may go in parallel.
+	int Matrixinator::sweepRow(int foreign, std::vector<std::vector<int>>& matches, std::vector<std::vector<double>>& similarities)
 	{
-		//branching
-		for (int i = 1; i <= numNodes; ++i) {
-			if (acacia[i].sample)
-				bulldozer(i);
+		findMatches(foreign, config.thresholds, matches, similarities);
+		std::array<double, 8> foreignOctagon;
+
+		//first threshold: straight into the sheet
+		int caseCount = (int)matches[0].size();
+		if (matchCells()) {
+			for (int i = 0; i < caseCount; ++i)
+				SS[foreign].usaMatches.push_back(std::make_pair(SS[matches[0][i]].data.front(), similarities[0][i]));
+			// no matches made at all
+			if (caseCount == 0)
+				SS[foreign].usaMatches.push_back(std::make_pair(std::to_wstring(0), 0));
+		}
+		if (caseCount > 0) {
+			blend(matches[0], similarities[0], foreignOctagon);
+			octagons.set(foreign, foreignOctagon.data());
 		}
 
-		//node-sample association
-		int sCount = 0;
-		for (int i = 1; i <= numNodes; ++i) {
-			if (acacia[i].sample) {
-				SS[sCount].nodeNumber = i;
-				++sCount;
+		//the rest of them
+		for (size_t level = 1; level < matches.size(); ++level) {
+			Outcome& outcome = outcomes[level - 1];
+			if (matchCells()) {
+				for (size_t i = 0; i < matches[level].size(); ++i)
+					outcome.matches[foreign].push_back(std::make_pair(matches[level][i], similarities[level][i]));
+			}
+			if (!matches[level].empty()) {
+				blend(matches[level], similarities[level], foreignOctagon);
+				outcome.octagons.set(foreign, foreignOctagon.data());
 			}
 		}
 
+		return caseCount;
 	}
 
-	// Sweep phase: process data in memory
+	// Sweep phase: process data in memory.
+	// Rows go in waves: the run's threads split each wave in small chunks, then the wave's results are
+	// checkpointed in row order before the next one starts.
 	void Matrixinator::sweep()
 	{
-		std::vector<double> similarities;
-		std::vector<int> matches;
+		const std::vector<int> nomatches;
+		const unsigned numThreads = config.sweepThreads();
+		const int chunk = 64;
+		const int wave = (int)numThreads * chunk * 16;
+
+		std::vector<char> reference(numSamples, 0);
+		for (int& item : USAsamples)
+			reference[item] = 1;
+
+		progress.setTotal(numSamples - (long long)USAsamples.size());
+
+		const int levels = (int)config.thresholds.size();
+		outcomes = std::vector<Outcome>(levels - 1);
+		for (Outcome& outcome : outcomes) {
+			outcome.octagons.reset(numSamples, config.compact);
+			if (matchCells())
+				outcome.matches.resize(numSamples);
+		}
 
-		for (int foreign = 0; foreign < numSamples; ++foreign) {
+		//pick up where the last run left off, if asked to and if it was on these same inputs
+		const std::string checkpointAt = checkpointPath();
+		Checkpoint checkpoint(checkpointAt, inputFingerprint());
+		std::vector<Checkpoint::List> lists;
+		checkpointFile.clear();
+		int start = 0;
+		if (config.resume) {
+			start = checkpoint.restore([this](const Checkpoint::Entry& entry) {
+				if (entry.level > 0) {
+					Outcome& outcome = outcomes[entry.level - 1];
+					if (entry.predicted)
+						outcome.octagons.set(entry.row, entry.octagon.data());
+					if (matchCells())
+						outcome.matches[entry.row] = entry.matches;
+				}
+				else {
+					if (entry.predicted)
+						octagons.set(entry.row, entry.octagon.data());
+					if (matchCells()) {
+						Metadata& sample = SS[entry.row];
+						for (auto& match : entry.matches)
+							sample.usaMatches.push_back(std::make_pair(SS[match.first].data.front(), match.second));
+						if (entry.matches.empty())
+							sample.usaMatches.push_back(std::make_pair(std::to_wstring(0), 0));
+					}
+				}
+			}, lists);
 
-			if (isUS(foreign)) {
-				continue;
+			long long skipped = start;
+			for (int& item : USAsamples)
+				skipped -= (item < start);
+			progress.advance(skipped);
+		}
+		const bool saving = checkpoint.start(start);
+		if (saving)
+			checkpointFile = checkpointAt;
+
+		//edge lists get every match as the sweep goes; a resumed one carries on with the lists it was writing
+		edgeLists.clear();
+		if (config.edges != EdgeWriter::none) {
+			const std::string extension = EdgeWriter::extension(config.edges, config.compression);
+			for (int level = 0; level < levels; ++level) {
+				edgeLists.emplace_back(new EdgeWriter());
+				if (start > 0) {
+					if (level >= (int)lists.size() || !edgeLists.back()->open(lists[level].path, config.edges, config.compression, SS, config.thresholds[level], lists[level].length))
+						throw 1;
+				}
+				else if (!edgeLists.back()->open(outputPath(level, extension), config.edges, config.compression, SS, config.thresholds[level]) &&
+					!edgeLists.back()->open(metaStem() + outputSuffix(level) + extension, config.edges, config.compression, SS, config.thresholds[level]))
+					throw 1;
 			}
-			similarities.clear();
-			matches.clear();
-
-			int caseCount = 0;
-			for (int& item : USAsamples) {
-				double sim = bullSim(SS[foreign].nodeNumber, SS[item].nodeNumber);
-
-				if (sim >= 80) {
-					++caseCount;
-					matches.push_back(item);
-					similarities.push_back(sim);
+		}
 
-					if (detailed) {
-						//std::pair<std::wstring, double> pr(SS[item].data.front(), sim);
-						SS[foreign].usaMatches.push_back(std::make_pair(SS[item].data.front(), sim));
+		//each save says how far every edge list had got by then
+		auto save = [&](int row) {
+			if (!saving)
+				return;
+			lists.clear();
+			for (auto& list : edgeLists)
+				lists.push_back({ list->getPath(), list->mark() });
+			checkpoint.save(row, lists);
+		};
+
+		//per-row, per-threshold matches of the current wave, kept until they're checkpointed
+		std::vector<std::vector<std::vector<int>>> waveMatches(wave);
+		std::vector<std::vector<std::vector<double>>> waveSims(wave);
+
+		for (int first = start; first < numSamples; first += wave) {
+			const int last = std::min(numSamples, first + wave);
+			std::atomic<int> next(first);
+
+			auto worker = [&]() {
+				//progress is batched up locally, the shared counters only see one update per chunk
+				for (int from = next.fetch_add(chunk); from < last; from = next.fetch_add(chunk)) {
+					PCK_TRACE_SCOPE("sweep chunk");
+					long long swept = 0, matched = 0;
+
+					for (int foreign = from; foreign < std::min(last, from + chunk); ++foreign) {
+						if (reference[foreign])
+							continue;
+						matched += sweepRow(foreign, waveMatches[foreign - first], waveSims[foreign - first]);
+						++swept;
+					}
+					progress.advance(swept, matched);
+				}
+			};
+
+			std::vector<std::thread> pool;
+			for (unsigned t = 1; t < numThreads; ++t)
+				pool.emplace_back(worker);
+			worker();
+			for (auto& th : pool)
+				th.join();
+
+			PCK_TRACE_SCOPE("checkpoint wave");
+			for (int foreign = first; foreign < last; ++foreign) {
+				if (reference[foreign])
+					continue;
+				for (int level = 0; level < levels; ++level) {
+					const std::vector<int>& matches = waveMatches[foreign - first][level];
+					const std::vector<double>& sims = waveSims[foreign - first][level];
+					std::array<double, 8> octagon;
+					if (!matches.empty())
+						((level == 0) ? octagons : outcomes[level - 1].octagons).get(foreign, octagon.data());
+					checkpoint.record(foreign, level, (!matches.empty()) ? octagon.data() : nullptr, (matchCells()) ? matches : nomatches, sims);
+
+					if (!edgeLists.empty()) {
+						for (size_t i = 0; i < matches.size(); ++i)
+							edgeLists[level]->add(foreign, matches[i], sims[i]);
 					}
 				}
 			}
 
-			switch (caseCount) {
-			case 0:
-				// because if it gets here, then no matches have been made up above
-				if (detailed)
-					SS[foreign].usaMatches.push_back(std::make_pair(std::to_wstring(0), 0));
-				break;
-
-			case 1:
-				SS[foreign].octagon = SS[matches[0]].octagon;
-				//SS.at(foreign).copyOct(SS.at(matches.at(0)));
-				break;
+			//a cancelled sweep keeps what it's done so far, for a resumed run to pick up from
+			if (cancelled) {
+				save(last);
+				throw 3;
+			}
+			if (checkpoint.due())
+				save(last);
+		}
+		save(numSamples);
 
-			default:
-				//multiply origins' octagon values by the similarity of origin samples to the foreign sample
-				std::vector<std::array<double, 8>> tempOct(matches.size());
-				std::array<double, 8> foreignOctagon;
-				double tempSim = 0;
-
-				int i = 0;
-				for (int& it : matches) {
-					for (int j = 0; j < 8; ++j) //octagon value #j
-						//tempOct[i][j] = SS.at(it).getOctagon().at(j) * similarities.at(i);
-						tempOct[i][j] = SS[it].octagon[j] * similarities[i];
-					++i;
-				}
+		for (auto& list : edgeLists) {
+			if (!list->close())
+				throw 1;
+		}
+		edgeLists.clear();
+	}
 
-				//add up all the similarities between origins and foreign
-				for (double& it : similarities)
-					tempSim += it;
+	// Output phase: dumps memory content into a .csv file, one per threshold
+	void Matrixinator::output()
+	{
+		progress.setTotal((long long)SS.size() * config.thresholds.size());
+		for (int level = 0; level < (int)config.thresholds.size(); ++level)
+			writeOutput(level);
+		if (config.pairCutoff > 0)
+			writePairs();
+		if (config.dense != DenseMatrix::none)
+			writeDense();
+	}
 
-				//add up all octagon values into a single octagon set
-				foreignOctagon.fill(0);
-				for (int i = 0; i < (int)matches.size(); ++i) {
-					for (int j = 0; j < 8; ++j)
-						foreignOctagon[j] += tempOct[i][j];
-				}
+	// What goes between the metadata file's name and ".csv": "-out" for a single threshold, "-out-t75" and
+	// the like for each of several
+	std::string Matrixinator::outputSuffix(int level)
+	{
+		if (config.thresholds.size() == 1)
+			return "-out";
 
-				//then divide these values by the added similarity "tempSim" and send it back
-				SS[foreign].octagon.clear();
-				for (int i = 0; i < 8; ++i) {
-					//foreignOctagon[i] /= tempSim;
-					SS[foreign].octagon.push_back(foreignOctagon[i] / tempSim);
-				}
+		char tag[32];
+		snprintf(tag, sizeof(tag), "-out-t%g", config.thresholds[level]);
+		return tag;
+	}
 
-				//now send it back
-				//SS.at(foreign).setOctagon(foreignOctagon);
-			}
-		}
+	// Where a threshold's results go
+	std::string Matrixinator::outputPath(int level, const std::string& extension)
+	{
+		return outputPath(outputSuffix(level), extension);
 	}
 
-	// Output phase: dumps memory content into a .csv file
-	void Matrixinator::output()
+	// Where any output goes: next to the metadata file, numbered if there's one there already
+	std::string Matrixinator::outputPath(const std::string& suffix, const std::string& extension)
 	{
-		//WE WIDE AGAIN FUCK MY LIFE WOO
 		typedef pck::FileSniffer fsn;
-		std::wfstream output;
-		std::string path, noext = paths.getMeta().substr(0, paths.getMeta().find_last_of('.'));
-		path = (overwrite) ? paths.getFullFilepath(true) : paths.getLeadingPath(true) + "\\" + noext;
+		std::string path, noext = metaStem();
+		path = (config.overwrite) ? config.paths.getFullFilepath(true) : config.paths.getLeadingPath(true) + "\\" + noext;
 
 		//check if the file already exists
-		if (fsn::exists(path + "-out.csv") && !overwrite) {
+		if (fsn::exists(path + suffix + extension) && !config.overwrite) {
 			size_t count = 1;
-			while (fsn::exists(path + "-out" + std::to_string(count) + ".csv")) {
+			std::string numbered = (isdigit((unsigned char)suffix.back())) ? suffix + "-" : suffix; //"-out-t75-1", not "-out-t751"
+			while (fsn::exists(path + numbered + std::to_string(count) + extension)) {
 				++count;
 			}
-			path.append("-out" + std::to_string(count) + ".csv");
+			path.append(numbered + std::to_string(count) + extension);
 		}
 		else
-			path.append("-out.csv");
+			path.append(suffix + extension);
 
-		output.open(path, std::wfstream::out | std::wfstream::trunc);
+		return path;
+	}
 
-		if (!output.is_open()) {
-			output.close();
-			output.open(noext + "-out.csv", std::wfstream::out);
+	// Writes the results at one of the thresholds
+	void Matrixinator::writeOutput(int level)
+	{
+		PCK_TRACE_SCOPE("write output");
+		if (config.columnar) {
+			writeColumnar(level);
+			return;
+		}
 
-			if (!output.is_open())
+		//WE WIDE AGAIN FUCK MY LIFE WOO
+		std::wfstream file;
+		pck::Packer packer; //compresses on a thread of its own while this one formats
+		std::wostream output(nullptr);
+		std::string noext = metaStem();
+		std::string extension = std::string(".csv") + pck::Packer::extension(config.compression);
+
+		if (config.compression != pck::Packer::plain) {
+			if (!packer.open(outputPath(level, extension), config.compression) &&
+				!packer.open(noext + outputSuffix(level) + extension, config.compression))
 				throw 1;
+			output.rdbuf(&packer);
+		}
+		else {
+			file.open(outputPath(level, extension), std::wfstream::out | std::wfstream::trunc);
+
+			if (!file.is_open()) {
+				file.close();
+				file.open(noext + outputSuffix(level) + extension, std::wfstream::out);
+
+				if (!file.is_open())
+					throw 1;
+			}
+			output.rdbuf(file.rdbuf());
 		}
 
 		output << std::setprecision(8);
@@ -361,177 +832,333 @@ namespace mtx {
 		output << L"Key,Location,CollectionDate,Company,FSGID,Farm,Age_days,SampleOrigin,SampleType,VMP,ibeA,traT,iutA,ompT,sitA,irp2,cvaC,tsh,iucC,iss"
 			<< L",BS22,BS15,BS3,BS8,BS27,BS84,BS18,BS278,";
 
-		if (detailed)
+		if (matchCells())
 			output << L"MatchKey=Similarity,";
 
 		output << L"\n";
 
+		//past the first threshold, foreign samples' results come from their outcome instead
+		std::vector<char> reference(SS.size(), 0);
+		for (int& item : USAsamples)
+			reference[item] = 1;
+
+		long long written = 0;
 		for (Metadata& entry : SS) {
 			//data
 			for (std::wstring& field : entry.getData())
 				output << field << L",";
 
-			if (!entry.nullOct()) {
+			const int row = (int)written;
+			if (level > 0 && !reference[row]) {
+				const Outcome& outcome = outcomes[level - 1];
+				if (outcome.octagons.has(row)) {
+					std::array<double, 8> octagon;
+					outcome.octagons.get(row, octagon.data());
+					for (const double& value : octagon)
+						output << value << L",";
+
+					if (matchCells()) {
+						for (auto& match : outcome.matches[row])
+							output << SS[match.first].data.front() << L"=" << match.second << L"; ";
+						output << L",";
+					}
+				}
+				else if (matchCells())
+					output << L",,,,,,,,,";
+				else
+					output << L",,,,,,,,";
+			}
+			else if (octagons.has(row)) {
 				//octagon
-				for (double& value : entry.getOctagon())
+				std::array<double, 8> octagon;
+				octagons.get(row, octagon.data());
+				for (const double& value : octagon)
 					output << value << L",";
 
 				//matches
-				if (detailed) {
+				if (matchCells()) {
 					for (std::pair<std::wstring, double>& pair : entry.getMatches())
 						output << pair.first << L"=" << pair.second << L"; ";
 					output << L",";
 				}
 			}
-			else if (detailed)
+			else if (matchCells())
 				output << L",,,,,,,,,";
 			else
 				output << L",,,,,,,,";
 			output << L"\n";
+
+			if (++written % 4096 == 0)
+				progress.advance(4096);
 		}
+		progress.advance(written % 4096);
+
+		output.flush();
+		if (config.compression != pck::Packer::plain && !packer.close())
+			throw 1;
 	}
 
-	// Main sequence
-	void Matrixinator::mainSequence()
+	// Writes the results at one of the thresholds in the columnar format: every metadata column dictionary-encoded,
+	// the octagons as one float64 matrix (NaN where there's none), and the matches if detailed
+	void Matrixinator::writeColumnar(int level)
 	{
-		int maxY, maxX; getmaxyx(stdscr, maxY, maxX);
-		maxY /= 2;
-
-		WINDOW* mtxcon = newwin(maxY, maxX, maxY, 0);
-		wborder(mtxcon, '|', '|', '-', '-', '#', '#', '#', '#');
-		wrefresh(mtxcon);
-
-		mvwprintw(mtxcon, 1, 1, "Initializing the Matrixinator v%s... ", MTXVER); wrefresh(mtxcon);
-		pck::spinner(2, mtxcon); //because speshul fx, makes it look like it's actually loading
-
-		//because aesthethiccs are important
-		wmove(mtxcon, getcury(mtxcon), getcurx(mtxcon) - 1);
-		wprintw(mtxcon, "   ");
-
-		//benchmarking
-		beg = std::chrono::high_resolution_clock::now();
-
-		//fail-safe
-		if (!isIOdefined()) {
-			wmove(mtxcon, getcury(mtxcon) + 1, 1);
-			pck::wprinterr(mtxcon, "Fatal error: ");
-			wprintw(mtxcon, "I/O Files have not been defined!");
-			wrefresh(mtxcon);
-			closing(2, mtxcon); return;
+		static const char* names[] = { "Key", "Location", "CollectionDate", "Company", "FSGID", "Farm", "Age_days", "SampleOrigin",
+			"SampleType", "VMP", "ibeA", "traT", "iutA", "ompT", "sitA", "irp2", "cvaC", "tsh", "iucC", "iss" };
+		const size_t rows = SS.size();
+		ColumnarWriter writer(rows, config.thresholds[level], matchCells());
+
+		std::vector<char> reference(rows, 0);
+		for (int& item : USAsamples)
+			reference[item] = 1;
+
+		//metadata, one column at a time
+		std::vector<std::string> column(rows);
+		for (int field = 0; field < 20; ++field) {
+			for (size_t row = 0; row < rows; ++row)
+				column[row] = (field < (int)SS[row].data.size()) ? w_narrow(SS[row].data[field]) : std::string();
+			writer.addText(names[field], column);
 		}
 
-		mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Reading files to memory... "); wrefresh(mtxcon);
-		try {
-			init();
-			pck::wprintok(mtxcon, "done."); wrefresh(mtxcon);
-		}
-		catch (const std::exception & e) {
-			pck::wprinterr(mtxcon, "Exception caught."); wmove(mtxcon, getcury(mtxcon) + 1, 1);
-			pck::wprinterr(mtxcon, "-> %s", e.what()); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
-		}
-		catch (...) {
-			pck::wprinterr(mtxcon, "Exception caught! We don't know which one though."); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
-		}
+		//octagons: 0 = none, 1 = measured, 2 = predicted
+		std::vector<double> matrix(rows * 8, std::numeric_limits<double>::quiet_NaN());
+		std::vector<uint8_t> status(rows, 0);
+		for (size_t row = 0; row < rows; ++row) {
+			const OctagonMatrix& source = (level > 0 && !reference[row]) ? outcomes[level - 1].octagons : octagons;
+			if (source.has(row)) {
+				status[row] = (reference[row]) ? 1 : 2;
+				source.get(row, matrix.data() + row * 8);
+			}
 
-		mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Running post-initialization... "); wrefresh(mtxcon);
-		try {
-			postinit();
-			pck::wprintok(mtxcon, "done.");
-		}
-		catch (const std::exception & e) {
-			pck::wprinterr(mtxcon, "Exception caught."); wmove(mtxcon, getcury(mtxcon) + 1, 1);
-			pck::wprinterr(mtxcon, "-> %s", e.what()); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
+			if ((row + 1) % 4096 == 0)
+				progress.advance(2048); //half for gathering, half for matches and writing
 		}
-		catch (...) {
-			pck::wprinterr(mtxcon, "Exception caught! We don't know which one though."); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
+		writer.addMatrix("octagon", matrix, 8);
+		writer.addBytes("octagon.status", status);
+
+		//matches point at the Key column's codes, so they're looked up the same way every key is
+		if (matchCells()) {
+			std::unordered_map<std::wstring, uint32_t> codes;
+			for (size_t row = 0; row < rows; ++row)
+				codes.emplace(SS[row].data.front(), (uint32_t)codes.size());
+
+			std::vector<uint64_t> offsets(1, 0);
+			std::vector<uint32_t> keys;
+			std::vector<double> sims;
+			for (size_t row = 0; row < rows; ++row) {
+				if (status[row] == 2) { //only predictions come with matches, like in the .csv
+					if (level > 0) {
+						for (auto& match : outcomes[level - 1].matches[row]) {
+							keys.push_back(codes[SS[match.first].data.front()]);
+							sims.push_back(match.second);
+						}
+					}
+					else {
+						for (auto& match : SS[row].usaMatches) {
+							keys.push_back(codes[match.first]);
+							sims.push_back(match.second);
+						}
+					}
+				}
+				offsets.push_back(keys.size());
+			}
+			writer.addMatches("matches", offsets, keys, sims);
 		}
 
-		mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Performing memory data sweep... "); wrefresh(mtxcon);
-		try {
-			sweep();
-			pck::wprintok(mtxcon, "done."); wrefresh(mtxcon);
+		std::string path = outputPath(level, ".mtxc");
+		if (!writer.save(path)) {
+			std::string noext = metaStem();
+			if (!writer.save(noext + outputSuffix(level) + ".mtxc"))
+				throw 1;
 		}
-		catch (const std::exception & e) {
-			pck::wprinterr(mtxcon, "Exception caught."); wmove(mtxcon, getcury(mtxcon) + 1, 1);
-			pck::wprinterr(mtxcon, "-> %s", e.what()); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
+		progress.advance((long long)rows - (long long)(rows / 4096) * 2048);
+	}
+
+	// Every tree sample's metadata row (all ones if it isn't in the sheet) and key (its leaf name if it isn't),
+	// by position in the tree's depth-first order
+	void Matrixinator::sampleKeys(std::vector<uint32_t>& rows, std::vector<std::string>& keys)
+	{
+		std::vector<int> rowOf(numNodes + 1, -1);
+		for (int row = 0; row < (int)SS.size(); ++row) {
+			int node = SS[row].nodeNumber;
+			if (node >= 1 && node <= numNodes && rowOf[node] < 0)
+				rowOf[node] = row;
 		}
-		catch (...) {
-			pck::wprinterr(mtxcon, "Exception caught! We don't know which one though."); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
+
+		const int samples = tree->last[0];
+		rows.assign(samples, UINT32_MAX);
+		keys.assign(samples, std::string());
+		for (int node = 1; node <= numNodes; ++node) {
+			const int q = tree->position[node];
+			if (q < 0)
+				continue;
+			if (rowOf[node] >= 0) {
+				rows[q] = (uint32_t)rowOf[node];
+				keys[q] = w_narrow(SS[rowOf[node]].data.front());
+			}
+			else if (!tree->labels.empty())
+				keys[q] = tree->labels[node];
 		}
+	}
 
-		(overwrite) ?
-			mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Outputting results to file: \"%s\"... ", paths.getMeta().c_str()) :
+	// Writes every pair of samples on the tree at least "pairCutoff" similar as a sparse matrix
+	void Matrixinator::writePairs()
+	{
+		PCK_TRACE_SCOPE("write pairs");
+		PairMatrix pairs(*tree, config.pairCutoff);
+		std::vector<uint32_t> rows;
+		std::vector<std::string> keys;
+		sampleKeys(rows, keys);
+
+		if (!pairs.save(outputPath("-pairs", ".mtxs"), rows, keys) &&
+			!pairs.save(metaStem() + "-pairs.mtxs", rows, keys))
+			throw 1;
+	}
 
-			mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Outputting results to file: \"%s\"... ",
-				(paths.getMeta().substr(0, paths.getMeta().find_last_of('.')) + "-out.csv").c_str()
-			);
+	// Writes the whole similarity matrix, every sample against every other one
+	void Matrixinator::writeDense()
+	{
+		PCK_TRACE_SCOPE("write dense matrix");
+		DenseMatrix matrix(*tree);
+		std::vector<uint32_t> rows;
+		std::vector<std::string> keys;
+		sampleKeys(rows, keys);
+
+		std::string extension = DenseMatrix::extension(config.dense, config.compression);
+		if (!matrix.save(outputPath("-dense", extension), config.dense, config.compression, rows, keys, config.sweepThreads()) &&
+			!matrix.save(metaStem() + "-dense" + extension, config.dense, config.compression, rows, keys, config.sweepThreads()))
+			throw 1;
+	}
 
-		wrefresh(mtxcon);
-		try {
-			output();
-			pck::wprintok(mtxcon, "done."); wrefresh(mtxcon);
-			closing(0, mtxcon); return;
-		}
-		catch (const std::exception & e) {
-			pck::wprinterr(mtxcon, "Exception caught."); wmove(mtxcon, getcury(mtxcon) + 1, 1);
-			pck::wprinterr(mtxcon, "-> %s", e.what()); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
-		}
-		catch (const int ex) {
-			pck::wprinterr(mtxcon, "Exception caught: Error code #%d", ex); wrefresh(mtxcon);
-			closing(ex, mtxcon); return;
-		}
-		catch (...) {
-			pck::wprinterr(mtxcon, "Exception caught! We don't know which one though."); wrefresh(mtxcon);
-			closing(10, mtxcon); return;
+	// Runs the first "upTo" phases back to back (all of them by default), publishing how it goes through
+	// "progress". Phases a preload already went through aren't run again; one that's still going is waited for.
+	// Meant to be run off the UI thread, so no curses in here. Returns the closing code.
+	int Matrixinator::run(int upTo)
+	{
+		int code = 0;
+		if (loader.joinable()) {
+			loader.join();
+			code = loadCode;
 		}
+		if (code == 0)
+			code = runPhases(upTo);
+
+		//results made it to disk, nothing left to resume (and only this run's own checkpoint is this run's to remove)
+		if (code == 0 && reached == 4 && !checkpointFile.empty())
+			std::remove(checkpointFile.c_str());
+
+		//a failed run's timeline is just as worth a look
+		PCK_TRACE_DUMP(config.paths.getLeadingPath(true) + "\\" + metaStem() + "-trace.json");
+
+		progress.finish();
+		return code;
 	}
 
-	// Closing sequence
-	void Matrixinator::closing(int code, WINDOW* mtxcon)
+	// The phases themselves, from wherever the last call left off up to "upTo". Code 3 if cancelled.
+	int Matrixinator::runPhases(int upTo)
 	{
-		end = std::chrono::high_resolution_clock::now();
-		double total = (double)std::chrono::duration_cast<std::chrono::milliseconds>(end - beg).count() / 1000;
-		mvwprintw(mtxcon, (getmaxy(mtxcon) / 4) * 3, 1, "Execution terminated. Duration: %.2fs | Code: %d | Status: ", total, code);
-		if (code == 0)
-			pck::wprintok(mtxcon, "OK");
-		else {
-			pck::wprinterr(mtxcon, "FAILURE");
-			mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "-> ");
+		void (Matrixinator::*phases[])() = { &Matrixinator::init, &Matrixinator::postinit, &Matrixinator::sweep, &Matrixinator::output };
+#ifdef PCK_TRACE
+		static const char* names[] = { "init", "postinit", "sweep", "output" };
+#endif
+		int code = 0;
+		upTo = std::min(std::max(upTo, 0), 4);
+
+		while (reached < upTo && code == 0) {
+			if (cancelled)
+				return 3;
+
+			progress.begin(reached);
+			try {
+				PCK_TRACE_SCOPE(names[reached]);
+				(this->*phases[reached])();
+				++reached;
+			}
+			catch (const std::exception & e) {
+				failure = e.what();
+				code = 10;
+			}
+			catch (const int ex) {
+				code = ex;
+			}
+			catch (...) {
+				code = 10;
+			}
 		}
+		return code;
+	}
 
-		switch (code) {
-		case 1:
-			wprintw(mtxcon, "The program was not able to create the output file, neither in the input metadata file's folder, nor in its own folder.");
-			mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Please make sure the folders exist, and that they are not read-only.");
-			break;
+	// Starts reading the inputs (init and postinit) on a thread of its own, for run() to pick up from later.
+	// A tree that's being built this way lands in the TreeCache, if that's where this run gets its trees.
+	void Matrixinator::preload()
+	{
+		if (loader.joinable() || reached > 0)
+			return;
 
-		case 2:
-			wprintw(mtxcon, "The program could not find the I/O files to read from. Please set them before initializing the Matrixinator.");
-			break;
+		inputStamp = stampInputs(config);
+		loader = std::thread([this]() {
+			loadCode = runPhases(2);
+		});
+	}
+
+	// Tells the run to stop: reading the inputs gives up partway, the sweep after the wave it's in (checkpointed),
+	// the output once it's written. Doesn't wait for it.
+	void Matrixinator::cancel()
+	{
+		cancelled = true;
+	}
 
-		case 10:
-			wprintw(mtxcon, "The program encountered an exception from the standard library.");
-			break;
+	// Both input files' sizes and modification times, mixed together
+	long long Matrixinator::stampInputs(const RunConfig& config) const
+	{
+		DisplayPaths paths = config.paths;
+		long long stamp = 0;
+		for (bool meta : { false, true }) {
+			std::error_code sizeError, timeError;
+			std::filesystem::path file = paths.getFullFilepath(meta);
+			long long size = (long long)std::filesystem::file_size(file, sizeError);
+			long long time = (long long)std::filesystem::last_write_time(file, timeError).time_since_epoch().count();
+			stamp = stamp * 1000003 + ((sizeError || timeError) ? -1 : size ^ time);
 		}
+		return stamp;
+	}
 
-		mvwprintw(mtxcon, getcury(mtxcon) + 1, 1, "Press any key to continue.");
-		refresh();
-		wrefresh(mtxcon);
-		getch();
+	// True if "config" points at the same inputs this run read (or is reading), and they haven't changed since
+	bool Matrixinator::sameInputs(const RunConfig& config) const
+	{
+		DisplayPaths mine = this->config.paths, theirs = config.paths;
+		return mine.getFullFilepath(true) == theirs.getFullFilepath(true) && mine.getFullFilepath(false) == theirs.getFullFilepath(false) &&
+			this->config.compact == config.compact && stampInputs(config) == inputStamp;
+	}
+
+	// Takes on the menu's current settings for the phases still to come. False if they need other inputs, or the
+	// same ones read differently, in which case this run is no use.
+	bool Matrixinator::adopt(const RunConfig& config)
+	{
+		if (!sameInputs(config))
+			return false;
+
+		//only what the sweep and output read: a preload may still be busy with the rest
+		this->config.overwrite = config.overwrite;
+		this->config.detailed = config.detailed;
+		this->config.resume = config.resume;
+		this->config.columnar = config.columnar;
+		this->config.compression = config.compression;
+		this->config.edges = config.edges;
+		this->config.dense = config.dense;
+		this->config.pairCutoff = config.pairCutoff;
+		this->config.thresholds = config.thresholds;
+		return true;
+	}
 
-		wborder(mtxcon, ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ');
-		for (int i = 0; i < getmaxy(mtxcon); ++i) {
-			wmove(mtxcon, i, 0); wclrtoeol(mtxcon);
+	// What a closing code means, for whoever's showing it. Null for OK, and for codes nobody gave a meaning.
+	const char* Matrixinator::explain(int code)
+	{
+		switch (code) {
+		case 1: return "could not create the output file, neither next to the metadata file nor in the program's folder";
+		case 2: return "could not find the I/O files to read from";
+		case 3: return "cancelled";
+		case 10: return "exception from the standard library";
+		default: return nullptr;
 		}
-		refresh();
-		wrefresh(mtxcon);
-		delwin(mtxcon);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "matrixinator.hpp"
+
+namespace mtx {
+	// ===============================================================================
+	//                                 OctagonMatrix                                 =
+	// ===============================================================================
+
+	// Constructor
+	OctagonMatrix::OctagonMatrix()
+	{
+		rows = 0;
+		compact = false;
+	}
+
+	// Makes room for "rows" rows, none of them with an octagon yet
+	void OctagonMatrix::reset(size_t rows, bool compact)
+	{
+		this->rows = rows;
+		this->compact = compact;
+		wide = std::vector<double>((compact) ? 0 : rows * 8);
+		narrow = std::vector<float>((compact) ? rows * 8 : 0);
+		present = std::vector<std::atomic<uint64_t>>((rows + 63) / 64); //value-initialized, so all clear
+	}
+
+	// Makes room for more rows after the ones there, none of them with an octagon yet
+	void OctagonMatrix::grow(size_t rows)
+	{
+		if (rows <= this->rows)
+			return;
+
+		if (compact)
+			narrow.resize(rows * 8);
+		else
+			wide.resize(rows * 8);
+		std::vector<std::atomic<uint64_t>> bits((rows + 63) / 64);
+		for (size_t i = 0; i < present.size(); ++i)
+			bits[i].store(present[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		present.swap(bits);
+		this->rows = rows;
+	}
+
+	// Stores a row's octagon, narrowing it if compact
+	void OctagonMatrix::set(size_t row, const double* values)
+	{
+		if (compact) {
+			for (int j = 0; j < 8; ++j)
+				narrow[row * 8 + j] = (float)values[j];
+		}
+		else
+			std::copy(values, values + 8, wide.begin() + row * 8);
+		present[row >> 6].fetch_or((uint64_t)1 << (row & 63), std::memory_order_relaxed);
+	}
+
+	// Hands a row's octagon back as doubles
+	void OctagonMatrix::get(size_t row, double* values) const
+	{
+		if (compact) {
+			for (int j = 0; j < 8; ++j)
+				values[j] = narrow[row * 8 + j];
+		}
+		else
+			std::copy(wide.begin() + row * 8, wide.begin() + row * 8 + 8, values);
+	}
+
+	// Takes a row out, moving every row after it up by one
+	void OctagonMatrix::erase(size_t row)
+	{
+		if (row >= rows)
+			return;
+
+		for (size_t r = row; r + 1 < rows; ++r) {
+			if (compact)
+				std::copy(narrow.begin() + (r + 1) * 8, narrow.begin() + (r + 2) * 8, narrow.begin() + r * 8);
+			else
+				std::copy(wide.begin() + (r + 1) * 8, wide.begin() + (r + 2) * 8, wide.begin() + r * 8);
+
+			const uint64_t bit = (uint64_t)1 << (r & 63);
+			if (has(r + 1))
+				present[r >> 6].fetch_or(bit, std::memory_order_relaxed);
+			else
+				present[r >> 6].fetch_and(~bit, std::memory_order_relaxed);
+		}
+
+		--rows;
+		present[rows >> 6].fetch_and(~((uint64_t)1 << (rows & 63)), std::memory_order_relaxed);
+		wide.resize((compact) ? 0 : rows * 8);
+		narrow.resize((compact) ? rows * 8 : 0);
+	}
+
+	// The prediction kernel: every picked row's octagon times its weight, added up in double, in pick order
+	template<class T>
+	void OctagonMatrix::accumulate(const T* values, const std::vector<int>& picks, const std::vector<double>& weights, double* sums)
+	{
+		for (size_t i = 0; i < picks.size(); ++i) {
+			const T* row = values + (size_t)picks[i] * 8;
+			const double weight = weights[i];
+			for (int j = 0; j < 8; ++j)
+				sums[j] += row[j] * weight;
+		}
+	}
+
+	// Adds every picked row's octagon, times its weight, to sums
+	void OctagonMatrix::weigh(const std::vector<int>& picks, const std::vector<double>& weights, double* sums) const
+	{
+		if (compact)
+			accumulate(narrow.data(), picks, weights, sums);
+		else
+			accumulate(wide.data(), picks, weights, sums);
+	}
+}
@@ -0,0 +1,460 @@
+#include "pckcore.hpp"
+#include <algorithm>
+//codecs are optional: whichever library is around at build time gets in
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define PCK_ZLIB
+#ifdef _MSC_VER
+#pragma comment(lib, "zlib.lib")
+#endif
+#endif
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define PCK_ZSTD
+#ifdef _MSC_VER
+#pragma comment(lib, "zstd.lib")
+#endif
+#endif
+
+namespace pck {
+	// ===============================================================================
+	//                                     Packer                                    =
+	// ===============================================================================
+
+	// Constructor
+	Packer::Packer()
+	{
+		format = plain;
+		closing = false;
+		failed = false;
+		putArea.resize(1 << 16);
+	}
+
+	// Destructor: an unclosed file still gets finished
+	Packer::~Packer()
+	{
+		if (worker.joinable())
+			close();
+	}
+
+	// True if the format was built in
+	bool Packer::available(Format format)
+	{
+		switch (format) {
+		case plain:
+			return true;
+		case gzip:
+#ifdef PCK_ZLIB
+			return true;
+#else
+			return false;
+#endif
+		case zstd:
+#ifdef PCK_ZSTD
+			return true;
+#else
+			return false;
+#endif
+		}
+		return false;
+	}
+
+	// What goes after the file's own extension
+	const char* Packer::extension(Format format)
+	{
+		static const char* extensions[] = { "", ".gz", ".zst" };
+		return extensions[format];
+	}
+
+	// For menus and such
+	const char* Packer::name(Format format)
+	{
+		static const char* names[] = { "None", "gzip", "zstd" };
+		return names[format];
+	}
+
+	// Compression format going by the file name alone
+	Packer::Format Packer::fromExtension(const std::string& file)
+	{
+		if (hasExtension(std::filesystem::path(file), "gz"))
+			return gzip;
+		if (hasExtension(std::filesystem::path(file), "zst"))
+			return zstd;
+		return plain;
+	}
+
+	// Starts a new file, or with append, a new member at the end of one. False if the format isn't built in or
+	// the file can't be created.
+	bool Packer::open(const std::string& path, Format format, bool append)
+	{
+		if (worker.joinable())
+			close();
+		if (!available(format))
+			return false;
+
+		file.open(path, std::ofstream::binary | ((append) ? std::ofstream::app : std::ofstream::trunc));
+		if (!file.is_open())
+			return false;
+
+		this->format = format;
+		closing = false;
+		failed = false;
+		filling.clear();
+		filling.reserve(blockSize);
+		setp(putArea.data(), putArea.data() + putArea.size());
+		worker = std::thread(&Packer::compress, this);
+		return true;
+	}
+
+	// Flushes what's left, waits for the codec to finish and closes the file. False if anything went wrong along the way.
+	bool Packer::close()
+	{
+		if (!worker.joinable())
+			return false;
+
+		narrowPut();
+		handOver();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closing = true;
+		}
+		changed.notify_all();
+		worker.join();
+
+		bool ok = !failed;
+		file.close();
+		setp(nullptr, nullptr);
+		return ok && !file.fail();
+	}
+
+	// Moves the put area into the block being filled, a byte per character
+	void Packer::narrowPut()
+	{
+		for (wchar_t* ch = pbase(); ch < pptr(); ++ch) {
+			filling.push_back((char)*ch);
+			if (filling.size() >= blockSize)
+				handOver();
+		}
+		setp(putArea.data(), putArea.data() + putArea.size());
+	}
+
+	// Queues the filled block for the codec, waiting if it's too far behind
+	void Packer::handOver()
+	{
+		if (filling.empty())
+			return;
+
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [this]() { return queue.size() < maxQueued; });
+		queue.push_back(std::move(filling));
+		guard.unlock();
+		changed.notify_all();
+
+		filling = std::vector<char>();
+		filling.reserve(blockSize);
+	}
+
+	// Put area's full
+	Packer::int_type Packer::overflow(int_type ch)
+	{
+		if (!worker.joinable())
+			return traits_type::eof();
+
+		narrowPut();
+		if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(ch);
+			pbump(1);
+		}
+		return traits_type::not_eof(ch);
+	}
+
+	// Flushing only goes as far as the block being filled; blocks go out whole
+	int Packer::sync()
+	{
+		if (!worker.joinable())
+			return -1;
+
+		narrowPut();
+		return (failed) ? -1 : 0;
+	}
+
+	// Codec thread: compresses and writes every block in the order they came in, then ends the stream once closing
+	void Packer::compress()
+	{
+		std::vector<char> out(1 << 18);
+#ifdef PCK_ZLIB
+		z_stream zs = {};
+		if (format == gzip && deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			failed = true; //15 + 16 = biggest window, gzip wrapper
+#endif
+#ifdef PCK_ZSTD
+		ZSTD_CCtx* zc = nullptr;
+		if (format == zstd && (zc = ZSTD_createCCtx()) == nullptr)
+			failed = true;
+#endif
+
+		while (true) {
+			std::vector<char> block;
+			bool last;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [this]() { return !queue.empty() || closing; });
+				last = queue.empty();
+				if (!last) {
+					block = std::move(queue.front());
+					queue.pop_front();
+				}
+			}
+			changed.notify_all();
+
+			//a failed stream keeps draining the queue, so the writer never hangs on it
+			PCK_TRACE_SCOPE("compress block");
+			if (!failed) {
+				if (format == plain)
+					file.write(block.data(), block.size());
+#ifdef PCK_ZLIB
+				else if (format == gzip) {
+					int code;
+					zs.next_in = (Bytef*)block.data();
+					zs.avail_in = (uInt)block.size();
+					do {
+						zs.next_out = (Bytef*)out.data();
+						zs.avail_out = (uInt)out.size();
+						code = deflate(&zs, (last) ? Z_FINISH : Z_NO_FLUSH);
+						if (code == Z_STREAM_ERROR) {
+							failed = true;
+							break;
+						}
+						file.write(out.data(), out.size() - zs.avail_out);
+					} while ((last) ? code != Z_STREAM_END : zs.avail_out == 0);
+				}
+#endif
+#ifdef PCK_ZSTD
+				else if (format == zstd) {
+					ZSTD_inBuffer in = { block.data(), block.size(), 0 };
+					size_t left;
+					do {
+						ZSTD_outBuffer chunk = { out.data(), out.size(), 0 };
+						left = ZSTD_compressStream2(zc, &chunk, &in, (last) ? ZSTD_e_end : ZSTD_e_continue);
+						if (ZSTD_isError(left)) {
+							failed = true;
+							break;
+						}
+						file.write(out.data(), chunk.pos);
+					} while ((last) ? left != 0 : in.pos < in.size);
+				}
+#endif
+				if (!file)
+					failed = true;
+			}
+
+			if (last)
+				break;
+		}
+
+#ifdef PCK_ZLIB
+		if (format == gzip)
+			deflateEnd(&zs);
+#endif
+#ifdef PCK_ZSTD
+		if (zc != nullptr)
+			ZSTD_freeCCtx(zc);
+#endif
+	}
+
+	// ===============================================================================
+	//                                    Unpacker                                   =
+	// ===============================================================================
+
+	struct Unpacker::Codec {
+#ifdef PCK_ZLIB
+		z_stream zs = {};
+#endif
+#ifdef PCK_ZSTD
+		ZSTD_DCtx* zd = nullptr;
+		ZSTD_inBuffer in = {};
+#endif
+	};
+
+	// Constructor
+	Unpacker::Unpacker()
+	{
+		format = Packer::plain;
+		drained = true;
+		ended = true;
+	}
+
+	// Destructor
+	Unpacker::~Unpacker()
+	{
+		close();
+	}
+
+	// Compression format going by the file's first bytes
+	Packer::Format Unpacker::sniff(const std::string& path)
+	{
+		std::ifstream file(path, std::ifstream::binary);
+		unsigned char magic[4] = { 0, 0, 0, 0 };
+		file.read((char*)magic, 4);
+
+		if (magic[0] == 0x1f && magic[1] == 0x8b)
+			return Packer::gzip;
+		if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+			return Packer::zstd;
+		return Packer::plain;
+	}
+
+	// Opens a file for reading. False if it can't be opened, or if it needs a codec this build doesn't have.
+	bool Unpacker::open(const std::string& path)
+	{
+		close();
+		format = sniff(path);
+		if (!Packer::available(format))
+			return false;
+
+		file.open(path, std::ifstream::binary);
+		if (!file.is_open())
+			return false;
+
+		codec.reset(new Codec());
+#ifdef PCK_ZLIB
+		if (format == Packer::gzip && inflateInit2(&codec->zs, 15 + 16) != Z_OK) { //15 + 16 = biggest window, gzip wrapper
+			close();
+			return false;
+		}
+#endif
+#ifdef PCK_ZSTD
+		if (format == Packer::zstd && (codec->zd = ZSTD_createDCtx()) == nullptr) {
+			close();
+			return false;
+		}
+#endif
+		input.resize(1 << 16);
+		drained = false;
+		ended = false;
+		return true;
+	}
+
+	// Reads the next compressed chunk from the file
+	void Unpacker::refill()
+	{
+		file.read(input.data(), input.size());
+		size_t got = (size_t)file.gcount();
+		if (got == 0)
+			drained = true;
+
+#ifdef PCK_ZLIB
+		codec->zs.next_in = (Bytef*)input.data();
+		codec->zs.avail_in = (uInt)got;
+#endif
+#ifdef PCK_ZSTD
+		codec->in = { input.data(), got, 0 };
+#endif
+	}
+
+	// Decompresses up to "size" bytes into out. Returns how many; 0 only once it's all been read (or it's broken).
+	size_t Unpacker::read(char* out, size_t size)
+	{
+		if (ended || size == 0)
+			return 0;
+
+		if (format == Packer::plain) {
+			file.read(out, size);
+			size_t got = (size_t)file.gcount();
+			ended = (got == 0);
+			return got;
+		}
+
+		while (true) {
+			size_t got = 0;
+#ifdef PCK_ZLIB
+			if (format == Packer::gzip) {
+				z_stream& zs = codec->zs;
+				if (zs.avail_in == 0 && !drained)
+					refill();
+
+				zs.next_out = (Bytef*)out;
+				zs.avail_out = (uInt)size;
+				int code = inflate(&zs, Z_NO_FLUSH);
+				got = size - zs.avail_out;
+
+				if (code == Z_STREAM_END) {
+					if (zs.avail_in == 0 && !drained)
+						refill();
+					if (zs.avail_in == 0)
+						ended = true;
+					else
+						inflateReset(&zs); //another member follows
+				}
+				else if (code != Z_OK && (code != Z_BUF_ERROR || (drained && zs.avail_in == 0)))
+					ended = true; //broken or cut short
+			}
+#endif
+#ifdef PCK_ZSTD
+			if (format == Packer::zstd) {
+				if (codec->in.pos == codec->in.size && !drained)
+					refill();
+
+				ZSTD_outBuffer chunk = { out, size, 0 };
+				size_t code = ZSTD_decompressStream(codec->zd, &chunk, &codec->in);
+				got = chunk.pos;
+
+				if (ZSTD_isError(code) || (got == 0 && drained && codec->in.pos == codec->in.size))
+					ended = true;
+			}
+#endif
+			if (got > 0 || ended)
+				return got;
+		}
+	}
+
+	// Reads the whole file through "take" a block at a time. Each block is at least blockSize bytes (unless the file
+	// runs out first) and comes with whether it's the last one; take sets "used" to how much of it made whole records,
+	// and whatever's past that goes at the front of the next block (growing it, if a record's longer than a block).
+	// Returns false as soon as take does, which stops the reading right there.
+	bool Unpacker::feed(const std::function<bool(const char* data, size_t size, bool last, size_t& used)>& take)
+	{
+		std::vector<char> buffer;
+		size_t filled = 0;
+
+		while (true) {
+			buffer.resize(filled + blockSize);
+			size_t got = 1;
+			while (filled < buffer.size() && got > 0) {
+				got = read(buffer.data() + filled, buffer.size() - filled);
+				filled += got;
+			}
+
+			const bool last = filled < buffer.size();
+			size_t used = 0;
+			if (!take(buffer.data(), filled, last, used))
+				return false;
+			if (last)
+				return true;
+
+			used = std::min(used, filled);
+			std::copy(buffer.begin() + used, buffer.begin() + filled, buffer.begin());
+			filled -= used;
+		}
+	}
+
+	// Closes the file and lets go of the codec
+	void Unpacker::close()
+	{
+		if (codec) {
+#ifdef PCK_ZLIB
+			if (format == Packer::gzip)
+				inflateEnd(&codec->zs);
+#endif
+#ifdef PCK_ZSTD
+			if (codec->zd != nullptr)
+				ZSTD_freeDCtx(codec->zd);
+#endif
+			codec.reset();
+		}
+		if (file.is_open())
+			file.close();
+		drained = true;
+		ended = true;
+	}
+}
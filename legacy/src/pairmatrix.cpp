@@ -0,0 +1,190 @@
+#include "matrixinator.hpp"
+#include <algorithm>
+
+namespace mtx {
+	// ===============================================================================
+	//                                   PairMatrix                                  =
+	// ===============================================================================
+
+	static const char MAGIC[8] = { 'M', 'T', 'X', 'S', 'I', 'M', '0', '1' };
+	static const uint32_t VERSION = 1;
+	static const uint32_t HEADER = 88;  //everything up to the first array
+	static const size_t CHUNK = 1 << 20;
+
+	// Next multiple of 8
+	static uint64_t aligned(uint64_t offset)
+	{
+		return (offset + 7) & ~(uint64_t)7;
+	}
+
+	// Constructor: chains up the ancestors that make the cutoff and counts every sample's pairs, but doesn't
+	// list any yet
+	PairMatrix::PairMatrix(const TreeIndex& tree, double cutoff) : tree(tree)
+	{
+		this->cutoff = cutoff;
+		const int numNodes = tree.numNodes;
+
+		int samples = 0, deepest = 0;
+		for (int i = 1; i <= numNodes; ++i) {
+			samples += (tree.position[i] >= 0);
+			deepest = std::max(deepest, tree.depth[i]);
+		}
+		nodes.assign(samples, 0);
+		for (int i = 1; i <= numNodes; ++i) {
+			if (tree.position[i] >= 0)
+				nodes[tree.position[i]] = i;
+		}
+
+		//parents before children: nodes by depth (those stuck in a loop of parents have none, and are left out)
+		std::vector<int> level(deepest + 2, 0), order;
+		for (int i = 1; i <= numNodes; ++i) {
+			if (tree.depth[i] >= 0)
+				++level[tree.depth[i] + 1];
+		}
+		for (int d = 0; d <= deepest; ++d)
+			level[d + 1] += level[d];
+		order.resize(level.back());
+		for (int i = 1; i <= numNodes; ++i) {
+			if (tree.depth[i] >= 0)
+				order[level[tree.depth[i]]++] = i;
+		}
+
+		//for every node, the closest ancestor that makes the cutoff, and how many partners a sample below it
+		//has through the ancestors above it: each one's samples, less those on this side of it
+		auto span = [&](int node) { return (uint64_t)(tree.last[node] - tree.first[node]); };
+		up.assign(numNodes + 1, 0);
+		std::vector<uint64_t> above(numNodes + 1, 0);
+		for (int node : order) {
+			const int parent = tree.parentOf(node);
+			if (parent == 0)
+				continue;
+			const bool makes = tree.acacia[parent].similarity >= cutoff;
+			up[node] = (makes) ? parent : up[parent];
+			above[node] = above[parent] + ((makes) ? span(parent) - span(node) : 0);
+		}
+
+		//plus, for a sample that has samples below it, those
+		offsets.assign((size_t)samples + 1, 0);
+		for (int q = 0; q < samples; ++q) {
+			const int node = nodes[q];
+			const uint64_t below = (tree.acacia[node].similarity >= cutoff) ? span(node) - 1 : 0;
+			offsets[q + 1] = offsets[q] + above[node] + below;
+		}
+	}
+
+	// Nonzeros, both halves of the matrix counted
+	uint64_t PairMatrix::getPairs() const
+	{
+		return offsets.back();
+	}
+
+	// One row: the sample's partners, in order, and how similar each one is to it. Going up the ancestors that
+	// make the cutoff, each one adds the samples it has left of the branch the sample's on, and right of it.
+	// The left ones come out backwards, so they're turned around before the rest go in.
+	void PairMatrix::row(int position, std::vector<uint32_t>& columns, std::vector<float>& values) const
+	{
+		columns.clear();
+		values.clear();
+		const int node = nodes[position];
+
+		for (int branch = node, above = up[node]; above != 0; branch = above, above = up[above]) {
+			const int side = tree.ancestor(branch, tree.depth[above] + 1);
+			const float similarity = (float)tree.acacia[above].similarity;
+			for (int q = tree.first[side] - 1; q >= tree.first[above]; --q) {
+				columns.push_back((uint32_t)q);
+				values.push_back(similarity);
+			}
+		}
+		std::reverse(columns.begin(), columns.end());
+		std::reverse(values.begin(), values.end());
+
+		if (tree.acacia[node].similarity >= cutoff) {
+			for (int q = position + 1; q < tree.last[node]; ++q) {
+				columns.push_back((uint32_t)q);
+				values.push_back((float)tree.acacia[node].similarity);
+			}
+		}
+
+		for (int branch = node, above = up[node]; above != 0; branch = above, above = up[above]) {
+			const int side = tree.ancestor(branch, tree.depth[above] + 1);
+			const float similarity = (float)tree.acacia[above].similarity;
+			for (int q = tree.last[side]; q < tree.last[above]; ++q) {
+				columns.push_back((uint32_t)q);
+				values.push_back(similarity);
+			}
+		}
+	}
+
+	// Writes the whole matrix, along with each sample's metadata row and key. Rows are listed twice, once for
+	// the column indices and once for the values, so neither has to be held whole in memory.
+	bool PairMatrix::save(const std::string& path, const std::vector<uint32_t>& rows, const std::vector<std::string>& keys) const
+	{
+		std::ofstream file(path, std::ofstream::binary | std::ofstream::trunc);
+		if (!file.is_open())
+			return false;
+
+		const uint64_t samples = nodes.size(), pairs = getPairs();
+		std::vector<uint64_t> keyOffsets(1, 0);
+		for (const std::string& key : keys)
+			keyOffsets.push_back(keyOffsets.back() + key.size());
+
+		//where each array starts
+		uint64_t sections[6];
+		sections[0] = HEADER;
+		sections[1] = aligned(sections[0] + (samples + 1) * sizeof(uint64_t));
+		sections[2] = aligned(sections[1] + pairs * sizeof(uint32_t));
+		sections[3] = aligned(sections[2] + pairs * sizeof(float));
+		sections[4] = aligned(sections[3] + samples * sizeof(uint32_t));
+		sections[5] = aligned(sections[4] + (samples + 1) * sizeof(uint64_t));
+
+		std::string pending;
+		uint64_t written = 0;
+		auto flush = [&](bool force) {
+			if (force || pending.size() >= CHUNK) {
+				file.write(pending.data(), pending.size());
+				written += pending.size();
+				pending.clear();
+			}
+		};
+		auto pad = [&](uint64_t to) {
+			pending.append((size_t)(to - written - pending.size()), '\0');
+		};
+
+		pending.append(MAGIC, 8);
+		pending.append((const char*)&VERSION, sizeof(VERSION));
+		pending.append((const char*)&HEADER, sizeof(HEADER));
+		pending.append((const char*)&samples, sizeof(samples));
+		pending.append((const char*)&pairs, sizeof(pairs));
+		pending.append((const char*)&cutoff, sizeof(cutoff));
+		pending.append((const char*)sections, sizeof(sections));
+
+		pending.append((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+		pad(sections[1]);
+
+		std::vector<uint32_t> columns;
+		std::vector<float> values;
+		for (int pass = 0; pass < 2; ++pass) {
+			for (int q = 0; q < (int)samples; ++q) {
+				row(q, columns, values);
+				if (pass == 0)
+					pending.append((const char*)columns.data(), columns.size() * sizeof(uint32_t));
+				else
+					pending.append((const char*)values.data(), values.size() * sizeof(float));
+				flush(false);
+			}
+			pad(sections[2 + pass]);
+		}
+
+		pending.append((const char*)rows.data(), rows.size() * sizeof(uint32_t));
+		pad(sections[4]);
+		pending.append((const char*)keyOffsets.data(), keyOffsets.size() * sizeof(uint64_t));
+		pad(sections[5]);
+		for (const std::string& key : keys) {
+			pending.append(key);
+			flush(false);
+		}
+		flush(true);
+
+		return (bool)file;
+	}
+}
@@ -5,6 +5,11 @@
 #include <windows.h>
 #include <cctype>
 #include <stdarg.h>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <exception>
 
 namespace pck {
 	// ===============================================================================
@@ -66,33 +71,60 @@ namespace pck {
 		va_end(args);
 	}
 
-	// Slices a string n' splices it together into a vector of substrings
+	// Slices a string n' splices it together into a vector of substrings. Hot paths should go through Tokens instead.
 	std::vector<std::string> sliceNsplice(const std::string& str, char delim = ' ')
 	{
 		std::vector<std::string> res;
-		std::stringstream sstr(str);
-		std::string temp;
+		for (std::string_view piece : Tokens(str, delim)) //empty pieces are skipped
+			res.emplace_back(piece);
+		return res;
+	}
 
-		// if there is no delimiter or string
-		if (str.empty())
-			return res;
+	// Compares the first "length" characters of a raw file name against an extension (no dot, lowercase)
+	template<class Str>
+	static bool endsInExtension(const Str& raw, size_t length, std::string_view extension)
+	{
+		const size_t extlen = extension.length();
 
-		if (str.find_first_of(delim) == std::string::npos) {
-			getline(sstr, temp, delim);
-			res.push_back(temp);
-			return res;
-		}
+		if (length <= extlen)
+			return false;
 
-		// remove leading delims
-		if (str[0] == delim)
-			sstr.ignore(INT_MAX, delim);
+		const size_t dot = length - extlen - 1;
+		if (raw[dot] != '.')
+			return false;
 
-		while (getline(sstr, temp, delim)) {
-			if (!temp.empty())
-				res.push_back(temp);
+		for (size_t i = 0; i < extlen; ++i) {
+			auto ch = raw[dot + 1 + i];
+			if (ch >= 'A' && ch <= 'Z')
+				ch += 'a' - 'A';
+			if (ch != (std::filesystem::path::value_type)extension[i])
+				return false;
 		}
+		return true;
+	}
 
-		return res;
+	// Compares a raw file name against an extension (no dot, lowercase), without building any strings
+	bool hasExtension(const std::filesystem::path& file, const std::string& extension)
+	{
+		return endsInExtension(file.native(), file.native().length(), extension);
+	}
+
+	// Same, but a compressed copy (.gz, .zst on top of the extension) counts too, and so does any of
+	// several extensions separated by '|' ("xml|nwk")
+	bool hasPackedExtension(const std::filesystem::path& file, const std::string& extension)
+	{
+		const auto& raw = file.native();
+		size_t length = raw.length();
+		if (endsInExtension(raw, length, "gz"))
+			length -= 3;
+		else if (endsInExtension(raw, length, "zst"))
+			length -= 4;
+
+		for (std::string_view option : Tokens(extension, '|')) {
+			if (endsInExtension(raw, length, option))
+				return true;
+		}
+		return false;
 	}
 
 	// Initialize some custom color schemes.
@@ -161,6 +193,84 @@ namespace pck {
 		return (input == 'Y') ? true : false;
 	}*/
 
+	// ===============================================================================
+	//                                    Progress                                   =
+	// ===============================================================================
+
+	// Constructor
+	Progress::Progress() : done(0), matched(0), total(0), started(0), phase(-1), finished(false)
+	{
+		started = std::chrono::steady_clock::now().time_since_epoch().count();
+	}
+
+	// Starts a new phase, resetting the counters. Total may be 0 if unknown.
+	void Progress::begin(int phase, long long total)
+	{
+		done.store(0, std::memory_order_relaxed);
+		matched.store(0, std::memory_order_relaxed);
+		this->total.store(total, std::memory_order_relaxed);
+		started.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+		this->phase.store(phase, std::memory_order_release);
+	}
+
+	// Sets the current phase's total, once the worker knows it
+	void Progress::setTotal(long long total)
+	{
+		this->total.store(total, std::memory_order_relaxed);
+	}
+
+	// Signals the worker is done, successfully or not
+	void Progress::finish()
+	{
+		finished.store(true, std::memory_order_release);
+	}
+
+	// Getters
+	int Progress::getPhase() const
+	{
+		return phase.load(std::memory_order_acquire);
+	}
+	bool Progress::isFinished() const
+	{
+		return finished.load(std::memory_order_acquire);
+	}
+	long long Progress::getDone() const
+	{
+		return done.load(std::memory_order_relaxed);
+	}
+	long long Progress::getTotal() const
+	{
+		return total.load(std::memory_order_relaxed);
+	}
+	long long Progress::getMatched() const
+	{
+		return matched.load(std::memory_order_relaxed);
+	}
+
+	// Seconds since the current phase began
+	double Progress::elapsed() const
+	{
+		std::chrono::steady_clock::duration since(std::chrono::steady_clock::now().time_since_epoch().count() - started.load(std::memory_order_relaxed));
+		return std::chrono::duration<double>(since).count();
+	}
+
+	// Items per second in the current phase
+	double Progress::rate() const
+	{
+		double secs = elapsed();
+		return (secs > 0) ? getDone() / secs : 0;
+	}
+
+	// Seconds left in the current phase, or -1 if there's no telling
+	double Progress::eta() const
+	{
+		double speed = rate();
+		long long left = getTotal() - getDone();
+		if (getTotal() <= 0 || speed <= 0)
+			return -1;
+		return (left > 0) ? left / speed : 0;
+	}
+
 	// ===============================================================================
 	//                                      Menu                                     =
 	// ===============================================================================
@@ -168,32 +278,30 @@ namespace pck {
 	// Updates the position of our selection cursor. startY delimits the options menu itself from the header. Pass curpos as -1 to do an initial print.
 	void Menu::updatepos(int& curpos, const int& newpos, const int& startY, const std::vector<std::string>& opts, int jumps) 
 	{
+		Screen& screen = Screen::shared();
 		if (curpos == newpos) return;
 		else if (curpos == -1) {
-			mvprintw(startY, 0, "-> ");
-			chgat((int)opts.at(0).length(), A_REVERSE, 0, NULL);
+			screen.print(startY, 0, "-> ");
+			screen.paint(startY, 3, (int)opts.at(0).length(), A_REVERSE);
 			curpos = 0;
 		}
 
-		mvprintw(startY + curpos, 0, "   ");
-		chgat((int)opts.at((size_t)curpos + jumps).length(), A_NORMAL, 0, NULL);
-		mvprintw(startY + newpos, 0, "-> ");
-		chgat((int)opts.at((size_t)newpos + jumps).length(), A_REVERSE, 0, NULL);
+		screen.print(startY + curpos, 0, "   ");
+		screen.paint(startY + curpos, 3, (int)opts.at((size_t)curpos + jumps).length(), A_NORMAL);
+		screen.print(startY + newpos, 0, "-> ");
+		screen.paint(startY + newpos, 3, (int)opts.at((size_t)newpos + jumps).length(), A_REVERSE);
 
 		curpos = newpos;
 	}
 
-	// Prints the collection received to stdscr.
+	// Prints the collection received to the Screen, one per row from startY on.
 	//template<class T>
-	void Menu::printopts(const std::vector<std::string>& collection)
+	void Menu::printopts(const int startY, const std::vector<std::string>& collection)
 	{
-		try {
-			for (auto& option : collection) {
-				printw("   %s\n", option.c_str());
-			}
-		}
-		catch (...) {
-			return;
+		Screen& screen = Screen::shared();
+		for (size_t i = 0; i < collection.size(); ++i) {
+			screen.erase(startY + (int)i);
+			screen.print(startY + (int)i, 3, collection[i]);
 		}
 	}
 
@@ -205,22 +313,20 @@ namespace pck {
 		bool looping = true;
 
 		while (looping) {
+			timeout(tickMs); //only here: prompts further in still wait for as long as it takes
 			int input = getch();
+			timeout(-1);
 			//mvprintw(getmaxy(stdscr) - 1, 0, "Key: %d", input);
 
-			if (input == KEY_RESIZE) {
-				sleep(350);
-
-				if (getmaxx(stdscr) >= minX && getmaxy(stdscr) >= minY)
-					resize_term(0, 0);
-
-				else if (getmaxx(stdscr) < minX)
-					resize_term(getmaxy(stdscr), minX);
-
-				else if (getmaxy(stdscr) < minY)
-					resize_term(minY, getmaxx(stdscr));
+			if (input == ERR) { //no key yet, just the jobs moving along
+				showJobPanel();
+				Screen::shared().flush();
+				continue;
+			}
 
-				else resize_term(minY, minX);
+			else if (input == KEY_RESIZE) {
+				Screen::shared().resize(minY, minX);
+				showJobPanel(); //its rows go with the bottom of the screen
 			}
 
 			else if (input == KEY_F(1) || input == KEY_LEFT) {
@@ -261,17 +367,75 @@ namespace pck {
 					--input;
 
 					updatepos(curpos, input, startY, options);
-					refresh(); sleep(200);
+					Screen::shared().flush();
 					parseopt(curpos);
 				}
 			}
 			//the hell you say?
 			else
 				Beep(1500, 100);
-			refresh();
+			Screen::shared().flush();
 		} //end-while
 	}
 
+	// Draws the JobRunner's status panel over the screen's last lines: running jobs with their phase,
+	// throughput and time so far, then queued ones, then how the latest ones went. Part of every menu's
+	// frame, so it's drawn before the flush that shows it.
+	void Menu::showJobPanel()
+	{
+		static const char spin[] = { '\\', '|', '/', '-' };
+		static int tick = 0;
+		static int shownTop = -1; //where it went last time, in case the screen's been resized since
+		std::vector<JobRunner::Status> jobs = JobRunner::shared().snapshot();
+		if (jobs.empty())
+			return;
+
+		Screen& screen = Screen::shared();
+		const int top = screen.height() - jobRows;
+		if (shownTop >= 0 && shownTop != top) {
+			for (int row = 0; row < jobRows; ++row)
+				screen.erase(shownTop + row);
+		}
+		shownTop = top;
+
+		int running = 0, queued = 0, finished = 0;
+		for (auto& job : jobs) {
+			running += (job.state == JobRunner::State::running);
+			queued += (job.state == JobRunner::State::queued);
+			finished += (job.state == JobRunner::State::finished);
+		}
+
+		screen.erase(top);
+		screen.printf(top, 0, COLOR_PAIR(RAINBOW4), "-- Jobs: %d running | %d queued | %d finished --", running, queued, finished);
+
+		for (int row = 1; row < jobRows; ++row) {
+			const int y = top + row;
+			screen.erase(y);
+			if (row > (int)jobs.size())
+				continue;
+
+			const JobRunner::Status& job = jobs[row - 1];
+			if (job.state == JobRunner::State::running) {
+				int x = screen.printf(y, 0, A_NORMAL, "%c #%-3d %-36.36s %-9s %lld", spin[tick % 4], job.id, job.label.c_str(), job.phase.c_str(), job.done);
+				if (job.total > 0)
+					x = screen.printf(y, x, A_NORMAL, "/%lld", job.total);
+				screen.printf(y, x, A_NORMAL, " | %.0f/s | %.0fs", job.rate, job.seconds);
+			}
+			else if (job.state == JobRunner::State::queued)
+				screen.printf(y, 0, A_NORMAL, "  #%-3d %-36.36s queued", job.id, job.label.c_str());
+			else {
+				int x = screen.printf(y, 0, A_NORMAL, "  #%-3d %-36.36s ", job.id, job.label.c_str());
+				x = (job.code == 0) ?
+					screen.print(y, x, "OK", COLOR_PAIR(OKCOLOR)) :
+					screen.print(y, x, "FAILURE", COLOR_PAIR(ERRCOLOR));
+				x = screen.printf(y, x, A_NORMAL, " (code %d) in %.2fs", job.code, job.seconds);
+				if (!job.failure.empty())
+					screen.print(y, x, " -> " + job.failure); //cut off at the edge, never onto the next line
+			}
+		}
+		++tick;
+	}
+
 	// ===============================================================================
 	//                                  DisplayQueue                                 =
 	// ===============================================================================
@@ -279,34 +443,149 @@ namespace pck {
 	// Constructor
 	DisplayQueue::DisplayQueue(std::vector<std::string> display, int startY) 
 	{
-		hidden = 0;
+		top = 0; cursor = 0;
 		this->startY = startY;
-		this->display = display;
+		this->display = std::move(display);
 	}
 
-	// Scroll function
-	void DisplayQueue::scroll(bool up) 
+	// Case folding for the type-ahead, plain ASCII
+	static char foldch(char ch)
 	{
-		if (display.size() <= 9) return; //can't scroll unscrollable screens
+		return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch;
+	}
+	static unsigned pairkey(char a, char b)
+	{
+		return ((unsigned)(unsigned char)foldch(a) << 8) | (unsigned char)foldch(b);
+	}
 
-		hidden += (up) ? -1 : +1;
-		for (int i = 0; i < 9; ++i) {
-			move(startY + i, 0); clrtoeol();
-			mvprintw(startY + i, 0, "   %s", display.at((size_t)hidden + i).c_str());
+	// Builds the character and character pair index. Only done once something gets typed.
+	void DisplayQueue::buildIndex()
+	{
+		byChar.assign(256, std::vector<int>());
+		byPair.clear();
+
+		for (int item = 0; item < (int)display.size(); ++item) {
+			const std::string& str = display[item];
+			for (size_t i = 0; i < str.length(); ++i) {
+				std::vector<int>& chars = byChar[(unsigned char)foldch(str[i])];
+				if (chars.empty() || chars.back() != item)
+					chars.push_back(item);
+
+				if (i + 1 < str.length()) {
+					std::vector<int>& pairs = byPair[pairkey(str[i], str[i + 1])];
+					if (pairs.empty() || pairs.back() != item)
+						pairs.push_back(item);
+				}
+			}
 		}
+	}
+
+	// Typed one more character: keep only the items still matching, starting from what's left
+	void DisplayQueue::narrow(char ch)
+	{
+		if (byChar.empty())
+			buildIndex();
+
+		query.push_back(foldch(ch));
+		std::vector<int> next;
+
+		if (query.length() == 1)
+			next = byChar[(unsigned char)query[0]];
 
-		if (up) {
-			mvprintw(startY, 0, "-> ");
-			chgat((int)display.at((size_t)hidden).length(), A_REVERSE, 0, NULL);
-		}
 		else {
-			mvprintw(startY + 8, 0, "-> ");
-			chgat((int)display.at((size_t)hidden + 8).length(), A_REVERSE, 0, NULL);
+			const std::vector<int>& prev = narrowed.back();
+			auto pairs = byPair.find(pairkey(query[query.length() - 2], query.back()));
+
+			if (pairs != byPair.end())
+				std::set_intersection(prev.begin(), prev.end(), pairs->second.begin(), pairs->second.end(), std::back_inserter(next));
+
+			//past two characters, having every pair doesn't mean having them in a row
+			if (query.length() > 2) {
+				auto folded = [](char a, char b) { return foldch(a) == b; };
+				next.erase(std::remove_if(next.begin(), next.end(), [&](int item) {
+					const std::string& str = display[item];
+					return std::search(str.begin(), str.end(), query.begin(), query.end(), folded) == str.end();
+				}), next.end());
+			}
 		}
 
-		return;
+		narrowed.push_back(std::move(next));
+		top = 0; cursor = 0;
 	}
 
+	// Erased the last typed character: go back to what was there before it
+	void DisplayQueue::widen()
+	{
+		if (query.empty())
+			return;
+
+		query.pop_back();
+		narrowed.pop_back();
+		top = 0; cursor = 0;
+	}
+
+	// Number of items currently available
+	int DisplayQueue::shownCount() const
+	{
+		return (query.empty()) ? (int)display.size() : (int)narrowed.back().size();
+	}
+
+	// Index in display of the item at a given row
+	int DisplayQueue::shownItem(int row) const
+	{
+		return (query.empty()) ? row : narrowed.back()[row];
+	}
+
+	// Draws a single row, selection arrow included
+	void DisplayQueue::printrow(int row)
+	{
+		Screen& screen = Screen::shared();
+		int y = startY + row - top;
+		screen.erase(y);
+		if (row >= shownCount())
+			return;
+
+		const std::string& item = display[shownItem(row)];
+		if (row == cursor) {
+			screen.print(y, 0, "-> ");
+			screen.print(y, 3, item, A_REVERSE);
+		}
+		else
+			screen.print(y, 3, item);
+	}
+
+	// Draws the visible window and the filter line, nothing else
+	void DisplayQueue::render()
+	{
+		Screen& screen = Screen::shared();
+		for (int row = top; row < top + window; ++row)
+			printrow(row);
+
+		screen.erase(startY + window);
+		if (!query.empty())
+			screen.printf(startY + window, 0, COLOR_PAIR((shownCount() > 0) ? OKCOLOR : ERRCOLOR), "Filter: %s (%d of %d)",
+				query.c_str(), shownCount(), (int)display.size());
+		else if ((int)display.size() > window)
+			screen.printf(startY + window, 0, A_NORMAL, "Type to filter (%d items)", (int)display.size());
+	}
+
+	// Moves the selection anywhere, redrawing the window only if it has to slide
+	void DisplayQueue::jump(int row)
+	{
+		int prev = cursor;
+		cursor = row;
+
+		if (row < top)
+			top = row;
+		else if (row >= top + window)
+			top = row - window + 1;
+		else {
+			printrow(prev);
+			printrow(cursor);
+			return;
+		}
+		render();
+	}
 
 	// Queue menu (single-choice lifespan)
 	int DisplayQueue::qmenu() 
@@ -315,98 +594,76 @@ namespace pck {
 		//that being said, try not to use the default constructor.
 
 		raw(); noecho(); keypad(stdscr, TRUE);
-		const int maxitems = 9, numitems = (int)display.size();
-		int curpos = -1;
-
-		for (int i = 0; i < maxitems && i < numitems; ++i) {
-			mvprintw(startY + i, 0, "   %s", display.at(i).c_str());
-		}
-		updatepos(curpos, 0, startY, display);
-		refresh();
+		query.clear(); narrowed.clear();
+		top = 0; cursor = 0;
+		render();
+		Screen::shared().flush();
 
+		int choice = -1;
 		bool looping = true;
 		while (looping) {
 			int input = getch();
+			const int numitems = shownCount();
 
-			if (input == KEY_RESIZE) {
-				sleep(350);
-
-				if (getmaxx(stdscr) < minX && getmaxy(stdscr) < minY)
-					resize_term(minY, minX);
-
-				else if (getmaxx(stdscr) < minX)
-					resize_term(getmaxy(stdscr), minX);
-
-				else if (getmaxy(stdscr) < minY)
-					resize_term(minY, getmaxx(stdscr));
-
-				else resize_term(0, 0);
-			}
+			if (input == KEY_RESIZE)
+				Screen::shared().resize(minY, minX);
 
 			else if (input == KEY_F(1) || input == KEY_LEFT) {
-				curpos = -1; hidden = 0;
 				looping = false;
 			}
 
-			else if (input == KEY_UP) {
-				if (numitems == 1) continue;
+			else if (input == KEY_UP && numitems > 1)
+				jump((cursor == 0) ? numitems - 1 : cursor - 1); //loop to last
 
-				if (curpos != 0)
-					updatepos(curpos, curpos - 1, startY, display, hidden);
+			else if (input == KEY_DOWN && numitems > 1)
+				jump((cursor >= numitems - 1) ? 0 : cursor + 1); //loop to first
 
-				else {
-					if (numitems <= maxitems) {
-						updatepos(curpos, numitems - 1, startY, display);
-					}
-					else if (hidden == 0) { //loop to last
-						for (int j = 0; j < numitems - 9; ++j)
-							scroll(false);
-						updatepos(curpos, 8, startY, display, hidden);
-					}
-					else {
-						scroll(true);
-					}
-				}
-			}
+			else if (input == KEY_PPAGE && numitems > 0)
+				jump(std::max(cursor - window, 0));
 
-			else if (input == KEY_DOWN) {
-				//can't move in a single-item menu, can we
-				if (numitems == 1) continue;
+			else if (input == KEY_NPAGE && numitems > 0)
+				jump(std::min(cursor + window, numitems - 1));
 
-				if (numitems <= maxitems) {
-					if (curpos == numitems - 1) //loop to first
-						updatepos(curpos, 0, startY, display);
-
-					else
-						updatepos(curpos, curpos + 1, startY, display);
-				}
+			else if (input == KEY_HOME && numitems > 0)
+				jump(0);
 
-				else if (curpos != 8)
-					updatepos(curpos, curpos + 1, startY, display, hidden);
+			else if (input == KEY_END && numitems > 0)
+				jump(numitems - 1);
 
+			else if (input == KEY_BACKSPACE || input == 8 || input == 127) {
+				if (query.empty())
+					Beep(1500, 100);
 				else {
-					if (hidden + curpos == numitems - 1) { //loop to first
-						for (int j = hidden; j > 0; --j)
-							scroll(true);
-						updatepos(curpos, 0, startY, display);
-					}
-					else {
-						scroll(false);
-					}
+					widen();
+					render();
 				}
 			}
 
 			//select
-			else if (vector_isin<int>(selectkeys, input))
-				looping = false;
+			else if (vector_isin<int>(selectkeys, input)) {
+				if (numitems == 0)
+					Beep(1500, 100); //nothing left to select, filter's too picky
+				else {
+					choice = shownItem(cursor);
+					looping = false;
+				}
+			}
+
+			//type-ahead
+			else if (input >= 32 && input <= 126) {
+				narrow((char)input);
+				render();
+			}
 
-			else //literally what
+			else if (input != KEY_UP && input != KEY_DOWN) //literally what
 				Beep(1500, 100);
 
-			refresh();
+			Screen::shared().flush();
 		}
 
-		return curpos + hidden;
+		Screen::shared().erase(startY + window);
+		Screen::shared().flush();
+		return choice;
 	}
 
 	// ===============================================================================
@@ -503,32 +760,165 @@ namespace pck {
 		return str;
 	}
 
-	// Find all files with a given extension
-	std::pair<bool, std::vector<std::string>> FileSniffer::find() 
+	// ASCII-only lowercase, works for both narrow and wide path characters
+	template<class C>
+	static C lowerch(C ch)
+	{
+		return (ch >= 'A' && ch <= 'Z') ? (C)(ch + ('a' - 'A')) : ch;
+	}
+
+	// Case-insensitive glob match supporting * and ?, no allocations
+	template<class C>
+	static bool globMatch(const char* pattern, const C* str)
+	{
+		const char* star = nullptr;
+		const C* retry = nullptr;
+
+		while (*str) {
+			if (*pattern == '*') {
+				star = pattern++;
+				retry = str;
+			}
+			else if (*pattern == '?' || lowerch<C>((C)(unsigned char)*pattern) == lowerch(*str)) {
+				++pattern; ++str;
+			}
+			else if (star) {
+				pattern = star + 1;
+				str = ++retry;
+			}
+			else
+				return false;
+		}
+
+		while (*pattern == '*')
+			++pattern;
+		return *pattern == '\0';
+	}
+
+	// Compares the raw file name against the wanted extension, compressed copies included, without building any strings
+	bool FileSniffer::matchesExtension(const std::filesystem::path& file) const
+	{
+		return hasPackedExtension(file, extension);
+	}
+
+	// True if the file or folder name matches any of the exclusion globs
+	bool FileSniffer::isExcluded(const std::filesystem::path& file) const
+	{
+		if (exclude.empty())
+			return false;
+
+		const auto name = file.filename().native(); //whichever separators the path was spelled with
+		for (auto& glob : exclude) {
+			if (globMatch(glob.c_str(), name.c_str()))
+				return true;
+		}
+		return false;
+	}
+
+	// Walks the folder tree in parallel, handing every matching file to "found" as it shows up, and if there's an
+	// "entered", every folder it reads (as its path from root, "" being root itself) before any of its files.
+	// Neither is ever called by two threads at once. Returns false if the root folder can't be read. If anything
+	// throws (found included), the walk stops and the first exception is rethrown here, once every worker's done.
+	bool FileSniffer::sniff(const std::function<void(const std::string&)>& found, const std::function<void(const std::string&)>& entered)
 	{
 		namespace fs = std::filesystem;
 		std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-		std::vector<std::string> results; bool success;
-		std::string buffer;
 
 		//quick integrity check on path given
+		if (path.empty())
+			return false;
 		if (path.back() != '/' && path.back() != '\\')
 			path.push_back('/');
 
-		try {
-			for (auto& file : fs::recursive_directory_iterator(path)) {
-				buffer = path2string(file);
+		std::error_code ec;
+		if (!fs::is_directory(path, ec))
+			return false;
+
+		std::deque<std::pair<fs::path, int>> pending = { { fs::path(path), 0 } }; //folder and its depth
+		int busy = 0;
+		bool failed = false;
+		std::exception_ptr thrown; //first exception out of any worker, handed on once they're all done
+		std::mutex lock, reporting;
+		std::condition_variable wakeup;
+
+		auto worker = [&]() {
+			std::unique_lock<std::mutex> guard(lock);
+
+			while (true) {
+				wakeup.wait(guard, [&] { return !pending.empty() || busy == 0; });
+				if (pending.empty())
+					return; //nothing queued and nobody left to queue anything
+
+				std::pair<fs::path, int> folder = std::move(pending.front());
+				pending.pop_front();
+				++busy;
+				guard.unlock();
+
+				std::vector<std::pair<fs::path, int>> subfolders;
+				std::exception_ptr error;
+				try {
+					std::error_code err;
+					fs::directory_iterator it(folder.first, fs::directory_options::skip_permission_denied, err);
+
+					if (err && folder.second == 0) {
+						std::lock_guard<std::mutex> flag(lock);
+						failed = true;
+					}
+					else if (!err && entered) {
+						std::string name = (folder.second == 0) ? "" : fileName(folder.first.string(), 2, path);
+						std::lock_guard<std::mutex> report(reporting);
+						entered(name);
+					}
 
-				if (fileName(buffer, 0) == extension)
-					results.push_back(fileName(buffer, printmode, path));
+					for (; !err && it != fs::directory_iterator(); it.increment(err)) {
+						const fs::path& entry = it->path();
+						if (isExcluded(entry))
+							continue;
+
+						std::error_code staterr;
+						if (it->is_directory(staterr)) {
+							if (!it->is_symlink(staterr) && (maxDepth < 0 || folder.second < maxDepth))
+								subfolders.emplace_back(entry, folder.second + 1);
+						}
+						else if (matchesExtension(entry)) {
+							std::string result = fileName(entry.string(), printmode, path);
+							std::lock_guard<std::mutex> report(reporting);
+							found(result);
+						}
+					}
+				}
+				catch (...) {
+					error = std::current_exception();
+				}
+
+				guard.lock();
+				if (error && !thrown)
+					thrown = error;
+				if (thrown) //no point in going any further
+					pending.clear();
+				else {
+					for (auto& sub : subfolders)
+						pending.push_back(std::move(sub));
+				}
+				--busy;
+				wakeup.notify_all();
 			}
-			success = results.size() > 0;
-		}
-		catch (...) {
-			success = false;
-			results.clear();
-		}
+		};
+
+		unsigned numThreads = (threads > 0) ? threads : std::thread::hardware_concurrency();
+		if (numThreads == 0)
+			numThreads = 1;
+
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < numThreads; ++i)
+			pool.emplace_back(worker);
+		worker();
+
+		for (auto& th : pool)
+			th.join();
 
-		return std::pair<bool, std::vector<std::string>>(success, results);
+		if (thrown)
+			std::rethrow_exception(thrown);
+		return !failed;
 	}
 }
\ No newline at end of file
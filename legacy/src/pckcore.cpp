@@ -3,18 +3,26 @@
  *
  * This is the implementation file for the framework core. Include any utility headers
  * below, should they contain classes for the execution and/or configuration of other
- * utilities to be called by the framework.
+ * utilities to be called by the framework. Utilities that aren't built in are plugins,
+ * see PluginRegistry.
  */
 #include "pckcore.hpp"
 #include "matrixinator.hpp"
 #include <iostream>
 #include <sstream>
 
-int main()
+int main(int argc, char** argv)
 {
+	//headless Matrixinator query service, no curses involved
+	if (argc > 1 && std::string(argv[1]) == "--serve")
+		return mtx::QueryService::daemon(argc - 2, argv + 2);
+
 	pck::Peacock* pck = new pck::Peacock();
 	pck->main_menu();
 
+	pck::JobRunner::shared().shutdown(); //jobs still going are cancelled, and stop as soon as they get to check
+	mtx::MatrixConfig::closeAll();
+	pck::FileIndex::closeAll();
 	endwin();
 	delete pck;
 
@@ -40,6 +48,10 @@ namespace pck {
 			stdscr_initialized = true;
 		}
 		startY = 0;
+
+		//only the manifests are read here, libraries wait until they're picked
+		plugins.addBuiltin("The Matrixinator", &mtx_plugin_entry);
+		plugins.discover(PluginRegistry::defaultFolder());
 	}
 
 	// private:
@@ -47,68 +59,85 @@ namespace pck {
 	// Selects an option
 	void Peacock::parseopt(int& option)
 	{
-		if (option == 0) { //matrixinator
-
-			mtx::MatrixConfig* mtxconfig = new mtx::MatrixConfig;
-			mtxconfig->mtxMenu();
-			printheader();
-			option = 0;
-			delete mtxconfig;
-		}
-		else if (option == 1) { //documentator
+		std::string error;
+		int code = 0;
+		if (!plugins.open(option, code, error)) { //couldn't be loaded: say why under the menu
 			redflash(startY + option, 3, (int)projects.at(option).length());
+			Screen::shared().erase(startY + (int)projects.size() + 1);
+			Screen::shared().print(startY + (int)projects.size() + 1, 0, "<" + error + ">", COLOR_PAIR(ERRCOLOR));
+			Screen::shared().flush();
+			return;
+		}
+
+		Screen::shared().invalidate(); //the utility drew whatever it liked
+		printheader();
+		if (code != 0) { //it ran, but couldn't start
+			Screen::shared().printf(startY + (int)projects.size() + 1, 0, COLOR_PAIR(ERRCOLOR), "<%s couldn't start (code %d)>", projects.at(option).c_str(), code);
+			Screen::shared().flush();
 		}
+		option = 0;
 	}
 
 	// Leading header
 	void Peacock::printheader() 
 	{
-		clear();
+		Screen& screen = Screen::shared();
+		screen.erase();
 		raw(); noecho(); nonl(); curs_set(0);
 
-		int any;
-		attrset(COLOR_PAIR(114));
-		printw("Peacock Framework v%s (%s)", PCKVER, PCKRELEASE);					  //0
+		int any = -1;
+		int x = screen.printf(0, 0, COLOR_PAIR(114), "Peacock Framework v%s (%s)", PCKVER, PCKRELEASE); //0
 		if (has_colors()) {
-			printw(" - Now with ");
-			addch('c' | COLOR_PAIR(RAINBOW1)); //red
-			addch('o' | COLOR_PAIR(RAINBOW2)); //orange
-			addch('l' | COLOR_PAIR(RAINBOW3)); //yellow
-			addch('o' | COLOR_PAIR(RAINBOW4)); //green
-			addch('r' | COLOR_PAIR(RAINBOW5)); //blue
-			addch('s' | COLOR_PAIR(RAINBOW6)); //indigo
-			addch('!' | COLOR_PAIR(RAINBOW7)); //purple
+			static const char colors[] = "colors!";
+			x = screen.print(0, x, " - Now with ", COLOR_PAIR(114));
+			for (int i = 0; i < 7; ++i) //red, orange, yellow, green, blue, indigo, purple
+				x = screen.print(0, x, std::string(1, colors[i]), COLOR_PAIR(RAINBOW1 + i));
 		}
 		
-		printw("\n(c) Leonardo Valim & Joshua Walker, all rights reserved.\n"		  //1
-			     "--------------------------------------------------------\n");	      //2
-			
-		printw("Press right-arrow or enter to select. Press F1 to quit.\n\n");        //3
-		getyx(stdscr, startY, any);	any = -1;										  //5
-		attrset(COLOR_PAIR(COLOR_BLACK));
+		screen.print(1, 0, "(c) Leonardo Valim & Joshua Walker, all rights reserved.", COLOR_PAIR(114));	//1
+		screen.print(2, 0, "--------------------------------------------------------", COLOR_PAIR(114));	//2
+		screen.print(3, 0, "Press right-arrow or enter to select. Press F1 to quit.", COLOR_PAIR(114));	//3
+		startY = 5;
 
 		projects.clear();
-		projects = {
-			"The Matrixinator",
-			"The Documentator",
-			"Exit program (F1)"
-		};
+		for (auto& entry : plugins.getEntries())
+			projects.push_back(entry.name);
+		projects.push_back("Exit program (F1)");
 		
-		printopts(projects);
+		printopts(startY, projects);
 		updatepos(any, 0, startY, projects);
-		refresh();
+		showJobPanel();
+		screen.flush();
 	}
 
 	// Flashes a particular option red. Signals "not yet implemented"
 	void Peacock::redflash(int y, int x, int chars) 
 	{
-		mvchgat(y, x, chars, A_REVERSE | COLOR_PAIR(111), 1, NULL); refresh();
-		sleep(100);
-		mvchgat(y, x, chars, A_REVERSE, 0, NULL); refresh();
-		sleep(100);
-		mvchgat(y, x, chars, A_REVERSE | COLOR_PAIR(111), 1, NULL); refresh();
-		sleep(100);
-		mvchgat(y, x, chars, A_REVERSE, 0, NULL); refresh();
+		Screen& screen = Screen::shared();
+		for (int i = 0; i < 2; ++i) {
+			screen.paint(y, x, chars, A_REVERSE | COLOR_PAIR(111)); screen.flush();
+			sleep(100);
+			screen.paint(y, x, chars, A_REVERSE); screen.flush();
+			if (i == 0)
+				sleep(100);
+		}
+	}
+
+	// Asks before leaving when that would cancel jobs that are still going. True if it's fine to leave.
+	bool Peacock::confirmExit()
+	{
+		int active = JobRunner::shared().active();
+		if (active == 0)
+			return true;
+
+		Screen& screen = Screen::shared();
+		const int y = startY + (int)projects.size() + 1;
+		screen.printf(y, 0, COLOR_PAIR(ERRCOLOR), "%d job(s) still running, quitting cancels them. Quit anyway? (y/n)", active);
+		screen.flush();
+		int answer = getch();
+		screen.erase(y);
+		screen.flush();
+		return answer == 'y' || answer == 'Y';
 	}
 
 	// public:
@@ -116,8 +145,10 @@ namespace pck {
 	// Main menu, core of the framework
 	void Peacock::main_menu() 
 	{
-		printheader();
-		menu(startY, projects, true);
+		do {
+			printheader();
+			menu(startY, projects, true);
+		} while (!confirmExit());
 
 		//exit routine
 		int endX, endY;
@@ -130,6 +161,12 @@ namespace pck {
 			mvprintw(endY, endX + 23, "%d...", i); refresh();
 			sleep(1000);
 		}
+
+		int active = JobRunner::shared().active();
+		if (active > 0) {
+			mvprintw(endY + 1, endX, "Stopping %d job(s)... ", active);
+			refresh();
+		}
 		return;
 	}
 }
\ No newline at end of file
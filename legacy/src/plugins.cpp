@@ -0,0 +1,165 @@
+#include "pckcore.hpp"
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+namespace pck {
+	// ===============================================================================
+	//                                 PluginRegistry                                =
+	// ===============================================================================
+
+	// Whitespace off both ends
+	static std::string trimmed(const std::string& text)
+	{
+		size_t from = text.find_first_not_of(" \t\r\n"), to = text.find_last_not_of(" \t\r\n");
+		return (from == std::string::npos) ? std::string() : text.substr(from, to - from + 1);
+	}
+
+	// Destructor: loaded libraries go last, once nothing can call into them anymore
+	PluginRegistry::~PluginRegistry()
+	{
+		for (Entry& entry : entries) {
+			if (entry.handle == nullptr)
+				continue;
+#ifdef _WIN32
+			FreeLibrary((HMODULE)entry.handle);
+#else
+			dlclose(entry.handle);
+#endif
+		}
+	}
+
+	// The "plugins" folder next to the executable, or in the working folder if there's no telling where that is
+	std::string PluginRegistry::defaultFolder()
+	{
+		std::filesystem::path exe;
+#ifdef _WIN32
+		char buffer[MAX_PATH];
+		DWORD length = GetModuleFileNameA(nullptr, buffer, MAX_PATH);
+		if (length > 0 && length < MAX_PATH)
+			exe = std::string(buffer, length);
+#else
+		std::error_code ec;
+		exe = std::filesystem::read_symlink("/proc/self/exe", ec);
+#endif
+		if (exe.empty())
+			return "plugins";
+		return (exe.parent_path() / "plugins").string();
+	}
+
+	// A utility that's linked into the executable
+	void PluginRegistry::addBuiltin(const std::string& name, PckPluginEntry entry)
+	{
+		entries.push_back({ name, std::string(), std::string(), entry, nullptr, nullptr, std::string() });
+	}
+
+	// Reads every manifest in the folder, in file name order, without loading anything. Returns how many were
+	// usable; ones without a name or a library are skipped.
+	int PluginRegistry::discover(const std::string& folder)
+	{
+		std::error_code ec;
+		std::vector<std::filesystem::path> manifests;
+		for (std::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec)) {
+			if (it->path().extension() == ".plugin")
+				manifests.push_back(it->path());
+		}
+		std::sort(manifests.begin(), manifests.end());
+
+		int found = 0;
+		for (auto& manifest : manifests) {
+			std::ifstream file(manifest);
+			Entry entry = { std::string(), std::string(), "pck_plugin_entry", nullptr, nullptr, nullptr, std::string() };
+
+			std::string line;
+			while (std::getline(file, line)) {
+				line = line.substr(0, line.find('#'));
+				size_t equals = line.find('=');
+				if (equals == std::string::npos)
+					continue;
+
+				std::string key = trimmed(line.substr(0, equals)), value = trimmed(line.substr(equals + 1));
+				if (key == "name")
+					entry.name = value;
+				else if (key == "library")
+					entry.library = (manifest.parent_path() / value).string();
+				else if (key == "entry" && !value.empty())
+					entry.symbol = value;
+			}
+
+			if (!entry.name.empty() && !entry.library.empty()) {
+				entries.push_back(entry);
+				++found;
+			}
+		}
+		return found;
+	}
+
+	// Everything the menu may offer, in order
+	const std::vector<PluginRegistry::Entry>& PluginRegistry::getEntries() const
+	{
+		return entries;
+	}
+
+	// Loads a plugin's library and checks what its entry point hands back. False (with the reason in the entry)
+	// if any of it goes wrong; it isn't tried again.
+	bool PluginRegistry::load(Entry& entry)
+	{
+		if (entry.entry == nullptr) {
+#ifdef _WIN32
+			HMODULE handle = LoadLibraryA(entry.library.c_str());
+			if (handle == nullptr) {
+				entry.error = "can't load " + entry.library;
+				return false;
+			}
+			entry.handle = handle;
+			entry.entry = (PckPluginEntry)GetProcAddress(handle, entry.symbol.c_str());
+#else
+			void* handle = dlopen(entry.library.c_str(), RTLD_NOW | RTLD_LOCAL);
+			if (handle == nullptr) {
+				const char* why = dlerror();
+				entry.error = (why != nullptr) ? why : "can't load " + entry.library;
+				return false;
+			}
+			entry.handle = handle;
+			entry.entry = (PckPluginEntry)dlsym(handle, entry.symbol.c_str());
+#endif
+			if (entry.entry == nullptr) {
+				entry.error = entry.library + " has no " + entry.symbol;
+				return false;
+			}
+		}
+
+		const PckPlugin* plugin = entry.entry();
+		if (plugin == nullptr || plugin->run == nullptr) {
+			entry.error = entry.name + " didn't hand back a plugin";
+			return false;
+		}
+		if (plugin->abi != PCK_PLUGIN_ABI) {
+			entry.error = entry.name + " is built for plugin ABI " + std::to_string(plugin->abi) + ", not " + std::to_string(PCK_PLUGIN_ABI);
+			return false;
+		}
+		entry.plugin = plugin;
+		return true;
+	}
+
+	// Runs a utility, loading it first if it's the first time, and hands back what it returned in "code".
+	// False (and why in "error") if it couldn't be loaded, and so never ran.
+	bool PluginRegistry::open(size_t index, int& code, std::string& error)
+	{
+		if (index >= entries.size()) {
+			error = "no such utility";
+			return false;
+		}
+
+		Entry& entry = entries[index];
+		if (entry.plugin == nullptr && (!entry.error.empty() || !load(entry))) {
+			error = entry.error;
+			return false;
+		}
+		code = entry.plugin->run();
+		return true;
+	}
+}
@@ -0,0 +1,477 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "matrixinator.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+namespace mtx {
+	// ===============================================================================
+	//                                  QueryService                                 =
+	// ===============================================================================
+
+	namespace fs = std::filesystem;
+
+#ifdef _WIN32
+	typedef SOCKET socket_t;
+	static const socket_t badSocket = INVALID_SOCKET;
+	static void closeSocket(socket_t sock) { closesocket(sock); }
+	static void hangUp(socket_t sock) { shutdown(sock, SD_BOTH); }
+#else
+	typedef int socket_t;
+	static const socket_t badSocket = -1;
+	static void closeSocket(socket_t sock) { close(sock); }
+	static void hangUp(socket_t sock) { shutdown(sock, SHUT_RDWR); }
+#endif
+	//so a client hanging up mid-answer doesn't take the whole service down with SIGPIPE (POSIX only)
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+	static const size_t maxRequest = 4096;  //longest line a client may send
+
+	// Keys come in as bytes, the same way the sheets are read (and go out through Matrixinator::w_narrow)
+	static std::wstring widen(std::string_view str)
+	{
+		return std::wstring(str.begin(), str.end());
+	}
+
+	// Sends the whole buffer, however many calls it takes
+	static bool sendAll(socket_t sock, const std::string& data)
+	{
+		size_t sent = 0;
+		while (sent < data.size()) {
+			int count = (int)send(sock, data.data() + sent, (int)(data.size() - sent), MSG_NOSIGNAL);
+			if (count <= 0)
+				return false;
+			sent += (size_t)count;
+		}
+		return true;
+	}
+
+	// Constructor. An empty socket path means the default one.
+	QueryService::QueryService(const RunConfig& config, const std::string& socketPath)
+		: reloading(false), stopping(false), running(false), served(0)
+	{
+		this->config = config;
+		this->socketPath = (socketPath.empty()) ? defaultSocket() : socketPath;
+		server = (uintptr_t)badSocket;
+	}
+
+	// Destructor
+	QueryService::~QueryService()
+	{
+		stop();
+	}
+
+	// Where the socket goes when nobody says otherwise: the temp directory on Windows (already the user's own),
+	// a directory of the user's own under it elsewhere
+	std::string QueryService::defaultSocket()
+	{
+		std::error_code ec;
+		fs::path temp = fs::temp_directory_path(ec);
+#ifndef _WIN32
+		temp /= "matrixinator-" + std::to_string(geteuid());
+#endif
+		return (temp / "matrixinator.sock").string();
+	}
+
+	// True if a service answers on the socket at "address"
+	static bool answers(const sockaddr_un& address)
+	{
+		socket_t probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe == badSocket)
+			return false;
+		const bool answered = connect(probe, (const sockaddr*)&address, sizeof(address)) == 0;
+		closeSocket(probe);
+		return answered;
+	}
+
+#ifndef _WIN32
+	// Makes sure "folder" is there, and that it's a directory nobody but this user can get into. False if it isn't,
+	// and error says why.
+	static bool privateFolder(const std::string& folder, std::string& error)
+	{
+		struct stat info;
+		if (mkdir(folder.c_str(), 0700) != 0 && errno != EEXIST) {
+			error = "could not create " + folder;
+			return false;
+		}
+		if (lstat(folder.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() || (info.st_mode & 077) != 0) {
+			error = folder + " isn't a directory of this user's own";
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	// Loads and indexes the inputs into a brand new snapshot. Null if it failed, and error says why.
+	std::shared_ptr<const QueryService::Snapshot> QueryService::load(long long generation, std::string& error)
+	{
+		if (!config.ioDefined()) {
+			error = "could not find both files";
+			return nullptr;
+		}
+
+		std::shared_ptr<Snapshot> snapshot = std::make_shared<Snapshot>();
+		snapshot->generation = generation;
+		snapshot->mtx.reset(new Matrixinator(config, TreeCache::get));
+
+		//reading and post-init only, the sweep is what queries do one row at a time
+		int code = snapshot->mtx->run(2);
+		if (code != 0) {
+			error = (snapshot->mtx->getFailure().empty()) ? "could not load the inputs (code " + std::to_string(code) + ")" : snapshot->mtx->getFailure();
+			return nullptr;
+		}
+
+		const Matrixinator& mtx = *snapshot->mtx;
+		snapshot->rows.reserve(mtx.SS.size());
+		for (int i = 0; i < (int)mtx.SS.size(); ++i)
+			snapshot->rows.emplace(mtx.SS[i].data.front(), i);
+
+		snapshot->reference.assign(mtx.SS.size(), 0);
+		for (const int& item : mtx.USAsamples)
+			snapshot->reference[item] = 1;
+
+		return snapshot;
+	}
+
+	// Loads the inputs, then starts listening. False if either failed, and error says why.
+	bool QueryService::start(std::string& error)
+	{
+		if (running)
+			return true;
+
+#ifdef _WIN32
+		static bool winsock = false;
+		WSADATA wsa;
+		if (!winsock && WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+			error = "could not start Winsock";
+			return false;
+		}
+		winsock = true;
+#endif
+
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socketPath.size() >= sizeof(address.sun_path)) {
+			error = "socket path is too long";
+			return false;
+		}
+		memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+		std::shared_ptr<const Snapshot> first = load(1, error);
+		if (!first)
+			return false;
+		std::atomic_store(&current, first);
+
+#ifndef _WIN32
+		//the default socket goes in a directory only its owner can get into, so it's never open to anyone else,
+		//not even between bind and chmod
+		if (socketPath == defaultSocket() && !privateFolder(fs::path(socketPath).parent_path().string(), error))
+			return false;
+#endif
+
+		//a socket file left behind by a service that died would make bind fail. Only that is removed: not a
+		//service that still answers, and not anything that isn't a socket at all.
+		std::error_code ec;
+		if (fs::exists(fs::symlink_status(socketPath, ec))) {
+#ifndef _WIN32
+			struct stat info;
+			if (lstat(socketPath.c_str(), &info) != 0 || !S_ISSOCK(info.st_mode)) {
+				error = socketPath + " is in the way, and isn't a socket";
+				return false;
+			}
+#endif
+			if (answers(address)) {
+				error = "another service is listening on " + socketPath;
+				return false;
+			}
+			fs::remove(socketPath, ec);
+		}
+
+		socket_t sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock == badSocket) {
+			error = "could not create the socket";
+			return false;
+		}
+
+		//the socket file is created by bind, and only its owner may connect to it. Linux gives the file the
+		//socket's own mode, elsewhere the chmod right after closes the gap. No umask: it's the whole process's.
+#ifdef _WIN32
+		const bool bound = bind(sock, (sockaddr*)&address, sizeof(address)) == 0;
+#else
+		const bool bound = fchmod(sock, 0600) == 0 && bind(sock, (sockaddr*)&address, sizeof(address)) == 0 && chmod(socketPath.c_str(), 0600) == 0;
+#endif
+		if (!bound || ::listen(sock, 16) != 0) {
+			closeSocket(sock);
+			error = "could not listen on " + socketPath;
+			return false;
+		}
+
+		server = (uintptr_t)sock;
+		stopping = false;
+		running = true;
+		listener = std::thread(&QueryService::listen, this);
+		return true;
+	}
+
+	// Stops listening, hangs up on every client and waits for them to go
+	void QueryService::stop()
+	{
+		stopping = true;
+		bool bound = (socket_t)server != badSocket;
+		if (bound)
+			hangUp((socket_t)server); //wakes up accept()
+		if (listener.joinable())
+			listener.join();
+		if (bound) {
+			closeSocket((socket_t)server);
+			server = (uintptr_t)badSocket;
+		}
+
+		std::lock_guard<std::mutex> guard(clientsLock);
+		for (Client& client : clients)
+			hangUp((socket_t)client.socket);
+		for (Client& client : clients) {
+			if (client.thread.joinable())
+				client.thread.join();
+			closeSocket((socket_t)client.socket);
+		}
+		clients.clear();
+
+		if (bound) {
+			std::error_code ec;
+			fs::remove(socketPath, ec);
+		}
+		running = false;
+	}
+
+	// Listener thread: one thread per client, cleaning up after those who left
+	void QueryService::listen()
+	{
+		while (!stopping) {
+			socket_t sock = accept((socket_t)server, nullptr, nullptr);
+			if (sock == badSocket) {
+				if (stopping)
+					break;
+				pck::sleep(10);
+				continue;
+			}
+
+			std::lock_guard<std::mutex> guard(clientsLock);
+			for (auto it = clients.begin(); it != clients.end();) {
+				if (it->done) {
+					it->thread.join();
+					closeSocket((socket_t)it->socket);
+					it = clients.erase(it);
+				}
+				else
+					++it;
+			}
+
+			clients.emplace_back();
+			Client& client = clients.back();
+			client.socket = (uintptr_t)sock;
+			client.thread = std::thread(&QueryService::serve, this, std::ref(client));
+		}
+		running = false;
+	}
+
+	// Client thread: answers every complete line as it comes in, all of a read's answers in one go
+	void QueryService::serve(Client& client)
+	{
+		socket_t sock = (socket_t)client.socket;
+		std::string buffer;
+		char chunk[4096];
+
+		while (!stopping) {
+			int count = (int)recv(sock, chunk, sizeof(chunk), 0);
+			if (count <= 0)
+				break;
+			buffer.append(chunk, count);
+
+			std::string answers;
+			size_t eol;
+			while ((eol = buffer.find('\n')) != std::string::npos) {
+				std::string request = buffer.substr(0, eol);
+				buffer.erase(0, eol + 1);
+				if (!request.empty() && request.back() == '\r')
+					request.pop_back();
+				if (!request.empty())
+					answers += answer(request) + "\n";
+			}
+
+			if (buffer.size() > maxRequest)
+				answers += "err,request too long\n";
+			if ((!answers.empty() && !sendAll(sock, answers)) || buffer.size() > maxRequest)
+				break;
+		}
+
+		hangUp(sock); //closed when the thread's reaped
+		client.done = true;
+	}
+
+	// Answers a single request against whatever snapshot is current right now
+	std::string QueryService::answer(const std::string& request)
+	{
+		std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current);
+		const Matrixinator& mtx = *snapshot->mtx;
+		pck::Tokens fields(request, ',');
+		std::string_view pieces[3];
+		size_t count = 0;
+		for (auto it = fields.begin(); it != fields.end() && count < 3; ++it)
+			pieces[count++] = *it;
+		++served;
+
+		if (count == 0)
+			return "err,empty request";
+		const std::string_view& command = pieces[0];
+		const double sweepThreshold = mtx.config.thresholds.front();
+		char number[64];
+
+		if (command == "predict" || command == "matches") {
+			if (count < 2)
+				return "err,missing key";
+			const std::string key(pieces[1]);
+			auto row = snapshot->rows.find(widen(pieces[1]));
+			if (row == snapshot->rows.end())
+				return "err,unknown key";
+
+			std::vector<int> matches;
+			std::vector<double> similarities;
+
+			if (command == "predict") {
+				std::array<double, 8> octagon;
+				std::string reply = "ok," + key;
+
+				if (snapshot->reference[row->second]) {
+					octagon.fill(-2); //a reference without one still says so, with the sheet's null values
+					if (mtx.octagons.has(row->second))
+						mtx.octagons.get(row->second, octagon.data());
+					reply += ",measured";
+				}
+				else if (mtx.findMatches(row->second, sweepThreshold, matches, similarities) > 0) {
+					mtx.blend(matches, similarities, octagon);
+					reply += ",predicted";
+				}
+				else
+					return reply + ",none";
+
+				for (double& value : octagon) {
+					snprintf(number, sizeof(number), ",%.8f", value);
+					reply += number;
+				}
+				return reply;
+			}
+
+			double threshold = (count > 2) ? atof(std::string(pieces[2]).c_str()) : sweepThreshold;
+			if (threshold <= 0 || threshold > 100)
+				return "err,threshold must be above 0 and up to 100";
+
+			int found = mtx.findMatches(row->second, threshold, matches, similarities);
+			std::string reply = "ok," + key + "," + std::to_string(found);
+			for (int i = 0; i < found; ++i) {
+				snprintf(number, sizeof(number), "=%.8f", similarities[i]);
+				reply += "," + Matrixinator::w_narrow(mtx.SS[matches[i]].data.front()) + number;
+			}
+			return reply;
+		}
+
+		else if (command == "reload") {
+			//only this client waits on it, everyone else keeps going on the old snapshot
+			if (reloading.exchange(true))
+				return "err,already reloading";
+
+			std::string error;
+			std::shared_ptr<const Snapshot> fresh = load(snapshot->generation + 1, error);
+			if (fresh)
+				std::atomic_store(&current, fresh);
+			reloading = false;
+
+			if (!fresh)
+				return "err," + error;
+			return "ok,reloaded," + std::to_string(fresh->mtx->numSamples);
+		}
+
+		else if (command == "status") {
+			return "ok," + std::to_string(mtx.numSamples) + "," + std::to_string(mtx.USAsamples.size()) + "," +
+				std::to_string(mtx.numNodes) + "," + std::to_string(snapshot->generation);
+		}
+
+		else if (command == "shutdown") {
+			//the owner notices through isRunning() and cleans up with stop()
+			stopping = true;
+			hangUp((socket_t)server);
+			return "ok,bye";
+		}
+
+		return "err,unknown request \"" + std::string(command) + "\"";
+	}
+
+	// Headless service: "--serve <dendrogram> <metadata> [socket]", runs until a client asks it to shut down
+	int QueryService::daemon(int argc, char** argv)
+	{
+		if (argc < 2) {
+			fprintf(stderr, "usage: --serve <dendrogram> <metadata> [socket]\n");
+			return 2;
+		}
+
+		RunConfig config;
+		fs::path tree = fs::absolute(fs::path(argv[0])).lexically_normal(), meta = fs::absolute(fs::path(argv[1])).lexically_normal();
+		if (!config.setInputs(tree, meta) || !config.ioDefined()) {
+			fprintf(stderr, "could not find both files\n");
+			return 2;
+		}
+
+		QueryService service(config, (argc > 2) ? argv[2] : "");
+		std::string error;
+		fprintf(stdout, "The Matrixinator v%s: loading %s and %s... ", MTXVER, config.paths.getTree().c_str(), config.paths.getMeta().c_str());
+		fflush(stdout);
+		if (!service.start(error)) {
+			fprintf(stdout, "failed.\n-> %s\n", error.c_str());
+			return 1;
+		}
+		fprintf(stdout, "done.\nListening on %s\n", service.getSocket().c_str());
+		fflush(stdout);
+
+		while (service.isRunning())
+			pck::sleep(200);
+		service.stop();
+
+		fprintf(stdout, "Shut down after %lld queries.\n", service.getServed());
+		return 0;
+	}
+
+	// Getters
+	bool QueryService::isRunning() const
+	{
+		return running && !stopping;
+	}
+	bool QueryService::isReloading() const
+	{
+		return reloading;
+	}
+	long long QueryService::getServed() const
+	{
+		return served;
+	}
+	long long QueryService::getGeneration() const
+	{
+		std::shared_ptr<const Snapshot> snapshot = std::atomic_load(&current);
+		return (snapshot) ? snapshot->generation : 0;
+	}
+	const std::string& QueryService::getSocket() const
+	{
+		return socketPath;
+	}
+}
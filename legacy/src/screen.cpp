@@ -0,0 +1,175 @@
+#include "pckcore.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+
+namespace pck {
+	// ===============================================================================
+	//                                     Screen                                    =
+	// ===============================================================================
+
+	// Constructor. The model takes the terminal's size the first time it's used.
+	Screen::Screen()
+	{
+		rows = 0;
+		cols = 0;
+		everything = true;
+	}
+
+	// The one for stdscr
+	Screen& Screen::shared()
+	{
+		static Screen screen;
+		return screen;
+	}
+
+	// Keeps the model as big as stdscr, holding on to whatever still fits
+	void Screen::fit()
+	{
+		const int height = getmaxy(stdscr), width = getmaxx(stdscr);
+		if (height == rows && width == cols)
+			return;
+
+		std::vector<chtype> resized((size_t)std::max(height, 0) * std::max(width, 0), (chtype)' ');
+		for (int y = 0; y < std::min(rows, height); ++y)
+			std::copy_n(cells.begin() + (size_t)y * cols, std::min(cols, width), resized.begin() + (size_t)y * width);
+
+		cells.swap(resized);
+		rows = height;
+		cols = width;
+		dirtyFrom.assign(rows, cols);
+		dirtyTo.assign(rows, 0);
+		everything = true;
+	}
+
+	// Widens a row's damage to cover [from, to)
+	void Screen::mark(int y, int from, int to)
+	{
+		dirtyFrom[y] = std::min(dirtyFrom[y], from);
+		dirtyTo[y] = std::max(dirtyTo[y], to);
+	}
+
+	// Size, in cells
+	int Screen::height()
+	{
+		fit();
+		return rows;
+	}
+	int Screen::width()
+	{
+		fit();
+		return cols;
+	}
+
+	// Blanks the whole model, to draw a new frame on. Nothing's repainted but what ends up different.
+	void Screen::erase()
+	{
+		fit();
+		std::fill(cells.begin(), cells.end(), (chtype)' ');
+		for (int y = 0; y < rows; ++y)
+			mark(y, 0, cols);
+	}
+
+	// Blanks a row from a column on, like clrtoeol()
+	void Screen::erase(int y, int x)
+	{
+		fit();
+		if (y < 0 || y >= rows || x >= cols)
+			return;
+		x = std::max(x, 0);
+		std::fill(cells.begin() + (size_t)y * cols + x, cells.begin() + (size_t)(y + 1) * cols, (chtype)' ');
+		mark(y, x, cols);
+	}
+
+	// Puts text on a row, cut off at the edge rather than wrapped. Returns the column right after it.
+	int Screen::print(int y, int x, const std::string& text, chtype attr)
+	{
+		fit();
+		if (y < 0 || y >= rows || x < 0 || x >= cols)
+			return x;
+
+		const int length = std::min((int)text.size(), cols - x);
+		chtype* cell = cells.data() + (size_t)y * cols + x;
+		for (int i = 0; i < length; ++i)
+			cell[i] = (chtype)(unsigned char)text[i] | attr;
+		mark(y, x, x + length);
+		return x + length;
+	}
+
+	// Same as above, printf style
+	int Screen::printf(int y, int x, chtype attr, const char* format, ...)
+	{
+		char text[512];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		return print(y, x, text, attr);
+	}
+
+	// Changes the attributes (and color) of cells already there, like chgat()
+	void Screen::paint(int y, int x, int length, chtype attr)
+	{
+		fit();
+		if (y < 0 || y >= rows || x >= cols)
+			return;
+
+		x = std::max(x, 0);
+		length = std::min(length, cols - x);
+		chtype* cell = cells.data() + (size_t)y * cols + x;
+		for (int i = 0; i < length; ++i)
+			cell[i] = (cell[i] & A_CHARTEXT) | attr;
+		if (length > 0)
+			mark(y, x, x + length);
+	}
+
+	// Sends curses whatever changed since the last flush, in runs of cells, and refreshes. The cursor's left
+	// where it was.
+	void Screen::flush()
+	{
+		fit();
+		int cursorY, cursorX; getyx(stdscr, cursorY, cursorX);
+
+		for (int y = 0; y < rows; ++y) {
+			const int from = (everything) ? 0 : dirtyFrom[y], to = (everything) ? cols : dirtyTo[y];
+			const chtype* row = cells.data() + (size_t)y * cols;
+
+			for (int x = from; x < to; ) {
+				if (!everything && mvwinch(stdscr, y, x) == row[x]) {
+					++x;
+					continue;
+				}
+				const int start = x;
+				while (x < to && (everything || mvwinch(stdscr, y, x) != row[x]))
+					++x;
+				mvwaddchnstr(stdscr, y, start, row + start, x - start);
+			}
+			dirtyFrom[y] = cols;
+			dirtyTo[y] = 0;
+		}
+
+		if (everything)
+			touchwin(stdscr);
+		everything = false;
+		move(cursorY, cursorX);
+		refresh();
+	}
+
+	// The terminal no longer shows what stdscr holds: the next flush sends every cell
+	void Screen::invalidate()
+	{
+		everything = true;
+	}
+
+	// Follows the terminal to its new size, after a KEY_RESIZE, and repaints. Never smaller than minY x minX.
+	void Screen::resize(int minY, int minX)
+	{
+		resize_term(0, 0);
+		if (getmaxy(stdscr) < minY || getmaxx(stdscr) < minX)
+			resize_term(std::max(getmaxy(stdscr), minY), std::max(getmaxx(stdscr), minX));
+
+		fit();
+		everything = true;
+		flush();
+	}
+}
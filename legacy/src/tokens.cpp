@@ -0,0 +1,125 @@
+#include "pckcore.hpp"
+#include <cwchar>
+#include <cstring>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PCK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PCK_AVX2
+#else
+#define PCK_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace pck {
+	// ===============================================================================
+	//                                     Tokens                                    =
+	// ===============================================================================
+
+#ifdef PCK_X86
+	// Index of the lowest set bit (mask is never 0)
+	static inline unsigned lowestBit(unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (unsigned)index;
+#else
+		return (unsigned)__builtin_ctz(mask);
+#endif
+	}
+
+	// True if the CPU and the OS both do AVX2
+	static bool hasAVX2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) //OSXSAVE, AVX
+			return false;
+		if ((_xgetbv(0) & 6) != 6) //the OS saves the YMM registers
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	// Compares 16 bytes at a time against the character, as wide as it is
+	template<class Ch>
+	static const Ch* scanSSE2(const Ch* from, const Ch* end, Ch ch)
+	{
+		const size_t step = 16 / sizeof(Ch);
+		const __m128i needle = (sizeof(Ch) == 1) ? _mm_set1_epi8((char)ch) :
+			(sizeof(Ch) == 2) ? _mm_set1_epi16((short)ch) : _mm_set1_epi32((int)ch);
+
+		for (; (size_t)(end - from) >= step; from += step) {
+			__m128i block = _mm_loadu_si128((const __m128i*)from);
+			__m128i hits = (sizeof(Ch) == 1) ? _mm_cmpeq_epi8(block, needle) :
+				(sizeof(Ch) == 2) ? _mm_cmpeq_epi16(block, needle) : _mm_cmpeq_epi32(block, needle);
+			unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+			if (mask != 0)
+				return from + lowestBit(mask) / sizeof(Ch);
+		}
+		for (; from < end; ++from) {
+			if (*from == ch)
+				return from;
+		}
+		return end;
+	}
+
+	// Same, 32 bytes at a time
+	template<class Ch>
+	PCK_AVX2 static const Ch* scanAVX2(const Ch* from, const Ch* end, Ch ch)
+	{
+		const size_t step = 32 / sizeof(Ch);
+		const __m256i needle = (sizeof(Ch) == 1) ? _mm256_set1_epi8((char)ch) :
+			(sizeof(Ch) == 2) ? _mm256_set1_epi16((short)ch) : _mm256_set1_epi32((int)ch);
+
+		for (; (size_t)(end - from) >= step; from += step) {
+			__m256i block = _mm256_loadu_si256((const __m256i*)from);
+			__m256i hits = (sizeof(Ch) == 1) ? _mm256_cmpeq_epi8(block, needle) :
+				(sizeof(Ch) == 2) ? _mm256_cmpeq_epi16(block, needle) : _mm256_cmpeq_epi32(block, needle);
+			unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+			if (mask != 0)
+				return from + lowestBit(mask) / sizeof(Ch);
+		}
+		return scanSSE2(from, end, ch); //what's left is under 32 bytes
+	}
+
+	// Picked once, the first time anything's scanned
+	template<class Ch>
+	static const Ch* (*pickScanner())(const Ch*, const Ch*, Ch)
+	{
+		return (hasAVX2()) ? &scanAVX2<Ch> : &scanSSE2<Ch>;
+	}
+#endif
+
+	// First occurrence of ch in [from, end), or end if there's none
+	const char* scanFor(const char* from, const char* end, char ch)
+	{
+#ifdef PCK_X86
+		static const auto scanner = pickScanner<char>();
+		return scanner(from, end, ch);
+#else
+		const char* found = (const char*)memchr(from, ch, end - from);
+		return (found != nullptr) ? found : end;
+#endif
+	}
+	const wchar_t* scanFor(const wchar_t* from, const wchar_t* end, wchar_t ch)
+	{
+#ifdef PCK_X86
+		static const auto scanner = pickScanner<wchar_t>();
+		return scanner(from, end, ch);
+#else
+		const wchar_t* found = wmemchr(from, ch, end - from);
+		return (found != nullptr) ? found : end;
+#endif
+	}
+}
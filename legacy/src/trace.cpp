@@ -0,0 +1,132 @@
+#include "pckcore.hpp"
+#include <algorithm>
+#include <cstdio>
+
+namespace pck {
+	// ===============================================================================
+	//                                     Tracer                                    =
+	// ===============================================================================
+
+	std::mutex Tracer::registryLock;
+	std::vector<std::shared_ptr<Tracer::Ring>> Tracer::rings;
+	unsigned Tracer::threads = 0;
+	size_t Tracer::capacity = 1 << 16;
+
+	// Lives as long as its thread does, then lets the ring go once it's been dumped
+	struct Tracer::Owner {
+		std::shared_ptr<Ring> ring;
+
+		~Owner()
+		{
+			if (ring) {
+				std::lock_guard<std::mutex> guard(ring->lock);
+				ring->retired = true;
+			}
+		}
+	};
+
+	// This thread's ring, made and registered the first time it records anything
+	Tracer::Ring& Tracer::local()
+	{
+		thread_local Owner owner;
+		if (!owner.ring) {
+			owner.ring = std::make_shared<Ring>();
+			std::lock_guard<std::mutex> guard(registryLock);
+			owner.ring->thread = ++threads;
+			rings.push_back(owner.ring);
+		}
+		return *owner.ring;
+	}
+
+	// Nanoseconds since the first time anyone asked
+	long long Tracer::now()
+	{
+		static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	// Adds a span to this thread's ring, over its oldest one if it's full
+	void Tracer::record(const char* name, long long start, long long end)
+	{
+		Ring& ring = local();
+		std::lock_guard<std::mutex> guard(ring.lock);
+		if (ring.spans.size() < capacity)
+			ring.spans.push_back({ name, start, end });
+		else if (!ring.spans.empty()) {
+			ring.spans[ring.next] = { name, start, end };
+			ring.next = (ring.next + 1) % ring.spans.size();
+		}
+	}
+
+	// Writes every span recorded since the last dump as Chrome trace-event JSON, then empties the rings.
+	// False if the file couldn't be written (the spans are gone either way).
+	bool Tracer::dump(const std::string& path)
+	{
+		std::vector<std::shared_ptr<Ring>> all;
+		{
+			std::lock_guard<std::mutex> guard(registryLock);
+			all = rings;
+			rings.erase(std::remove_if(rings.begin(), rings.end(), [](const std::shared_ptr<Ring>& ring) {
+				std::lock_guard<std::mutex> hold(ring->lock);
+				return ring->retired;
+			}), rings.end());
+		}
+
+		std::ofstream file(path, std::ofstream::trunc);
+		if (!file.is_open())
+			return false;
+
+		//complete ("X") events in microseconds, plus a name for every thread that shows up
+		char buffer[64];
+		bool first = true;
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		for (auto& ring : all) {
+			std::vector<Span> spans;
+			{
+				std::lock_guard<std::mutex> guard(ring->lock);
+				spans.assign(ring->spans.begin() + ring->next, ring->spans.end());
+				spans.insert(spans.end(), ring->spans.begin(), ring->spans.begin() + ring->next);
+				ring->spans.clear();
+				ring->next = 0;
+			}
+			if (spans.empty())
+				continue;
+
+			file << ((first) ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->thread
+				<< ",\"args\":{\"name\":\"thread " << ring->thread << "\"}}";
+			first = false;
+
+			for (Span& span : spans) {
+				file << ",\n{\"name\":\"";
+				for (const char* ch = span.name; *ch != '\0'; ++ch) {
+					if (*ch == '"' || *ch == '\\')
+						file << '\\';
+					file << *ch;
+				}
+				snprintf(buffer, sizeof(buffer), "%.3f", span.start / 1000.0);
+				file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread << ",\"ts\":" << buffer;
+				snprintf(buffer, sizeof(buffer), "%.3f", (span.end - span.start) / 1000.0);
+				file << ",\"dur\":" << buffer << "}";
+			}
+		}
+		file << "\n]}\n";
+		return (bool)file;
+	}
+
+	// ===============================================================================
+	//                                   TraceScope                                  =
+	// ===============================================================================
+
+	// Constructor: the span starts
+	TraceScope::TraceScope(const char* name)
+	{
+		this->name = name;
+		start = Tracer::now();
+	}
+
+	// Destructor: the span ends
+	TraceScope::~TraceScope()
+	{
+		Tracer::record(name, start, Tracer::now());
+	}
+}
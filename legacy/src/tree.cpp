@@ -1,4 +1,11 @@
 #include "matrixinator.hpp"
+#include <fstream>
+#include <sstream>
+#include <climits>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
 
 namespace mtx {
 
@@ -39,12 +46,6 @@ namespace mtx {
         similarity = sim;
     }
 
-    // Adds an ID to this node's child list
-    void Tree::addChild(int childID) 
-    {
-        childList.insert(childID);
-    }
-
     // Toggles whether or not this is a sample node
     void Tree::makeSample()
     {
@@ -71,12 +72,6 @@ namespace mtx {
         return similarity;
     }
 
-    // Returns the list of children for this node
-    std::set<int> Tree::getChildren() 
-    {
-        return childList;
-    }
-
     // Returns true if the current node is a sample, false otherwise
     bool Tree::isSample() 
     {
@@ -84,4 +79,704 @@ namespace mtx {
     }
 
 
-}
\ No newline at end of file
+    // ===============================================================================
+    //                                   TreeIndex                                   =
+    // ===============================================================================
+
+    // Constructor
+    TreeIndex::TreeIndex()
+    {
+        numNodes = 0;
+    }
+
+    // Throws closing code 3 if whoever's loading the tree has been cancelled
+    static void checkCancelled(const std::atomic<bool>* cancelled)
+    {
+        if (cancelled != nullptr && *cancelled)
+            throw 3;
+    }
+
+    // Loads and lays out a dendrogram, all in one go, with up to "threads" threads
+    std::shared_ptr<const TreeIndex> TreeIndex::build(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled,
+        unsigned threads)
+    {
+        std::shared_ptr<TreeIndex> index = std::make_shared<TreeIndex>();
+        if (pck::hasPackedExtension(std::filesystem::path(file), "nwk|newick"))
+            index->loadNewick(file, progress, cancelled);
+        else
+            index->load(file, progress, cancelled, std::max(threads, 1u));
+        checkCancelled(cancelled);
+        index->layout(cancelled);
+        return index;
+    }
+
+    // One node as it's written in the tree file
+    struct NodeRecord {
+        int id;
+        int parent;
+        double sim;
+        bool sample;
+    };
+
+    // An ID as written, with anything out of an int's range pinned to its ends rather than wrapped around
+    static int readID(const char* text)
+    {
+        return (int)std::max<long long>(std::min<long long>(std::strtoll(text, nullptr, 10), INT_MAX), INT_MIN);
+    }
+
+    // Reads the nodes from "begin" (an ID's opening quote) up to "end". Every node is three quoted values: ID,
+    // parent ID and similarity, and it's a sample unless its element closes right after the last one. Gives up
+    // early once "cancelled" is set.
+    static void parseNodes(const char* begin, const char* end, std::vector<NodeRecord>& nodes, pck::Progress& progress,
+        const std::atomic<bool>* cancelled)
+    {
+        const char* quote[6];
+        const char* ch = begin;
+        int read = 0;
+
+        while (true) {
+            int found = 0;
+            for (; found < 6; ++found) {
+                quote[found] = (const char*)memchr(ch, '\"', end - ch);
+                if (quote[found] == nullptr)
+                    break;
+                ch = quote[found] + 1;
+            }
+            if (found < 6)
+                break;
+
+            NodeRecord node;
+            node.id = readID(quote[0] + 1);
+            node.parent = readID(quote[2] + 1);
+            node.sim = std::strtod(quote[4] + 1, nullptr);
+            node.sample = (quote[5] + 1 == end || quote[5][1] != '/');
+            nodes.push_back(node);
+
+            if (++read % 4096 == 0)
+                progress.advance(4096);
+            if (cancelled != nullptr && *cancelled)
+                return;
+        }
+        progress.advance(read % 4096);
+    }
+
+    // Runs "task" for every index below "count", on up to "threads" threads at once (the calling one among them)
+    static void shareOut(size_t count, unsigned threads, const std::function<void(size_t)>& task)
+    {
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t i = next++; i < count; i = next++)
+                task(i);
+        };
+
+        std::vector<std::future<void>> helpers;
+        for (size_t t = 1; t < std::min<size_t>(count, threads); ++t)
+            helpers.push_back(std::async(std::launch::async, worker));
+        worker();
+        for (auto& helper : helpers)
+            helper.get();
+    }
+
+    // Where the last node that starts in "data" starts (its ID's opening quote), or 0 if only the first one does.
+    // Data starts at a node, or before the first one.
+    static size_t lastNode(const char* data, size_t size)
+    {
+        size_t found = 0, at = 0;
+        for (const char* ch = data; (ch = (const char*)memchr(ch, '\"', data + size - ch)) != nullptr; ++ch, ++found) {
+            if (found % 6 == 0)
+                at = ch - data;
+        }
+        return at;
+    }
+
+    // Parses every node from "data" (a node's first quote, or anything before it) up to "end", split in chunks at
+    // node boundaries and parsed by "threads" threads. Each chunk's nodes go after the ones already in "chunks".
+    static void parseBlock(const char* data, const char* end, std::vector<std::vector<NodeRecord>>& chunks, unsigned threads,
+        pck::Progress& progress, const std::atomic<bool>* cancelled)
+    {
+        const size_t size = end - data;
+
+        //about 4 chunks per thread, none under a megabyte
+        const size_t count = std::max<size_t>(1, std::min<size_t>((size_t)threads * 4, size >> 20));
+        std::vector<const char*> cuts(count + 1);
+        for (size_t i = 0; i <= count; ++i)
+            cuts[i] = data + size / count * i;
+        cuts[count] = end;
+
+        //nodes are six quotes each, so where one starts depends on how many quotes came before: count them per chunk
+        std::vector<size_t> quotes(count, 0);
+        shareOut(count, threads, [&](size_t i) {
+            PCK_TRACE_SCOPE("count quotes");
+            size_t found = 0;
+            for (const char* ch = cuts[i]; (ch = (const char*)memchr(ch, '\"', cuts[i + 1] - ch)) != nullptr; ++ch)
+                ++found;
+            quotes[i] = found;
+        });
+        checkCancelled(cancelled);
+
+        //then move every cut up to the next node's first quote
+        std::vector<const char*> starts(count + 1, end);
+        size_t before = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t index = before;
+            for (const char* ch = cuts[i]; (ch = (const char*)memchr(ch, '\"', end - ch)) != nullptr; ++ch, ++index) {
+                if (index % 6 == 0) {
+                    starts[i] = ch;
+                    break;
+                }
+            }
+            before += quotes[i];
+        }
+
+        const size_t first = chunks.size();
+        chunks.resize(first + count);
+        shareOut(count, threads, [&](size_t i) {
+            PCK_TRACE_SCOPE("parse nodes");
+            parseNodes(starts[i], starts[i + 1], chunks[first + i], progress, cancelled);
+        });
+        checkCancelled(cancelled);
+    }
+
+    // Reads the tree file: split in chunks at node boundaries, parsed in parallel, then every node put in its ID's
+    // slot. Plain files are mapped and parsed whole; packed ones are decompressed and parsed a block at a time.
+    void TreeIndex::load(const std::string& path, pck::Progress& progress, const std::atomic<bool>* cancelled, unsigned threads)
+    {
+        PCK_TRACE_SCOPE("load tree (xml)");
+        std::vector<std::vector<NodeRecord>> chunks;
+        if (pck::Unpacker::sniff(path) == pck::Packer::plain) {
+            //let's work with thin streams this time, shall we?
+            pck::MappedFile file;
+            if (!file.open(path, cancelled)) {
+                checkCancelled(cancelled);
+                throw std::runtime_error("can't read " + path);
+            }
+            parseBlock(file.data(), file.data() + file.size(), chunks, threads, progress, cancelled);
+        }
+        else {
+            pck::Unpacker file;
+            if (!file.open(path))
+                throw std::runtime_error("can't read " + path);
+            file.feed([&](const char* data, size_t size, bool last, size_t& used) {
+                used = (last) ? size : lastNode(data, size);
+                if (used > 0)
+                    parseBlock(data, data + used, chunks, threads, progress, cancelled);
+                return true;
+            });
+        }
+
+        //node 0 is a fictional root of roots, and IDs without a node stay just as empty. IDs may skip a few, but a
+        //table mostly made of gaps would only be a way to run out of memory.
+        int maxID = 0;
+        size_t count = 0;
+        for (auto& chunk : chunks) {
+            for (auto& node : chunk)
+                maxID = std::max(maxID, node.id);
+            count += chunk.size();
+        }
+        if ((size_t)maxID > count * 4 + 1024)
+            throw std::runtime_error(path + ": node IDs go up to " + std::to_string(maxID) + ", for only " + std::to_string(count) + " nodes");
+        acacia.assign((size_t)maxID + 1, Tree());
+
+        shareOut(chunks.size(), threads, [&](size_t i) {
+            PCK_TRACE_SCOPE("place nodes");
+            for (auto& node : chunks[i]) {
+                if (node.id < 1)
+                    continue;
+                Tree& slot = acacia[node.id];
+                slot.setIDs(node.id, node.parent);
+                slot.setSim(node.sim);
+                if (node.sample)
+                    slot.makeSample();
+            }
+            std::vector<NodeRecord>().swap(chunks[i]);
+        });
+
+        numNodes = (int)acacia.size() - 1; //node 0 is a fictional node
+    }
+
+    // Where the number or unquoted label at "ch" ends: the first character past it, or "end"
+    static const char* tokenEnd(const char* ch, const char* end, bool number)
+    {
+        if (number) {
+            while (ch < end && (isdigit((unsigned char)*ch) || strchr("+-.eE", *ch) != nullptr))
+                ++ch;
+            return ch;
+        }
+        while (ch < end && strchr("()[]':;, \t\n\r", *ch) == nullptr)
+            ++ch;
+        return ch;
+    }
+
+    // True if the whole of the token at "ch" is there before "end", so it can't be cut short by a block's end. A
+    // quote right at the end could still turn out to be doubled.
+    static bool wholeToken(const char* ch, const char* end)
+    {
+        if (*ch == '[')
+            return pck::scanFor(ch, end, ']') < end;
+        if (*ch == ':')
+            return tokenEnd(ch + 1, end, true) < end;
+        if (*ch == '\'') {
+            for (++ch; ch < end; ++ch) {
+                if (*ch == '\'') {
+                    if (ch + 1 == end)
+                        return false;
+                    if (ch[1] != '\'')
+                        return true;
+                    ++ch;
+                }
+            }
+            return false;
+        }
+        if (strchr("(),;", *ch) != nullptr)
+            return true;
+        return tokenEnd(ch, end, false) < end;
+    }
+
+    // Reads a Newick tree file in one pass. Nodes are numbered as they open, so parents always come before their
+    // children just like in the .xml, and every leaf is a sample. Branch lengths are distances: a node's height is
+    // its longest way down to a leaf, and its similarity 100 minus that (times 100 first if no height goes over 1,
+    // as then they're fractions). Several trees (one per ';') make a forest. Packed files are decompressed a block at
+    // a time, each one parsed up to its last whole token.
+    void TreeIndex::loadNewick(const std::string& path, pck::Progress& progress, const std::atomic<bool>* cancelled)
+    {
+        PCK_TRACE_SCOPE("load tree (newick)");
+        std::vector<int> parents(1, 0);
+        std::vector<double> lengths(1, 0);
+        std::vector<bool> leaves(1, false);
+        std::vector<std::string> names(1);
+        std::vector<int> open;      //internal nodes whose ')' hasn't come up yet
+        int current = 0;            //node a label or length would go to
+        bool expecting = false;     //right after '(' or ',', where a node has to follow
+        bool named = false;
+        const char* base = nullptr; //the block being parsed, which starts "consumed" bytes into the file
+        const char* ch = nullptr;
+        const char* end = nullptr;
+        size_t consumed = 0;
+
+        auto newNode = [&](bool leaf) {
+            parents.push_back((open.empty()) ? 0 : open.back());
+            lengths.push_back(0);
+            leaves.push_back(leaf);
+            names.emplace_back();
+            if (parents.size() % 4096 == 0) {
+                progress.advance(4096);
+                checkCancelled(cancelled);
+            }
+            return (int)parents.size() - 1;
+        };
+        auto malformed = [&](const char* what) {
+            throw std::runtime_error(path + ": " + what + " at byte " + std::to_string(consumed + (ch - base)));
+        };
+
+        //parses a block up to its end, or if there's more to come, up to its last whole token; returns how far it got
+        auto parse = [&](const char* data, size_t size, bool last) {
+            base = ch = data;
+            end = data + size;
+            while (ch < end) {
+                char c = *ch;
+                if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                    ++ch;
+                    continue;
+                }
+                if (!last && !wholeToken(ch, end))
+                    break;
+                if (c == '[') { //comment
+                    ch = pck::scanFor(ch, end, ']');
+                    ch += (ch < end);
+                    continue;
+                }
+
+                //a leaf with no label at all, as in "(,)" or "(:1,:2)"
+                if (expecting && (c == ',' || c == ')' || c == ':')) {
+                    current = newNode(true);
+                    expecting = false;
+                }
+
+                if (c == '(') {
+                    if (current != 0)
+                        malformed("'(' after a node");
+                    open.push_back(newNode(false));
+                    expecting = true;
+                    ++ch;
+                }
+                else if (c == ',') {
+                    if (open.empty())
+                        malformed("',' outside parentheses");
+                    current = 0;
+                    expecting = true;
+                    ++ch;
+                }
+                else if (c == ')') {
+                    if (open.empty())
+                        malformed("unmatched ')'");
+                    current = open.back();
+                    open.pop_back();
+                    ++ch;
+                }
+                else if (c == ';') {
+                    if (!open.empty())
+                        malformed("unclosed '('");
+                    current = 0;
+                    ++ch;
+                }
+                else if (c == ':') {
+                    if (current == 0)
+                        malformed("branch length without a node");
+                    char number[64];
+                    size_t used = 0;
+                    for (++ch; ch < end && used + 1 < sizeof(number) && (isdigit((unsigned char)*ch) || strchr("+-.eE", *ch) != nullptr); ++ch)
+                        number[used++] = *ch;
+                    number[used] = '\0';
+                    lengths[current] = std::max(0.0, std::strtod(number, nullptr));
+                }
+                else {
+                    //label: quoted ('' being a quote) or running up to the next special character. Underscores are
+                    //left alone, since the label has to match the metadata's key exactly.
+                    std::string label;
+                    if (c == '\'') {
+                        for (++ch; ch < end; ++ch) {
+                            if (*ch == '\'') {
+                                if (ch + 1 < end && ch[1] == '\'')
+                                    ++ch;
+                                else
+                                    break;
+                            }
+                            label.push_back(*ch);
+                        }
+                        if (ch == end)
+                            malformed("unclosed quote");
+                        ++ch;
+                    }
+                    else {
+                        const char* start = ch;
+                        ch = tokenEnd(ch, end, false);
+                        label.assign(start, ch);
+                    }
+
+                    if (current == 0) {
+                        current = newNode(true);
+                        names[current] = std::move(label);
+                        named = named || !names[current].empty();
+                        expecting = false;
+                    }
+                    //labels on internal nodes are usually support values, nothing this tree has a use for
+                }
+            }
+            const size_t used = ch - base;
+            consumed += used;
+            base = ch;
+            return used;
+        };
+
+        if (pck::Unpacker::sniff(path) == pck::Packer::plain) {
+            pck::MappedFile file;
+            if (!file.open(path, cancelled)) {
+                checkCancelled(cancelled);
+                throw std::runtime_error("can't read " + path);
+            }
+            parse(file.data(), file.size(), true);
+        }
+        else {
+            pck::Unpacker file;
+            if (!file.open(path))
+                throw std::runtime_error("can't read " + path);
+            file.feed([&](const char* data, size_t size, bool last, size_t& used) {
+                used = parse(data, size, last);
+                return true;
+            });
+        }
+        if (!open.empty())
+            malformed("unclosed '('");
+        progress.advance((long long)(parents.size() % 4096));
+
+        numNodes = (int)parents.size() - 1;
+        acacia.assign((size_t)numNodes + 1, Tree());
+
+        //children always come after their parents, so one backwards pass finds every height
+        std::vector<double> heights((size_t)numNodes + 1, 0);
+        for (int i = numNodes; i >= 1; --i) {
+            if (parents[i] != 0)
+                heights[parents[i]] = std::max(heights[parents[i]], heights[i] + lengths[i]);
+        }
+        double top = 0;
+        for (int i = 1; i <= numNodes; ++i)
+            top = std::max(top, heights[i]);
+        const double scale = (top <= 1) ? 100 : 1;
+
+        for (int i = 1; i <= numNodes; ++i) {
+            acacia[i].setIDs(i, parents[i]);
+            acacia[i].setSim(std::min(100.0, std::max(0.0, 100 - heights[i] * scale)));
+            if (leaves[i])
+                acacia[i].makeSample();
+        }
+
+        if (named)
+            labels = std::move(names);
+    }
+
+    // A node's parent, or 0 if it's a root. Same rule bullSim walks the tree by.
+    int TreeIndex::parentOf(int node) const
+    {
+        int parent = acacia[node].IDs.second;
+        if (parent < 1 || parent > numNodes || acacia[parent].IDs.first < 1)
+            return 0;
+        return parent;
+    }
+
+    // Depth-first sample order, node ranges, the jump table and the joins between neighbouring samples. Checks
+    // "cancelled" between (and every so often within) each of them.
+    void TreeIndex::layout(const std::atomic<bool>* cancelled)
+    {
+        PCK_TRACE_SCOPE("lay out tree");
+        const int size = numNodes + 1;
+
+        //children lists, in file order
+        std::vector<int> childStart(size + 1, 0), children(size);
+        for (int i = 1; i <= numNodes; ++i)
+            ++childStart[parentOf(i) + 1];
+        for (int i = 0; i < size; ++i)
+            childStart[i + 1] += childStart[i];
+        std::vector<int> fill(childStart.begin(), childStart.end() - 1);
+        for (int i = 1; i <= numNodes; ++i)
+            children[fill[parentOf(i)]++] = i;
+
+        depth.assign(size, -1);
+        position.assign(size, -1);
+        first.assign(size, 0);
+        last.assign(size, 0);
+        std::vector<int> samples, visit;    //samples in depth-first order, nodes in visiting order
+        visit.reserve(size);
+        checkCancelled(cancelled);
+
+        //node 0 parents every root, so one walk from it covers the whole forest. Anything not reached
+        //is stuck in a loop of parents and gets no position at all, just as it never gets swept.
+        std::vector<std::pair<int, int>> stack = { { 0, childStart[0] } };
+        while (!stack.empty()) {
+            int node = stack.back().first, next = stack.back().second;
+
+            if (next < childStart[node + 1]) {
+                if ((visit.size() & 0xFFFF) == 0)
+                    checkCancelled(cancelled);
+                ++stack.back().second;
+                int child = children[next];
+                depth[child] = depth[node] + 1;
+                first[child] = (int)samples.size();
+                if (acacia[child].sample) {
+                    position[child] = (int)samples.size();
+                    samples.push_back(child);
+                }
+                visit.push_back(child);
+                stack.push_back({ child, childStart[child] });
+            }
+            else {
+                last[node] = (int)samples.size();
+                stack.pop_back();
+            }
+        }
+
+        //jump table: level 0 is the parent, every level doubles the one below it
+        int deepest = 0;
+        for (int& d : depth)
+            deepest = std::max(deepest, d);
+        levels = 1;
+        while ((1 << levels) <= deepest)
+            ++levels;
+
+        lift.assign((size_t)levels * size, 0);
+        liftMin.assign((size_t)levels * size, 0);
+        for (int& node : visit) {
+            int parent = parentOf(node);
+            lift[node] = parent;
+            liftMin[node] = acacia[parent].similarity;
+        }
+        for (int k = 1; k < levels; ++k) {
+            checkCancelled(cancelled);
+            for (int& node : visit) { //parents before children, so the level below is always ready
+                int half = lift[(size_t)(k - 1) * size + node];
+                lift[(size_t)k * size + node] = lift[(size_t)(k - 1) * size + half];
+                liftMin[(size_t)k * size + node] = std::min(liftMin[(size_t)(k - 1) * size + node], liftMin[(size_t)(k - 1) * size + half]);
+            }
+        }
+
+        checkCancelled(cancelled);
+        joins.assign((samples.empty()) ? 0 : samples.size() - 1, 0);
+        for (size_t q = 0; q + 1 < samples.size(); ++q) {
+            if ((q & 0xFFFF) == 0)
+                checkCancelled(cancelled);
+            joins[q] = common(samples[q], samples[q + 1]);
+        }
+    }
+
+    // A node's ancestor at a given depth (no deeper than the node's own)
+    int TreeIndex::ancestor(int node, int atDepth) const
+    {
+        const size_t size = (size_t)numNodes + 1;
+        for (int k = levels - 1; k >= 0; --k) {
+            if (depth[node] - (1 << k) >= atDepth)
+                node = lift[k * size + node];
+        }
+        return node;
+    }
+
+    // Lowest common ancestor of two nodes, 0 if they're in different trees
+    int TreeIndex::common(int a, int b) const
+    {
+        const size_t size = (size_t)numNodes + 1;
+        if (depth[a] < depth[b])
+            std::swap(a, b);
+
+        for (int k = levels - 1; k >= 0; --k) {
+            if (depth[a] - (1 << k) >= depth[b])
+                a = lift[k * size + a];
+        }
+        if (a == b)
+            return a;
+
+        for (int k = levels - 1; k >= 0; --k) {
+            if (lift[k * size + a] != lift[k * size + b]) {
+                a = lift[k * size + a];
+                b = lift[k * size + b];
+            }
+        }
+        return lift[a];
+    }
+
+    // Highest node a sample can climb to without going through anything less than "threshold" similar,
+    // the sample itself included. 0 if the sample itself is already below it.
+    int TreeIndex::highest(int node, double threshold) const
+    {
+        const size_t size = (size_t)numNodes + 1;
+        if (node < 1 || node > numNodes || position[node] < 0 || acacia[node].similarity < threshold)
+            return 0;
+
+        for (int k = levels - 1; k >= 0; --k) {
+            if (lift[k * size + node] != 0 && liftMin[k * size + node] >= threshold)
+                node = lift[k * size + node];
+        }
+        return node;
+    }
+
+    // Number of nodes, fictional node 0 not included
+    int TreeIndex::getNumNodes() const
+    {
+        return numNodes;
+    }
+
+    // Number of sample nodes
+    int TreeIndex::getNumSamples() const
+    {
+        int count = 0;
+        for (int i = 1; i <= numNodes; ++i)
+            count += acacia[i].sample;
+        return count;
+    }
+
+
+    // ===============================================================================
+    //                                   TreeCache                                   =
+    // ===============================================================================
+
+    // Statics
+    std::mutex TreeCache::lock;
+    std::vector<TreeCache::Slot> TreeCache::slots;
+    unsigned long long TreeCache::clock = 0;
+    size_t TreeCache::capacity = 2;
+
+    // Returns the tree index for a dendrogram file, building it only if the cache doesn't have this very file.
+    // A build that's cancelled leaves the cache; whoever was waiting on it builds it again.
+    std::shared_ptr<const TreeIndex> TreeCache::get(const std::string& file, pck::Progress& progress, const std::atomic<bool>* cancelled,
+        unsigned threads)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::string key = fs::weakly_canonical(fs::path(file), ec).string();
+        uintmax_t size = fs::file_size(file, ec);
+        long long stamp = (long long)fs::last_write_time(file, ec).time_since_epoch().count();
+
+        std::promise<std::shared_ptr<const TreeIndex>> promise;
+        std::shared_future<std::shared_ptr<const TreeIndex>> index;
+        bool mine = false;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto slot = std::find_if(slots.begin(), slots.end(), [&](const Slot& s) { return s.key == key; });
+
+            if (slot != slots.end() && slot->size == size && slot->stamp == stamp) {
+                slot->used = ++clock;
+                index = slot->index;
+            }
+            else {
+                if (slot != slots.end()) //same file, but it changed since
+                    slots.erase(slot);
+
+                //make room by dropping the least recently used; runs still holding it keep their copy
+                while (!slots.empty() && slots.size() >= capacity) {
+                    slots.erase(std::min_element(slots.begin(), slots.end(),
+                        [](const Slot& a, const Slot& b) { return a.used < b.used; }));
+                }
+
+                index = promise.get_future().share();
+                slots.push_back({ key, size, stamp, ++clock, index });
+                mine = true;
+            }
+        }
+
+        if (mine) {
+            try {
+                promise.set_value(TreeIndex::build(file, progress, cancelled, threads));
+            }
+            catch (...) {
+                //don't keep a failure around, the next run (or one waiting on this) gets to try again
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const Slot& s) { return s.key == key && s.stamp == stamp; }), slots.end());
+                }
+                promise.set_exception(std::current_exception());
+            }
+        }
+
+        try {
+            return index.get(); //rethrows if building failed
+        }
+        catch (const int code) {
+            if (mine || code != 3)
+                throw;
+        }
+        checkCancelled(cancelled);
+        return get(file, progress, cancelled, threads); //someone else's build, and they were cancelled
+    }
+
+    // True if the cache holds an up to date index for this file
+    bool TreeCache::has(const std::string& file)
+    {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        std::string key = fs::weakly_canonical(fs::path(file), ec).string();
+        uintmax_t size = fs::file_size(file, ec);
+        long long stamp = (long long)fs::last_write_time(file, ec).time_since_epoch().count();
+
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto& slot : slots) {
+            if (slot.key == key && slot.size == size && slot.stamp == stamp)
+                return true;
+        }
+        return false;
+    }
+
+    // Drops a dendrogram file's tree, whatever version of it is cached. Runs still holding it keep their copy.
+    void TreeCache::drop(const std::string& file)
+    {
+        std::error_code ec;
+        std::string key = std::filesystem::weakly_canonical(std::filesystem::path(file), ec).string();
+
+        std::lock_guard<std::mutex> guard(lock);
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [&](const Slot& s) { return s.key == key; }), slots.end());
+    }
+
+    // Drops every cached tree
+    void TreeCache::clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        slots.clear();
+    }
+}